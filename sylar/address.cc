@@ -1,5 +1,6 @@
 #include "address.h"
 #include "log.h"
+#include "offload.h"
 #include <sstream>
 #include <netdb.h>
 #include <ifaddrs.h>
@@ -136,7 +137,11 @@ bool Address::Lookup(std::vector<Address::ptr>& result, const std::string& host,
         node = host;
     }
     // 使用前面解析得到的`node`和`service`（可能为NULL），以及`hints`进行地址解析
-    int error = getaddrinfo(node.c_str(), service, &hints, &results);
+    //DNS解析会阻塞整个线程, 在协程中时放到offload线程池执行
+    int error = 0;
+    Offload([&](){
+        error = getaddrinfo(node.c_str(), service, &hints, &results);
+    });
     if(error) {
         SYLAR_LOG_ERROR(g_logger) << "Address::Lookup getaddress(" << host << ", "
             << family << ", " << type << ") err=" << error << " errstr="
@@ -0,0 +1,114 @@
+#include "channel.h"
+#include "util.h"
+
+namespace sylar {
+
+void ChannelBase::close() {
+    std::vector<FiberWaiter::ptr> waiters;
+    {
+        MutexType::Lock lock(m_mutex);
+        if(m_closed) {
+            return;
+        }
+        m_closed = true;
+        while(FiberWaiter::ptr waiter = m_readers.pop()) {
+            waiters.push_back(waiter);
+        }
+        while(FiberWaiter::ptr waiter = m_writers.pop()) {
+            waiters.push_back(waiter);
+        }
+    }
+    for(auto& i : waiters) {
+        i->wake(false);
+    }
+}
+
+bool ChannelBase::isClosed() {
+    MutexType::Lock lock(m_mutex);
+    return m_closed;
+}
+
+void ChannelBase::passReader() {
+    MutexType::Lock lock(m_mutex);
+    if(!hasItemLocked()) {
+        return;
+    }
+    FiberWaiter::ptr waiter = m_readers.pop();
+    lock.unlock();
+    if(waiter) {
+        waiter->wake();
+    }
+}
+
+uint64_t ChannelBase::Deadline(uint64_t timeout_ms) {
+    if(timeout_ms == ~0ull) {
+        return ~0ull;
+    }
+    return GetCurrentMS() + timeout_ms;
+}
+
+uint64_t ChannelBase::Remaining(uint64_t deadline) {
+    if(deadline == ~0ull) {
+        return ~0ull;
+    }
+    uint64_t now = GetCurrentMS();
+    return deadline > now ? deadline - now : 0;
+}
+
+int ChannelBase::WaitReadable(const std::vector<ChannelBase*>& chans
+                              ,uint64_t timeout_ms, bool& notified) {
+    uint64_t deadline = Deadline(timeout_ms);
+    notified = false;
+    while(true) {
+        //同一个等待者排到所有还开着的空通道上, 任一通道push都能唤醒它
+        FiberWaiter::ptr waiter;
+        std::vector<ChannelBase*> added;
+        int ready = -1;
+        size_t closed = 0;
+        //不等待时也要把所有通道检查一遍
+        bool can_wait = Remaining(deadline) > 0;
+        for(size_t i = 0; i < chans.size(); ++i) {
+            ChannelBase* ch = chans[i];
+            MutexType::Lock lock(ch->m_mutex);
+            if(ch->hasItemLocked()) {
+                ready = i;
+                break;
+            }
+            if(ch->m_closed) {
+                ++closed;
+                continue;
+            }
+            if(!can_wait) {
+                continue;
+            }
+            if(!waiter) {
+                waiter.reset(new FiberWaiter);
+            }
+            ch->m_readers.push(waiter);
+            added.push_back(ch);
+        }
+
+        bool park = waiter && ready < 0 && closed + added.size() == chans.size();
+        bool woken = false;
+        if(park) {
+            woken = waiter->park(Remaining(deadline));
+        }
+        for(auto& ch : added) {
+            MutexType::Lock lock(ch->m_mutex);
+            ch->m_readers.remove(waiter);
+        }
+        if(waiter && !park) {
+            woken = waiter->cancel();
+        }
+        notified = notified || woken;
+        if(ready >= 0) {
+            return ready;
+        }
+        if(!park || !woken) {
+            //超时或全部关闭
+            return -1;
+        }
+    }
+}
+
+}
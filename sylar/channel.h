@@ -0,0 +1,220 @@
+#ifndef __SYLAR_CHANNEL_H__
+#define __SYLAR_CHANNEL_H__
+
+/*
+  协程间的有界多生产者多消费者通道
+
+  push满了/pop空了只挂起当前协程, 不阻塞线程; 不在协程中时阻塞线程, 可以和协程混用.
+  push/pop唤醒对端时, 对端上次在当前线程运行的话直接切换过去(见FiberWaiter::wake),
+  同一线程上的流水线各级之间交接不经过任务队列.
+  容量有界, 下游处理不过来时上游push自然挂起, 流水线各级之间有背压.
+  数据放在按2的幂对齐的连续环形缓冲中, 下标用掩码计算.
+
+  close之后push返回false, pop把剩下的数据取完后返回false.
+  Channel<T>::Select同时等待多个同类型通道中任意一个有数据.
+  超时单位ms, ~0ull为不超时, 0为不等待; 协程中带超时等待必须在IOManager里
+*/
+
+#include <stdint.h>
+#include <memory>
+#include <utility>
+#include <vector>
+#include "fiber_sync.h"
+#include "log.h"
+#include "macro.h"
+
+namespace sylar {
+
+/**
+ * @brief 与元素类型无关的部分: 锁, 等待队列, 关闭和多通道等待
+ */
+class ChannelBase {
+public:
+    typedef Spinlock MutexType;
+
+    virtual ~ChannelBase() {}
+
+    // 关闭通道, 唤醒所有等待者
+    void close();
+    bool isClosed();
+
+    /**
+     * @brief 等待多个通道中任意一个有数据
+     * @param[in] chans 通道列表
+     * @param[in] timeout_ms 超时时间
+     * @param[out] notified 是否被通道唤醒过, 为true时调用者取走数据后应对其他通道passReader
+     * @return 有数据的通道下标, 超时或全部已关闭且为空返回-1
+     */
+    static int WaitReadable(const std::vector<ChannelBase*>& chans
+                            ,uint64_t timeout_ms, bool& notified);
+protected:
+    // 是否有数据, 持锁调用
+    virtual bool hasItemLocked() const = 0;
+
+    /**
+     * @brief 有数据时把读唤醒交给下一个读者
+     * @details select被一个通道唤醒却从另一个通道取了数据时调用, 避免唤醒丢失
+     */
+    void passReader();
+
+    // 超时时间换算为截止时间(ms)
+    static uint64_t Deadline(uint64_t timeout_ms);
+    // 距离截止时间还有多久, 0为已超时
+    static uint64_t Remaining(uint64_t deadline);
+protected:
+    MutexType m_mutex;
+    FiberWaitQueue m_readers;
+    FiberWaitQueue m_writers;
+    bool m_closed = false;
+};
+
+/**
+ * @brief 有界通道
+ * @details T需要可默认构造和移动赋值, 取出后槽位重置为T()
+ */
+template<class T>
+class Channel : public ChannelBase {
+public:
+    typedef std::shared_ptr<Channel> ptr;
+
+    /**
+     * @brief 构造函数
+     * @param[in] capacity 容量, 大于0
+     */
+    Channel(size_t capacity)
+        :m_capacity(capacity) {
+        SYLAR_ASSERT(capacity > 0);
+        size_t n = 1;
+        while(n < capacity) {
+            n <<= 1;
+        }
+        m_buffer.resize(n);
+        m_mask = n - 1;
+    }
+
+    /**
+     * @brief 放入数据, 满了挂起等待
+     * @return 已关闭或超时返回false
+     */
+    bool push(const T& v, uint64_t timeout_ms = ~0ull) {
+        return pushImpl(v, timeout_ms);
+    }
+
+    bool push(T&& v, uint64_t timeout_ms = ~0ull) {
+        return pushImpl(std::move(v), timeout_ms);
+    }
+
+    bool tryPush(const T& v) { return push(v, 0);}
+
+    /**
+     * @brief 取出数据, 空了挂起等待
+     * @return 已关闭且为空或超时返回false
+     */
+    bool pop(T& v, uint64_t timeout_ms = ~0ull) {
+        uint64_t deadline = Deadline(timeout_ms);
+        MutexType::Lock lock(m_mutex);
+        while(true) {
+            if(m_head != m_tail) {
+                T& slot = m_buffer[m_head & m_mask];
+                v = std::move(slot);
+                slot = T();
+                ++m_head;
+                FiberWaiter::ptr waiter = m_writers.pop();
+                lock.unlock();
+                if(waiter) {
+                    waiter->wake();
+                }
+                return true;
+            }
+            if(m_closed) {
+                return false;
+            }
+            uint64_t remain = Remaining(deadline);
+            if(remain == 0 || !m_readers.wait(lock, remain)) {
+                return false;
+            }
+            //被唤醒后重新检查, 数据可能已被其他读者取走
+            lock.lock();
+        }
+    }
+
+    bool tryPop(T& v) { return pop(v, 0);}
+
+    size_t size() {
+        MutexType::Lock lock(m_mutex);
+        return m_tail - m_head;
+    }
+
+    size_t getCapacity() const { return m_capacity;}
+
+    /**
+     * @brief 从多个通道中任意一个取出数据
+     * @param[in] chans 通道列表, 排在前面的优先
+     * @param[out] v 取出的数据
+     * @param[in] timeout_ms 超时时间
+     * @return 取出数据的通道下标, 超时或全部已关闭且为空返回-1
+     */
+    static int Select(const std::vector<Channel*>& chans, T& v
+                      ,uint64_t timeout_ms = ~0ull) {
+        std::vector<ChannelBase*> bases(chans.begin(), chans.end());
+        uint64_t deadline = Deadline(timeout_ms);
+        bool notified = false;
+        while(true) {
+            bool n = false;
+            int idx = WaitReadable(bases, Remaining(deadline), n);
+            notified = notified || n;
+            if(idx < 0) {
+                return -1;
+            }
+            if(chans[idx]->pop(v, 0)) {
+                if(notified) {
+                    for(size_t i = 0; i < chans.size(); ++i) {
+                        if((int)i != idx) {
+                            chans[i]->passReader();
+                        }
+                    }
+                }
+                return idx;
+            }
+        }
+    }
+protected:
+    bool hasItemLocked() const override { return m_head != m_tail;}
+private:
+    template<class U>
+    bool pushImpl(U&& v, uint64_t timeout_ms) {
+        uint64_t deadline = Deadline(timeout_ms);
+        MutexType::Lock lock(m_mutex);
+        while(true) {
+            if(m_closed) {
+                return false;
+            }
+            if(m_tail - m_head < m_capacity) {
+                m_buffer[m_tail & m_mask] = std::forward<U>(v);
+                ++m_tail;
+                FiberWaiter::ptr waiter = m_readers.pop();
+                lock.unlock();
+                if(waiter) {
+                    waiter->wake();
+                }
+                return true;
+            }
+            uint64_t remain = Remaining(deadline);
+            if(remain == 0 || !m_writers.wait(lock, remain)) {
+                return false;
+            }
+            lock.lock();
+        }
+    }
+private:
+    std::vector<T> m_buffer;
+    size_t m_mask;
+    size_t m_capacity;
+    // 单调递增, 下标为&m_mask
+    uint64_t m_head = 0;
+    uint64_t m_tail = 0;
+};
+
+}
+
+#endif
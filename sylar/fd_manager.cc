@@ -72,6 +72,9 @@ FdManager::FdManager() {
 }
 
 FdCtx::ptr FdManager::get(int fd, bool auto_create) {
+    if(fd < 0) {
+        return nullptr;
+    }
     RWMutexType::ReadLock lock(m_mutex);
     if((int)m_datas.size() <= fd) {
         if(auto_create == false) {
@@ -85,6 +88,12 @@ FdCtx::ptr FdManager::get(int fd, bool auto_create) {
     lock.unlock();
 
     RWMutexType::WriteLock lock2(m_mutex);
+    if((int)m_datas.size() <= fd) {
+        m_datas.resize(fd * 1.5);
+    } else if(m_datas[fd]) {
+        //解锁期间其他线程已经创建
+        return m_datas[fd];
+    }
     FdCtx::ptr ctx(new FdCtx(fd));
     m_datas[fd] = ctx;
     return ctx;
@@ -3,7 +3,12 @@
 #include "macro.h"
 #include "log.h"
 #include "scheduler.h"
+#include "stack_allocator.h"
+#include <algorithm>
 #include <atomic>
+#include <vector>
+#include <string.h>
+#include <stdlib.h>
 
 namespace sylar {
 
@@ -14,21 +19,78 @@ static std::atomic<uint64_t> s_fiber_count(0);
 
 static thread_local Fiber* t_fiber = nullptr;
 static thread_local Fiber::ptr t_thread_fiber = nullptr;
+// 为false时当前执行的回调不在自己的协程里, 不能让出
+static thread_local bool t_yieldable = true;
 
 static ConfigVar<uint32_t>::ptr g_fiber_stack_size =
     Config::Lookup<uint32_t>("fiber.stack_size", 128 * 1024, "fiber stack size");
 
-class MallocStackAllocator {
-public:
-    static void* Alloc(size_t size) {
-        return malloc(size);
+static ConfigVar<uint32_t>::ptr g_fiber_pool_size =
+    Config::Lookup<uint32_t>("fiber.pool_size", 64
+            , "terminated fibers kept with their stacks per scheduler thread, 0 disables");
+
+static std::atomic<uint32_t> s_fiber_stack_size(0);
+static std::atomic<uint32_t> s_fiber_pool_size(0);
+
+struct _FiberIniter {
+    _FiberIniter() {
+        s_fiber_stack_size = g_fiber_stack_size->getValue();
+        g_fiber_stack_size->addListener([](const uint32_t& ov, const uint32_t& nv){
+            s_fiber_stack_size = nv;
+        });
+        s_fiber_pool_size = g_fiber_pool_size->getValue();
+        g_fiber_pool_size->addListener([](const uint32_t& ov, const uint32_t& nv){
+            s_fiber_pool_size = nv;
+        });
     }
-    static void Dealloc(void* vp, size_t size) {
-        return free(vp);
+};
+
+static _FiberIniter s_fiber_init;
+
+static thread_local Fiber::Pool* t_fiber_pool = nullptr;
+
+static ConfigVar<uint32_t>::ptr g_fiber_shared_stack_size =
+    Config::Lookup<uint32_t>("fiber.shared_stack_size", 1024 * 1024, "fiber shared stack size");
+
+static ConfigVar<uint32_t>::ptr g_fiber_shared_stack_count =
+    Config::Lookup<uint32_t>("fiber.shared_stack_count", 4, "fiber shared stacks per thread");
+
+/**
+ * @brief 共享栈
+ * @details 同一时刻只有occupant的栈内容在共享栈上, 其他绑定到它的协程
+ *          切入时先把occupant已用的部分拷出到occupant自己的缓冲区, 再拷回自己的
+ */
+struct Fiber::SharedStack {
+    typedef Spinlock MutexType;
+
+    SharedStack(size_t s, pid_t thr, const void* o)
+        :size(s)
+        ,thread(thr)
+        ,owner(o) {
+        stack = StackAllocator::Alloc(size, type);
+        SYLAR_ASSERT2(stack, "alloc shared stack fail size=" + std::to_string(size));
+    }
+
+    ~SharedStack() {
+        StackAllocator::Dealloc(stack, size, type);
     }
+
+    MutexType mutex;
+    void* stack = nullptr;
+    size_t size = 0;
+    StackAllocator::Type type = StackAllocator::MALLOC;
+    pid_t thread = -1;              //// 所属线程
+    const void* owner = nullptr;    //// 所属线程的t_shared_stacks地址, 用于快速判断线程
+    Fiber* occupant = nullptr;      //// 当前栈上是谁的内容
 };
 
-using StackAllocator = MallocStackAllocator;
+// 协程本地存储各槽位的析构函数, 注册后不变
+static void (*s_local_dtors[Fiber::LOCAL_SLOTS])(void*) = {nullptr};
+static std::atomic<size_t> s_local_count(0);
+
+// 当前线程的共享栈, 协程持有shared_ptr, 线程退出后仍可安全析构
+static thread_local std::vector<std::shared_ptr<Fiber::SharedStack> > t_shared_stacks;
+static thread_local size_t t_shared_stack_idx = 0;
 
 uint64_t Fiber::GetFiberId() {
     if(t_fiber) {
@@ -42,34 +104,37 @@ Fiber::Fiber() {
     m_state = EXEC;
     SetThis(this);
 
+#ifndef SYLAR_FIBER_ASM_CONTEXT
     if(getcontext(&m_ctx)) {
         SYLAR_ASSERT2(false, "getcontext");
     }
+#endif
 
     ++s_fiber_count;
 
     SYLAR_LOG_DEBUG(g_logger) << "Fiber::Fiber";
 }
 
-Fiber::Fiber(std::function<void()> cb, size_t stacksize, bool use_caller)
+Fiber::Fiber(std::function<void()> cb, size_t stacksize, bool use_caller, bool shared_stack)
     :m_id(++s_fiber_id)
+    ,m_shared(shared_stack)
     ,m_cb(cb) {
     ++s_fiber_count;
-    m_stacksize = stacksize ? stacksize : g_fiber_stack_size->getValue();
-
-    m_stack = StackAllocator::Alloc(m_stacksize);
-    if(getcontext(&m_ctx)) {
-        SYLAR_ASSERT2(false, "getcontext");
+    if(m_shared) {
+        // 共享栈在第一次切入时绑定, 上下文也在那时构造
+        SYLAR_ASSERT2(!use_caller, "use_caller fiber can not run on shared stack");
+        SYLAR_LOG_DEBUG(g_logger) << "Fiber::Fiber id=" << m_id << " shared stack";
+        return;
     }
+    m_stacksize = stacksize ? stacksize : s_fiber_stack_size.load();
 
-    m_ctx.uc_link = nullptr;
-    m_ctx.uc_stack.ss_sp = m_stack;
-    m_ctx.uc_stack.ss_size = m_stacksize;
+    m_stack = StackAllocator::Alloc(m_stacksize, m_stackType);
+    SYLAR_ASSERT2(m_stack, "alloc fiber stack fail size=" + std::to_string(m_stacksize));
 
     if(!use_caller) {
-        makecontext(&m_ctx, &Fiber::MainFunc, 0);
+        makeContext(&Fiber::MainFunc);
     } else {
-        makecontext(&m_ctx, &Fiber::CallerMainFunc, 0);
+        makeContext(&Fiber::CallerMainFunc);
     }
 
     SYLAR_LOG_DEBUG(g_logger) << "Fiber::Fiber id=" << m_id;
@@ -77,12 +142,20 @@ Fiber::Fiber(std::function<void()> cb, size_t stacksize, bool use_caller)
 
 Fiber::~Fiber() {
     --s_fiber_count;
-    if(m_stack) {
+    clearLocals();
+    if(m_shared) {
+        SYLAR_ASSERT(m_state == TERM
+                || m_state == EXCEPT
+                || m_state == INIT);
+
+        releaseSharedStack();
+        free(m_saveBuf);
+    } else if(m_stack) {
         SYLAR_ASSERT(m_state == TERM
                 || m_state == EXCEPT
                 || m_state == INIT);
                 
-        StackAllocator::Dealloc(m_stack, m_stacksize);
+        StackAllocator::Dealloc(m_stack, m_stacksize, m_stackType);
     } else {
         SYLAR_ASSERT(!m_cb);
         SYLAR_ASSERT(m_state == EXEC);
@@ -97,11 +170,199 @@ Fiber::~Fiber() {
 }
 
 void Fiber::reset(std::function<void()> cb) {
-    SYLAR_ASSERT(m_stack);
+    SYLAR_ASSERT(m_stack || m_shared);
     SYLAR_ASSERT(m_state == TERM
                 || m_state == EXCEPT
                 || m_state == INIT);
     m_cb = cb;
+    clearLocals();
+    if(m_shared) {
+        // 旧的栈内容不再需要, 下次切入时重新绑定当前线程的共享栈
+        releaseSharedStack();
+    } else {
+        makeContext(&Fiber::MainFunc);
+    }
+    m_state = INIT;
+}
+
+size_t Fiber::RegisterLocal(void (*dtor)(void*)) {
+    size_t slot = s_local_count++;
+    SYLAR_ASSERT2(slot < LOCAL_SLOTS, "too many fiber local slots");
+    s_local_dtors[slot] = dtor;
+    return slot;
+}
+
+void* Fiber::GetLocal(size_t slot) {
+    return t_fiber ? t_fiber->m_locals[slot] : nullptr;
+}
+
+void Fiber::SetLocal(size_t slot, void* value) {
+    if(!t_fiber) {
+        GetThis();
+    }
+    void* old = t_fiber->m_locals[slot];
+    t_fiber->m_locals[slot] = value;
+    if(old && old != value) {
+        s_local_dtors[slot](old);
+    }
+}
+
+void Fiber::clearLocals() {
+    size_t n = std::min((size_t)LOCAL_SLOTS, s_local_count.load());
+    for(size_t i = 0; i < n; ++i) {
+        //析构函数中可能再设置本协程的槽位, 先取出再销毁
+        void* value = m_locals[i];
+        if(value) {
+            m_locals[i] = nullptr;
+            s_local_dtors[i](value);
+        }
+    }
+}
+
+Fiber::ptr Fiber::Pool::get(std::function<void()> cb) {
+    if(m_fibers.empty()) {
+        return nullptr;
+    }
+    Fiber::ptr fiber;
+    fiber.swap(m_fibers.back());
+    m_fibers.pop_back();
+    m_size.store(m_fibers.size(), std::memory_order_relaxed);
+    fiber->reset(cb);
+    return fiber;
+}
+
+bool Fiber::Pool::put(Fiber::ptr& fiber) {
+    if(fiber->m_state != TERM && fiber->m_state != EXCEPT) {
+        return false;
+    }
+    //共享栈, 非默认栈大小的不回收; 有其他引用的可能还会被查看状态
+    if(fiber->m_shared || !fiber->m_stack
+            || fiber->m_stacksize != s_fiber_stack_size
+            || fiber.use_count() != 1
+            || m_fibers.size() >= s_fiber_pool_size) {
+        return false;
+    }
+    //异常结束的协程回调还在, 释放它捕获的资源
+    fiber->m_cb = nullptr;
+    fiber->clearLocals();
+    m_fibers.push_back(nullptr);
+    m_fibers.back().swap(fiber);
+    m_size.store(m_fibers.size(), std::memory_order_relaxed);
+    m_recycled.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+Fiber::ptr Fiber::Create(std::function<void()> cb, size_t stacksize) {
+    Pool* pool = t_fiber_pool;
+    if(pool && (stacksize == 0 || stacksize == s_fiber_stack_size)) {
+        Fiber::ptr fiber = pool->get(cb);
+        if(fiber) {
+            pool->m_hits.fetch_add(1, std::memory_order_relaxed);
+            return fiber;
+        }
+        pool->m_misses.fetch_add(1, std::memory_order_relaxed);
+    }
+    return Fiber::ptr(new Fiber(cb, stacksize));
+}
+
+void Fiber::SetThreadPool(Pool* pool) {
+    t_fiber_pool = pool;
+}
+
+Fiber::Pool* Fiber::GetThreadPool() {
+    return t_fiber_pool;
+}
+
+pid_t Fiber::getBoundThread() const {
+    return m_sharedStack ? m_sharedStack->thread : -1;
+}
+
+char* Fiber::getSavedStackPointer() {
+    char* sp = nullptr;
+#if defined(SYLAR_FIBER_ASM_CONTEXT)
+    sp = (char*)m_ctx;
+#elif defined(__x86_64__)
+    sp = (char*)m_ctx.uc_mcontext.gregs[REG_RSP];
+#elif defined(__aarch64__)
+    sp = (char*)m_ctx.uc_mcontext.sp;
+#endif
+    // 取不到或不在栈范围内就保存整个栈
+    if(sp < (char*)m_stack || sp > (char*)m_stack + m_stacksize) {
+        sp = (char*)m_stack;
+    }
+    return sp;
+}
+
+void Fiber::saveSharedStack() {
+    if(m_state == TERM || m_state == EXCEPT || m_state == INIT) {
+        m_saveLen = 0;
+        return;
+    }
+    char* top = (char*)m_stack + m_stacksize;
+    char* sp = getSavedStackPointer();
+    size_t len = top - sp;
+    // 缓冲区按实际使用量分配, 明显偏大时也收缩
+    if(len > m_saveCap || len < m_saveCap / 2) {
+        free(m_saveBuf);
+        m_saveBuf = (char*)malloc(len);
+        SYLAR_ASSERT(m_saveBuf || !len);
+        m_saveCap = len;
+    }
+    memcpy(m_saveBuf, sp, len);
+    m_saveLen = len;
+}
+
+void Fiber::switchSharedStack() {
+    if(!m_sharedStack) {
+        if(t_shared_stacks.empty()) {
+            uint32_t count = g_fiber_shared_stack_count->getValue();
+            uint32_t size = g_fiber_shared_stack_size->getValue();
+            pid_t thread = sylar::GetThreadId();
+            for(uint32_t i = 0; i < (count ? count : 1); ++i) {
+                t_shared_stacks.push_back(std::make_shared<SharedStack>(
+                            size, thread, &t_shared_stacks));
+            }
+        }
+        m_sharedStack = t_shared_stacks[t_shared_stack_idx++ % t_shared_stacks.size()];
+        m_stack = m_sharedStack->stack;
+        m_stacksize = m_sharedStack->size;
+    }
+    SYLAR_ASSERT2(m_sharedStack->owner == &t_shared_stacks
+            , "shared stack fiber_id=" + std::to_string(m_id)
+            + " bound to thread " + std::to_string(m_sharedStack->thread));
+
+    SharedStack::MutexType::Lock lock(m_sharedStack->mutex);
+    Fiber* occupant = m_sharedStack->occupant;
+    if(occupant == this) {
+        return;
+    }
+    if(occupant) {
+        occupant->saveSharedStack();
+    }
+    if(m_state == INIT) {
+        makeContext(&Fiber::MainFunc);
+    } else if(m_saveLen) {
+        memcpy((char*)m_stack + m_stacksize - m_saveLen, m_saveBuf, m_saveLen);
+    }
+    m_sharedStack->occupant = this;
+}
+
+void Fiber::releaseSharedStack() {
+    if(m_sharedStack) {
+        SharedStack::MutexType::Lock lock(m_sharedStack->mutex);
+        if(m_sharedStack->occupant == this) {
+            m_sharedStack->occupant = nullptr;
+        }
+    }
+    m_sharedStack.reset();
+    m_stack = nullptr;
+    m_saveLen = 0;
+}
+
+void Fiber::makeContext(void (*func)()) {
+#ifdef SYLAR_FIBER_ASM_CONTEXT
+    m_ctx = MakeContext(m_stack, m_stacksize, func);
+#else
     if(getcontext(&m_ctx)) {
         SYLAR_ASSERT2(false, "getcontext");
     }
@@ -110,40 +371,57 @@ void Fiber::reset(std::function<void()> cb) {
     m_ctx.uc_stack.ss_sp = m_stack;
     m_ctx.uc_stack.ss_size = m_stacksize;
 
-    makecontext(&m_ctx, &Fiber::MainFunc, 0);
-    m_state = INIT;
+    makecontext(&m_ctx, func, 0);
+#endif
+}
+
+void Fiber::SwapContext(Fiber* from, Fiber* to) {
+#ifdef SYLAR_FIBER_ASM_CONTEXT
+    sylar_context_swap(&from->m_ctx, to->m_ctx);
+#else
+    if(swapcontext(&from->m_ctx, &to->m_ctx)) {
+        SYLAR_ASSERT2(false, "swapcontext");
+    }
+#endif
 }
 
 void Fiber::call() {
+    SYLAR_ASSERT(!m_shared);
     SetThis(this);
     m_state = EXEC;
-    SYLAR_LOG_ERROR(g_logger) << getId();
-    if(swapcontext(&t_thread_fiber->m_ctx, &m_ctx)) {
-        SYLAR_ASSERT2(false, "swapcontext");
-    }
+    SwapContext(t_thread_fiber.get(), this);
 }
 
 void Fiber::back() {
     SetThis(t_thread_fiber.get());
-    if(swapcontext(&m_ctx, &t_thread_fiber->m_ctx)) {
-        SYLAR_ASSERT2(false, "swapcontext");
-    }     
+    SwapContext(this, t_thread_fiber.get());
 }
 
 void Fiber::swapIn() {
     SetThis(this);
     SYLAR_ASSERT(m_state != EXEC);
+    if(m_shared) {
+        switchSharedStack();
+    }
     m_state = EXEC;
-    if(swapcontext(&Scheduler::GetMainFiber()->m_ctx, &m_ctx)) {
-        SYLAR_ASSERT2(false, "swapcontext");
+    m_lastMain = Scheduler::GetMainFiber();
+    SwapContext(m_lastMain, this);
+}
+
+void Fiber::swapTo(Fiber* to) {
+    SetThis(to);
+    SYLAR_ASSERT(to->m_state != EXEC);
+    if(to->m_shared) {
+        to->switchSharedStack();
     }
+    to->m_state = EXEC;
+    to->m_lastMain = m_lastMain;
+    SwapContext(this, to);
 }
 
 void Fiber::swapOut() {
     SetThis(Scheduler::GetMainFiber());
-    if(swapcontext(&m_ctx, &Scheduler::GetMainFiber()->m_ctx)) {
-        SYLAR_ASSERT2(false, "swapcontext");        
-    }
+    SwapContext(this, Scheduler::GetMainFiber());
 }
 
 void Fiber::SetThis(Fiber* f) {
@@ -161,21 +439,49 @@ Fiber::ptr Fiber::GetThis() {
 }
 
 void Fiber::YieldToReady() {
+    SYLAR_ASSERT2(t_yieldable, "yield in inline task");
     Fiber::ptr cur = GetThis();
     cur->m_state = READY;
     cur->swapOut();
 }
 
 void Fiber::YieldToHold() {
+    SYLAR_ASSERT2(t_yieldable, "yield in inline task");
     Fiber::ptr cur = GetThis();
-    cur->m_state = HOLD;
+    SYLAR_ASSERT(cur->m_state == EXEC);
+    // 切出完成前保持EXEC, 由调度循环置为HOLD; 否则其他线程可能在
+    // 上下文保存完之前就把它切入
     cur->swapOut();
 }
 
+bool Fiber::YieldTo(Fiber::ptr fiber) {
+    Scheduler* sc = Scheduler::GetThis();
+    SYLAR_ASSERT(sc);
+    return sc->handoff(fiber);
+}
+
 uint64_t Fiber::TotalFibers() {
     return s_fiber_count;
 }
 
+void Fiber::SetYieldable(bool v) {
+    t_yieldable = v;
+}
+
+bool Fiber::IsYieldable() {
+    return t_yieldable;
+}
+
+bool Fiber::HasBoundFibers() {
+    //绑定只发生在本线程, 除t_shared_stacks外没有引用就不会再有协程绑上来
+    for(auto& i : t_shared_stacks) {
+        if(i.use_count() > 1) {
+            return true;
+        }
+    }
+    return false;
+}
+
 void Fiber::MainFunc() {
     Fiber::ptr cur = GetThis();
     SYLAR_ASSERT(cur);
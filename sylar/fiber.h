@@ -11,10 +11,18 @@ Thread->main_fiber <--------------> sub_fiber
 */
 
 
+#include <atomic>
 #include <memory>
 #include <functional>
-#include <ucontext.h>
+#include <vector>
 #include "thread.h"
+#include "stack_allocator.h"
+
+#ifdef SYLAR_FIBER_ASM_CONTEXT
+#include "fiber_context.h"
+#else
+#include <ucontext.h>
+#endif
 
 
 namespace sylar{
@@ -25,6 +33,9 @@ class Fiber : public std::enable_shared_from_this<Fiber> {
 friend class Scheduler;
 public:
     typedef std::shared_ptr<Fiber> ptr;
+    struct SharedStack;
+    // 协程本地存储的槽位数, 见fiber_local.h
+    static const size_t LOCAL_SLOTS = 16;
 
     enum State {
         INIT,           //// 初始状态
@@ -35,13 +46,64 @@ public:
         EXCEPT          //// 异常状态
     };
 
+    /**
+     * @brief 已结束协程的对象池, 每个调度线程一个, 连同栈一起复用
+     * @details 只有所属线程get/put, 计数可以被其他线程读取.
+     *          只回收私有栈, 栈大小为默认值且没有其他引用的协程, 上限为fiber.pool_size
+     */
+    class Pool {
+    public:
+        Pool() {}
+
+        // 取一个协程并reset为cb, 池空返回nullptr
+        Fiber::ptr get(std::function<void()> cb);
+        /**
+         * @brief 回收已结束的协程, 清掉回调和协程本地存储
+         * @return 不满足条件或池满返回false, fiber不变
+         */
+        bool put(Fiber::ptr& fiber);
+
+        size_t size() const { return m_size.load(std::memory_order_relaxed);}
+        uint64_t getHits() const { return m_hits.load(std::memory_order_relaxed);}
+        uint64_t getMisses() const { return m_misses.load(std::memory_order_relaxed);}
+        uint64_t getRecycled() const { return m_recycled.load(std::memory_order_relaxed);}
+    private:
+        friend class Fiber;
+        std::vector<Fiber::ptr> m_fibers;
+        std::atomic<size_t> m_size {0};
+        std::atomic<uint64_t> m_hits {0};       //// 从池中取到的次数
+        std::atomic<uint64_t> m_misses {0};     //// 池空新建的次数
+        std::atomic<uint64_t> m_recycled {0};   //// 回收进池的次数
+    };
+
 private:
     Fiber();
 
 public:
-    Fiber(std::function<void()> cb, size_t stacksize = 0, bool use_caller = false);
+    /**
+     * @brief 构造函数
+     * @param[in] cb 协程执行的函数
+     * @param[in] stacksize 栈大小, 0使用fiber.stack_size
+     * @param[in] use_caller 是否在调度器的use_caller线程上以call/back方式运行
+     * @param[in] shared_stack 运行在线程的共享栈上, 切出后只保存已用部分;
+     *            第一次切入后协程固定在该线程上运行.
+     *            挂起期间栈上的地址属于正在运行的其他协程, 不能交给内核或其他线程
+     *            异步写入, 所以这种协程的socket读写不走io_uring, 由epoll在切回后执行,
+     *            OffloadPool::run(包括hook的文件读写和Address::Lookup)直接在当前线程执行
+     */
+    Fiber(std::function<void()> cb, size_t stacksize = 0, bool use_caller = false
+          ,bool shared_stack = false);
     ~Fiber();
 
+    /**
+     * @brief 创建协程, 在设置了协程池的线程上优先从池中取
+     * @param[in] stacksize 非0且不等于fiber.stack_size时不使用池
+     */
+    static Fiber::ptr Create(std::function<void()> cb, size_t stacksize = 0);
+    // 设置当前线程的协程池, 由调度线程在run()中设置
+    static void SetThreadPool(Pool* pool);
+    static Pool* GetThreadPool();
+
     // 重置fiber状态
     void reset(std::function<void()> cb);
     // 切换到当前协程执行
@@ -54,6 +116,10 @@ public:
     void back();
     uint64_t getId() const { return m_id;}
     State getState() const {return m_state; }
+    // 是否运行在共享栈上
+    bool isSharedStack() const { return m_shared;}
+    // 共享栈协程绑定的线程, 未绑定或私有栈返回-1
+    pid_t getBoundThread() const;
 
 public:
     //设置当前协程
@@ -64,22 +130,73 @@ public:
     static void YieldToReady();
     // 协程切换到后台, 并且设置为Hold状态
     static void YieldToHold();
+    // 直接切换到同线程挂起的fiber, 当前协程就绪, 见Scheduler::handoff
+    static bool YieldTo(Fiber::ptr fiber);
     // 获取协程数量
     static uint64_t TotalFibers();
+    // 设置当前线程是否允许让出, 调度循环直接执行Scheduler::scheduleInline的回调时禁止
+    static void SetYieldable(bool v);
+    static bool IsYieldable();
+    // 当前线程的共享栈上是否还有绑定的协程, 有则线程不能退出, 见Scheduler::retire
+    static bool HasBoundFibers();
 
     static void MainFunc();
     static void CallerMainFunc();
     static uint64_t GetFiberId();
 
+    /**
+     * @brief 注册一个协程本地存储槽位, 槽位不回收
+     * @param[in] dtor 协程reset或析构时销毁槽位中的值
+     */
+    static size_t RegisterLocal(void (*dtor)(void*));
+    // 当前协程槽位中的值, 没有协程或未设置返回nullptr
+    static void* GetLocal(size_t slot);
+    // 设置当前协程槽位的值, 原来的值被销毁; 不在协程中时设置到线程主协程上
+    static void SetLocal(size_t slot, void* value);
+
+private:
+    // 在协程栈上构造入口为func的上下文
+    void makeContext(void (*func)());
+    // 保存当前上下文到from, 切换到to
+    static void SwapContext(Fiber* from, Fiber* to);
+    // 从当前协程直接切换到to, 不经过调度主协程
+    void swapTo(Fiber* to);
+
+    // 切出时保存的栈指针
+    char* getSavedStackPointer();
+    // 把自己在共享栈上已用的部分拷到m_saveBuf
+    void saveSharedStack();
+    // 切入前调用, 绑定共享栈并换上自己的栈内容
+    void switchSharedStack();
+    // 解除共享栈绑定
+    void releaseSharedStack();
+    // 销毁所有协程本地存储的值
+    void clearLocals();
+
 private:
     uint64_t m_id = 0;
     uint32_t m_stacksize = 0;
     State m_state = INIT;
 
+#ifdef SYLAR_FIBER_ASM_CONTEXT
+    void* m_ctx = nullptr;      //// 切出时的栈指针
+#else
     ucontext_t m_ctx;
+#endif
     void* m_stack = nullptr;
+    StackAllocator::Type m_stackType = StackAllocator::MALLOC;
+
+    bool m_shared = false;                          //// 是否运行在共享栈上
+    std::shared_ptr<SharedStack> m_sharedStack;     //// 绑定的共享栈
+    char* m_saveBuf = nullptr;                      //// 被换下共享栈时保存的栈内容
+    size_t m_saveLen = 0;
+    size_t m_saveCap = 0;
+    /// 最近一次运行所在线程的调度主协程, 用于判断能否直接交接
+    Fiber* m_lastMain = nullptr;
 
     std::function<void()> m_cb;
+    /// 协程本地存储, 下标为RegisterLocal分配的槽位
+    void* m_locals[LOCAL_SLOTS] = {};
 };
 
 
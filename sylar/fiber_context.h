@@ -0,0 +1,70 @@
+#ifndef __SYLAR_FIBER_CONTEXT_H__
+#define __SYLAR_FIBER_CONTEXT_H__
+
+/*
+  汇编实现的协程上下文切换(fiber_context.S), 替代ucontext的swapcontext
+
+  swapcontext每次切换都要保存/恢复信号屏蔽字, 需要一次rt_sigprocmask系统调用;
+  这里只在栈上保存callee-saved寄存器, 上下文就是切出时的栈指针
+
+  x86_64 切出时的栈(低地址 -> 高地址):
+    mxcsr/x87cw | r15 | r14 | r13 | r12 | rbx | rbp | 返回地址
+  aarch64 切出时的栈(低地址 -> 高地址):
+    d8-d15 | x19-x28 | x29(fp) | x30(lr)
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__aarch64__)
+#define SYLAR_HAS_ASM_CONTEXT 1
+#endif
+
+#ifdef SYLAR_HAS_ASM_CONTEXT
+
+extern "C" {
+
+/**
+ * @brief 保存当前上下文, 栈指针写入*from_sp, 然后切换到to_sp
+ */
+void sylar_context_swap(void** from_sp, void* to_sp);
+
+/**
+ * @brief 新上下文的入口跳板, 调用MakeContext传入的函数
+ */
+void sylar_context_entry();
+
+}
+
+namespace sylar {
+
+/**
+ * @brief 在栈[stack, stack + size)上构造初始上下文
+ * @param[in] func 切入后执行的函数, 不能返回
+ * @return 可以传给sylar_context_swap的栈指针
+ */
+inline void* MakeContext(void* stack, size_t size, void (*func)()) {
+    uintptr_t top = ((uintptr_t)stack + size) & ~(uintptr_t)15;
+#if defined(__x86_64__)
+    // ret进入跳板后rsp == top - 16, 满足call前16字节对齐
+    uint64_t* sp = (uint64_t*)(top - 80);
+    memset(sp, 0, 80);
+    ((uint32_t*)sp)[0] = 0x1F80;                    //mxcsr 默认值
+    ((uint16_t*)sp)[2] = 0x037F;                    //x87 控制字默认值
+    sp[4] = (uint64_t)func;                         //r12
+    sp[7] = (uint64_t)&sylar_context_entry;         //返回地址
+#elif defined(__aarch64__)
+    uint64_t* sp = (uint64_t*)(top - 160);
+    memset(sp, 0, 160);
+    sp[8] = (uint64_t)func;                         //x19
+    sp[19] = (uint64_t)&sylar_context_entry;        //x30
+#endif
+    return sp;
+}
+
+}
+
+#endif
+
+#endif
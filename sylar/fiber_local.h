@@ -0,0 +1,61 @@
+#ifndef __SYLAR_FIBER_LOCAL_H__
+#define __SYLAR_FIBER_LOCAL_H__
+
+/*
+  协程本地存储
+
+  M:N调度下协程会在不同线程间迁移, thread_local不能用来保存请求上下文(trace id, 截止时间等).
+  FiberLocal<T>在构造时注册一个槽位, 值存放在Fiber内联的指针数组中, 按槽位下标直接访问.
+  值在协程reset(调度器复用回调协程)或析构时销毁, 下一个任务看不到上一个任务的值.
+
+  槽位总数为Fiber::LOCAL_SLOTS, 注册后不回收, FiberLocal应定义为全局或静态变量:
+    static sylar::FiberLocal<std::string> s_trace_id;
+    s_trace_id.set("abc");
+    const std::string* id = s_trace_id.get();
+*/
+
+#include "fiber.h"
+
+namespace sylar {
+
+template<class T>
+class FiberLocal {
+public:
+    FiberLocal()
+        :m_slot(Fiber::RegisterLocal(&FiberLocal::Destroy)) {
+    }
+
+    // 当前协程的值, 未设置返回nullptr
+    T* get() const { return (T*)Fiber::GetLocal(m_slot);}
+
+    // 当前协程的值, 未设置时默认构造一个
+    T& operator*() const {
+        T* v = get();
+        if(!v) {
+            v = new T();
+            Fiber::SetLocal(m_slot, v);
+        }
+        return *v;
+    }
+
+    T* operator->() const { return &**this;}
+
+    void set(const T& v) const { Fiber::SetLocal(m_slot, new T(v));}
+    void set(T&& v) const { Fiber::SetLocal(m_slot, new T(std::move(v)));}
+
+    // 销毁当前协程的值
+    void reset() const { Fiber::SetLocal(m_slot, nullptr);}
+
+    size_t getSlot() const { return m_slot;}
+private:
+    static void Destroy(void* v) { delete (T*)v;}
+
+    FiberLocal(const FiberLocal&) = delete;
+    FiberLocal& operator=(const FiberLocal&) = delete;
+private:
+    size_t m_slot;
+};
+
+}
+
+#endif
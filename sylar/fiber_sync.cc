@@ -0,0 +1,310 @@
+#include "fiber_sync.h"
+#include "iomanager.h"
+#include "macro.h"
+#include "scheduler.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+
+namespace sylar {
+
+FiberWaiter::FiberWaiter()
+    :m_state(WAITING) {
+    if(Scheduler::CanPark()) {
+        m_scheduler = Scheduler::GetThis();
+        m_fiber = Fiber::GetThis();
+        //挂起期间调度器不能停止, 唤醒或超时时done
+        m_scheduler->addPending();
+    }
+}
+
+bool FiberWaiter::finish(State s) {
+    int expect = WAITING;
+    return m_state.compare_exchange_strong(expect, s);
+}
+
+bool FiberWaiter::claim() {
+    return finish(NOTIFIED);
+}
+
+void FiberWaiter::OnTimeout(FiberWaiter::ptr waiter) {
+    if(waiter->finish(TIMEOUT)) {
+        waiter->wake(false);
+    }
+}
+
+bool FiberWaiter::park(uint64_t timeout_ms) {
+    if(!m_scheduler) {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        auto pred = [this](){
+            return m_state != WAITING;
+        };
+        if(timeout_ms == ~0ull) {
+            m_cond.wait(lock, pred);
+            return true;
+        }
+        if(m_cond.wait_for(lock, std::chrono::milliseconds(timeout_ms), pred)) {
+            return m_state == NOTIFIED;
+        }
+        //超时的同时被唤醒了, 算作唤醒
+        return !finish(TIMEOUT);
+    }
+
+    Timer::ptr timer;
+    if(timeout_ms != ~0ull) {
+        IOManager* iom = IOManager::GetThis();
+        SYLAR_ASSERT2(iom, "fiber wait with timeout outside IOManager");
+        //回调不会让出, inline执行
+        timer = iom->addTimer(timeout_ms, std::bind(&FiberWaiter::OnTimeout, shared_from_this())
+                    , false, true);
+    }
+    //唤醒方可能在让出前就放回调度器, 调度循环会等它切出后再执行
+    Fiber::YieldToHold();
+    if(timer) {
+        timer->cancel();
+    }
+    SYLAR_ASSERT(m_state != WAITING);
+    return m_state == NOTIFIED;
+}
+
+void FiberWaiter::wake(bool handoff) {
+    if(!m_scheduler) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_cond.notify_one();
+        return;
+    }
+    Scheduler* scheduler = m_scheduler;
+    Fiber::ptr fiber;
+    fiber.swap(m_fiber);
+    if(handoff && Scheduler::GetThis() == scheduler) {
+        //当前线程正在这个调度器上执行, 调度器不会在这期间停止, 可以先done.
+        //不能直接切换时(对方还没切出或在其他线程上)handoff退化为schedule
+        scheduler->donePending();
+        scheduler->handoff(fiber);
+        return;
+    }
+    scheduler->schedule(fiber);
+    scheduler->donePending();
+}
+
+bool FiberWaiter::cancel() {
+    if(!finish(TIMEOUT)) {
+        park();
+        return true;
+    }
+    if(m_scheduler) {
+        m_fiber.reset();
+        m_scheduler->donePending();
+    }
+    return false;
+}
+
+FiberWaitQueue::~FiberWaitQueue() {
+    SYLAR_ASSERT2(m_waiters.empty(), "destroy wait queue with waiters");
+}
+
+bool FiberWaitQueue::wait(MutexType::Lock& lock, uint64_t timeout_ms
+                          ,const std::function<void()>& before_park) {
+    FiberWaiter::ptr waiter(new FiberWaiter);
+    m_waiters.push_back(waiter);
+    lock.unlock();
+
+    if(before_park) {
+        before_park();
+    }
+    if(waiter->park(timeout_ms)) {
+        return true;
+    }
+    //超时的还留在队列中, pop会跳过它, 这里移除
+    lock.lock();
+    m_waiters.remove(waiter);
+    lock.unlock();
+    return false;
+}
+
+FiberWaiter::ptr FiberWaitQueue::pop() {
+    while(!m_waiters.empty()) {
+        FiberWaiter::ptr waiter;
+        waiter.swap(m_waiters.front());
+        m_waiters.pop_front();
+        //已经超时的由超时方负责唤醒
+        if(waiter->claim()) {
+            return waiter;
+        }
+    }
+    return nullptr;
+}
+
+FiberMutex::~FiberMutex() {
+    SYLAR_ASSERT2(!m_locked, "destroy locked FiberMutex");
+}
+
+void FiberMutex::lock() {
+    FiberWaitQueue::MutexType::Lock lock(m_mutex);
+    if(!m_locked) {
+        m_locked = true;
+        return;
+    }
+    //被唤醒时锁已经转给自己
+    m_queue.wait(lock);
+}
+
+bool FiberMutex::tryLock() {
+    FiberWaitQueue::MutexType::Lock lock(m_mutex);
+    if(m_locked) {
+        return false;
+    }
+    m_locked = true;
+    return true;
+}
+
+bool FiberMutex::lockFor(uint64_t timeout_ms) {
+    FiberWaitQueue::MutexType::Lock lock(m_mutex);
+    if(!m_locked) {
+        m_locked = true;
+        return true;
+    }
+    return m_queue.wait(lock, timeout_ms);
+}
+
+void FiberMutex::unlock() {
+    FiberWaitQueue::MutexType::Lock lock(m_mutex);
+    SYLAR_ASSERT2(m_locked, "unlock FiberMutex not locked");
+    FiberWaiter::ptr waiter = m_queue.pop();
+    if(!waiter) {
+        m_locked = false;
+        return;
+    }
+    //m_locked保持为true, 直接交给队首
+    lock.unlock();
+    waiter->wake();
+}
+
+void FiberCondition::wait(FiberMutex::Lock& lock) {
+    waitFor(lock, ~0ull);
+}
+
+bool FiberCondition::waitFor(FiberMutex::Lock& lock, uint64_t timeout_ms) {
+    FiberWaitQueue::MutexType::Lock qlock(m_mutex);
+    //先进队列再释放用户的锁, 之后的notify一定能看到自己
+    bool rt = m_queue.wait(qlock, timeout_ms, [&lock](){
+        lock.unlock();
+    });
+    lock.lock();
+    return rt;
+}
+
+void FiberCondition::notify() {
+    FiberWaitQueue::MutexType::Lock lock(m_mutex);
+    FiberWaiter::ptr waiter = m_queue.pop();
+    lock.unlock();
+    if(waiter) {
+        waiter->wake();
+    }
+}
+
+void FiberCondition::notifyAll() {
+    std::vector<FiberWaiter::ptr> waiters;
+    {
+        FiberWaitQueue::MutexType::Lock lock(m_mutex);
+        while(FiberWaiter::ptr waiter = m_queue.pop()) {
+            waiters.push_back(waiter);
+        }
+    }
+    for(auto& i : waiters) {
+        i->wake(false);
+    }
+}
+
+void FiberSemaphore::wait() {
+    waitFor(~0ull);
+}
+
+bool FiberSemaphore::tryWait() {
+    FiberWaitQueue::MutexType::Lock lock(m_mutex);
+    if(m_count == 0) {
+        return false;
+    }
+    --m_count;
+    return true;
+}
+
+bool FiberSemaphore::waitFor(uint64_t timeout_ms) {
+    FiberWaitQueue::MutexType::Lock lock(m_mutex);
+    if(m_count > 0) {
+        --m_count;
+        return true;
+    }
+    if(timeout_ms == 0) {
+        return false;
+    }
+    //被唤醒时计数已经交给自己
+    return m_queue.wait(lock, timeout_ms);
+}
+
+void FiberSemaphore::notify(uint32_t n) {
+    std::vector<FiberWaiter::ptr> waiters;
+    {
+        FiberWaitQueue::MutexType::Lock lock(m_mutex);
+        for(uint32_t i = 0; i < n; ++i) {
+            FiberWaiter::ptr waiter = m_queue.pop();
+            if(!waiter) {
+                m_count += n - i;
+                break;
+            }
+            waiters.push_back(waiter);
+        }
+    }
+    //前面的放回调度器, 最后一个直接切换过去
+    for(size_t i = 0; i < waiters.size(); ++i) {
+        waiters[i]->wake(i + 1 == waiters.size());
+    }
+}
+
+WaitGroup::~WaitGroup() {
+    SYLAR_ASSERT2(m_queue.empty(), "destroy WaitGroup with waiters");
+}
+
+void WaitGroup::add(uint32_t n) {
+    FiberWaitQueue::MutexType::Lock lock(m_mutex);
+    m_count += n;
+}
+
+void WaitGroup::done() {
+    std::vector<FiberWaiter::ptr> waiters;
+    {
+        FiberWaitQueue::MutexType::Lock lock(m_mutex);
+        SYLAR_ASSERT2(m_count > 0, "WaitGroup done more than add");
+        if(--m_count > 0) {
+            return;
+        }
+        while(FiberWaiter::ptr waiter = m_queue.pop()) {
+            waiters.push_back(waiter);
+        }
+    }
+    for(auto& i : waiters) {
+        i->wake(false);
+    }
+}
+
+void WaitGroup::wait() {
+    waitFor(~0ull);
+}
+
+bool WaitGroup::waitFor(uint64_t timeout_ms) {
+    FiberWaitQueue::MutexType::Lock lock(m_mutex);
+    if(m_count == 0) {
+        return true;
+    }
+    return m_queue.wait(lock, timeout_ms);
+}
+
+uint32_t WaitGroup::getCount() {
+    FiberWaitQueue::MutexType::Lock lock(m_mutex);
+    return m_count;
+}
+
+}
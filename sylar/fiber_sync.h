@@ -0,0 +1,235 @@
+#ifndef __SYLAR_FIBER_SYNC_H__
+#define __SYLAR_FIBER_SYNC_H__
+
+/*
+  协程同步原语: FiberMutex, FiberCondition, FiberSemaphore, WaitGroup
+
+  mutex.h中的锁都是pthread的, 协程里拿不到锁会阻塞整个工作线程, 上面的其他协程也跟着等.
+  这里拿不到时只把当前协程挂到等待队列上(HOLD), 被唤醒时通过原来的调度器schedule回来.
+  不在协程中(例如普通线程)调用时退化为用条件变量阻塞线程, 可以和协程混用.
+
+  超时用当前IOManager的定时器(inline回调), 协程中带超时等待必须在IOManager里.
+  唤醒是FIFO并且直接交给被唤醒者: FiberMutex解锁时锁直接转给队首协程,
+  FiberSemaphore的notify直接把计数交给队首协程, 不会被后来者抢走.
+  只唤醒一个时, 被唤醒的协程上次在当前线程运行的话直接切换过去(Scheduler::handoff),
+  唤醒方就绪, 等对方让出后继续, 不经过任务队列. 所以不要持有线程锁去解锁/notify/push.
+
+  FiberWaiter和FiberWaitQueue也可以直接用来实现其他需要挂起协程的结构, 见channel.h
+*/
+
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <functional>
+#include "fiber.h"
+#include "mutex.h"
+
+namespace sylar {
+
+class Scheduler;
+
+/**
+ * @brief 一个等待者, 创建时记录当前协程和调度器, 不能挂起时用条件变量阻塞线程
+ * @details 状态只会从WAITING变为NOTIFIED或TIMEOUT一次, 唤醒方和超时定时器通过CAS决定谁生效.
+ *          同一个等待者可以同时排在多个队列中(如Channel的select), 只会被唤醒一次
+ */
+class FiberWaiter : public std::enable_shared_from_this<FiberWaiter> {
+public:
+    typedef std::shared_ptr<FiberWaiter> ptr;
+    enum State {
+        WAITING = 0,
+        NOTIFIED,
+        TIMEOUT
+    };
+
+    FiberWaiter();
+
+    /**
+     * @brief 挂起直到被唤醒或超时
+     * @param[in] timeout_ms 超时时间, ~0ull为不超时; 协程中带超时必须在IOManager里
+     * @return 被唤醒返回true, 超时返回false
+     */
+    bool park(uint64_t timeout_ms = ~0ull);
+
+    /**
+     * @brief 抢到唤醒权, 可以在锁内调用
+     * @return 已经被唤醒或超时返回false, 此时不能再wake
+     */
+    bool claim();
+
+    /**
+     * @brief claim成功后唤醒, 应在锁外调用
+     * @param[in] handoff 被唤醒的协程上次在当前线程运行, 且当前在同一调度器的协程中时,
+     *            直接切换过去, 当前协程就绪. 否则放回调度器. 一次唤醒多个时传false
+     */
+    void wake(bool handoff = true);
+
+    /**
+     * @brief 创建后不挂起时放弃等待
+     * @details 已经被其他人claim时会挂起一次, 吸收掉对方的唤醒
+     * @return 是否吸收了唤醒
+     */
+    bool cancel();
+
+    State getState() const { return (State)m_state.load();}
+private:
+    bool finish(State s);
+    // 超时定时器回调
+    static void OnTimeout(FiberWaiter::ptr waiter);
+private:
+    std::atomic<int> m_state;
+    Scheduler* m_scheduler = nullptr;   //// 为空表示线程在等待
+    Fiber::ptr m_fiber;
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+};
+
+/**
+ * @brief 等待者队列, 由使用者自己的锁保护
+ */
+class FiberWaitQueue {
+public:
+    typedef Spinlock MutexType;
+
+    FiberWaitQueue() {}
+    ~FiberWaitQueue();
+
+    /**
+     * @brief 当前协程(或线程)排到队尾并挂起, 直到被唤醒或超时
+     * @param[in] lock 持有保护本队列的锁, 返回时已释放
+     * @param[in] timeout_ms 超时时间, ~0ull为不超时
+     * @param[in] before_park 释放锁之后挂起之前执行, 此时已在队列中, 不会漏掉唤醒
+     * @return 被唤醒返回true, 超时返回false
+     */
+    bool wait(MutexType::Lock& lock, uint64_t timeout_ms = ~0ull
+              ,const std::function<void()>& before_park = nullptr);
+
+    /**
+     * @brief 取出队首还在等待的一个并claim, 持锁调用
+     * @return 没有等待者返回nullptr; 非空时释放锁后调用wake
+     */
+    FiberWaiter::ptr pop();
+
+    // 持锁调用
+    void push(const FiberWaiter::ptr& waiter) { m_waiters.push_back(waiter);}
+    void remove(const FiberWaiter::ptr& waiter) { m_waiters.remove(waiter);}
+    bool empty() const { return m_waiters.empty();}
+private:
+    std::list<FiberWaiter::ptr> m_waiters;
+};
+
+/**
+ * @brief 协程互斥量, 不可重入
+ */
+class FiberMutex {
+public:
+    typedef ScopeLockImpl<FiberMutex> Lock;
+
+    FiberMutex() {}
+    ~FiberMutex();
+
+    void lock();
+    void unlock();
+    bool tryLock();
+    /**
+     * @brief 最多等待timeout_ms
+     * @return 是否拿到锁
+     */
+    bool lockFor(uint64_t timeout_ms);
+private:
+    FiberMutex(const FiberMutex&) = delete;
+    FiberMutex& operator=(const FiberMutex&) = delete;
+private:
+    FiberWaitQueue::MutexType m_mutex;
+    FiberWaitQueue m_queue;
+    bool m_locked = false;
+};
+
+/**
+ * @brief 协程条件变量, 配合FiberMutex使用
+ */
+class FiberCondition {
+public:
+    FiberCondition() {}
+
+    // 释放lock并等待, 被唤醒后重新加锁; 可能虚假唤醒, 调用者应在循环中检查条件
+    void wait(FiberMutex::Lock& lock);
+    /**
+     * @brief 最多等待timeout_ms
+     * @return 超时返回false, 返回时都已重新加锁
+     */
+    bool waitFor(FiberMutex::Lock& lock, uint64_t timeout_ms);
+
+    void notify();
+    void notifyAll();
+private:
+    FiberCondition(const FiberCondition&) = delete;
+    FiberCondition& operator=(const FiberCondition&) = delete;
+private:
+    FiberWaitQueue::MutexType m_mutex;
+    FiberWaitQueue m_queue;
+};
+
+/**
+ * @brief 协程信号量
+ */
+class FiberSemaphore {
+public:
+    FiberSemaphore(uint32_t count = 0)
+        :m_count(count) {
+    }
+
+    void wait();
+    bool tryWait();
+    /**
+     * @brief 最多等待timeout_ms
+     * @return 是否拿到计数
+     */
+    bool waitFor(uint64_t timeout_ms);
+    void notify(uint32_t n = 1);
+
+    uint32_t getCount() const { return m_count;}
+private:
+    FiberSemaphore(const FiberSemaphore&) = delete;
+    FiberSemaphore& operator=(const FiberSemaphore&) = delete;
+private:
+    FiberWaitQueue::MutexType m_mutex;
+    FiberWaitQueue m_queue;
+    uint32_t m_count;
+};
+
+/**
+ * @brief 等待一组任务完成
+ * @details 发起任务前add, 每个任务完成时done, wait挂起直到计数归零
+ */
+class WaitGroup {
+public:
+    WaitGroup() {}
+    ~WaitGroup();
+
+    void add(uint32_t n = 1);
+    void done();
+
+    void wait();
+    /**
+     * @brief 最多等待timeout_ms
+     * @return 超时返回false
+     */
+    bool waitFor(uint64_t timeout_ms);
+
+    uint32_t getCount();
+private:
+    WaitGroup(const WaitGroup&) = delete;
+    WaitGroup& operator=(const WaitGroup&) = delete;
+private:
+    FiberWaitQueue::MutexType m_mutex;
+    FiberWaitQueue m_queue;
+    uint32_t m_count = 0;
+};
+
+}
+
+#endif
@@ -0,0 +1,96 @@
+#include "future.h"
+
+#include <atomic>
+
+namespace sylar {
+
+bool FutureStateBase::isReady() {
+    MutexType::Lock lock(m_mutex);
+    return m_ready;
+}
+
+bool FutureStateBase::wait(uint64_t timeout_ms) {
+    MutexType::Lock lock(m_mutex);
+    if(m_ready) {
+        return true;
+    }
+    //就绪时唤醒全部等待者, 被唤醒即已就绪
+    return m_waiters.wait(lock, timeout_ms);
+}
+
+void FutureStateBase::setException(std::exception_ptr error) {
+    MutexType::Lock lock(m_mutex);
+    SYLAR_ASSERT2(!m_ready, "promise already satisfied");
+    m_error = error;
+    markReady(lock);
+}
+
+void FutureStateBase::then(const std::function<void()>& cb) {
+    MutexType::Lock lock(m_mutex);
+    if(!m_ready) {
+        m_callbacks.push_back(cb);
+        return;
+    }
+    lock.unlock();
+    cb();
+}
+
+void FutureStateBase::rethrow() {
+    if(m_error) {
+        std::rethrow_exception(m_error);
+    }
+}
+
+void FutureStateBase::markReady(MutexType::Lock& lock) {
+    m_ready = true;
+    std::vector<FiberWaiter::ptr> waiters;
+    while(FiberWaiter::ptr waiter = m_waiters.pop()) {
+        waiters.push_back(waiter);
+    }
+    std::vector<std::function<void()> > cbs;
+    cbs.swap(m_callbacks);
+    lock.unlock();
+
+    for(auto& i : waiters) {
+        i->wake(false);
+    }
+    for(auto& i : cbs) {
+        i();
+    }
+}
+
+Future<void> WhenAll(const std::vector<FutureStateBase::ptr>& states) {
+    Promise<void> promise;
+    Future<void> future = promise.getFuture();
+    if(states.empty()) {
+        promise.setValue();
+        return future;
+    }
+    std::shared_ptr<std::atomic<size_t> > left
+        = std::make_shared<std::atomic<size_t> >(states.size());
+    for(auto& i : states) {
+        i->then([promise, left]() mutable {
+            if(--*left == 0) {
+                promise.setValue();
+            }
+        });
+    }
+    return future;
+}
+
+Future<size_t> WhenAny(const std::vector<FutureStateBase::ptr>& states) {
+    Promise<size_t> promise;
+    Future<size_t> future = promise.getFuture();
+    std::shared_ptr<std::atomic<bool> > done
+        = std::make_shared<std::atomic<bool> >(false);
+    for(size_t i = 0; i < states.size(); ++i) {
+        states[i]->then([promise, done, i]() mutable {
+            if(!done->exchange(true)) {
+                promise.setValue(i);
+            }
+        });
+    }
+    return future;
+}
+
+}
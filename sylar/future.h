@@ -0,0 +1,246 @@
+#ifndef __SYLAR_FUTURE_H__
+#define __SYLAR_FUTURE_H__
+
+/*
+  调度任务的结果: Promise/Future
+
+  Async(scheduler, fn)把fn放入调度器执行, 返回Future<R>, R为fn的返回值类型(可以是void).
+  Future::get()在协程中挂起当前协程直到结果就绪, 不在协程中时阻塞线程; fn抛出的异常在get()中重新抛出.
+  Future可以拷贝, 多个协程可以同时等待同一个结果.
+
+  WhenAll/WhenAny组合多个Future, 用于并发发出多个请求后等全部或第一个完成:
+    std::vector<Future<int> > fs;
+    for(...) fs.push_back(Async(iom, [](){ return call();}));
+    WhenAll(fs).get();
+*/
+
+#include <stddef.h>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "fiber_sync.h"
+#include "log.h"
+#include "macro.h"
+#include "scheduler.h"
+
+namespace sylar {
+
+/**
+ * @brief 与结果类型无关的共享状态: 就绪标记, 异常, 等待者和回调
+ */
+class FutureStateBase {
+public:
+    typedef std::shared_ptr<FutureStateBase> ptr;
+    typedef Spinlock MutexType;
+
+    virtual ~FutureStateBase() {}
+
+    bool isReady();
+
+    /**
+     * @brief 等待结果就绪
+     * @param[in] timeout_ms 超时时间, ~0ull为不超时; 协程中带超时必须在IOManager里
+     * @return 超时返回false
+     */
+    bool wait(uint64_t timeout_ms = ~0ull);
+
+    // 以异常完成
+    void setException(std::exception_ptr error);
+
+    /**
+     * @brief 就绪时执行cb, 已就绪则立即在当前线程执行
+     * @details cb在完成结果的协程/线程中执行, 不能阻塞或让出
+     */
+    void then(const std::function<void()>& cb);
+
+    // 就绪后调用, 有异常则重新抛出
+    void rethrow();
+protected:
+    // 持锁调用, 标记就绪并唤醒等待者, 返回时锁已释放
+    void markReady(MutexType::Lock& lock);
+protected:
+    MutexType m_mutex;
+    bool m_ready = false;
+    std::exception_ptr m_error;
+    FiberWaitQueue m_waiters;
+    std::vector<std::function<void()> > m_callbacks;
+};
+
+template<class T>
+class FutureState : public FutureStateBase {
+public:
+    typedef std::shared_ptr<FutureState> ptr;
+
+    template<class U>
+    void setValue(U&& v) {
+        MutexType::Lock lock(m_mutex);
+        SYLAR_ASSERT2(!m_ready, "promise already satisfied");
+        m_value.reset(new T(std::forward<U>(v)));
+        markReady(lock);
+    }
+
+    const T& get() {
+        wait();
+        rethrow();
+        return *m_value;
+    }
+private:
+    std::unique_ptr<T> m_value;
+};
+
+template<>
+class FutureState<void> : public FutureStateBase {
+public:
+    typedef std::shared_ptr<FutureState> ptr;
+
+    void setValue() {
+        MutexType::Lock lock(m_mutex);
+        SYLAR_ASSERT2(!m_ready, "promise already satisfied");
+        markReady(lock);
+    }
+
+    void get() {
+        wait();
+        rethrow();
+    }
+};
+
+/**
+ * @brief 结果的读取端
+ */
+template<class T>
+class Future {
+public:
+    Future() {}
+    explicit Future(typename FutureState<T>::ptr state)
+        :m_state(state) {
+    }
+
+    // 是否关联了结果
+    bool valid() const { return (bool)m_state;}
+    bool isReady() const { return m_state->isReady();}
+
+    // 等待就绪, 不抛出异常
+    void wait() const { m_state->wait();}
+
+    /**
+     * @brief 最多等待timeout_ms
+     * @return 超时返回false
+     */
+    bool waitFor(uint64_t timeout_ms) const { return m_state->wait(timeout_ms);}
+
+    /**
+     * @brief 等待并取结果, T为void时返回void
+     * @details 结果以异常完成时重新抛出
+     */
+    auto get() const -> decltype(std::declval<FutureState<T> >().get()) {
+        return m_state->get();
+    }
+
+    // 就绪时执行cb, 见FutureStateBase::then
+    void then(const std::function<void()>& cb) const { m_state->then(cb);}
+
+    FutureStateBase::ptr getState() const { return m_state;}
+private:
+    typename FutureState<T>::ptr m_state;
+};
+
+/**
+ * @brief 结果的写入端, 只能完成一次
+ */
+template<class T>
+class Promise {
+public:
+    Promise()
+        :m_state(std::make_shared<FutureState<T> >()) {
+    }
+
+    Future<T> getFuture() const { return Future<T>(m_state);}
+
+    template<class... Args>
+    void setValue(Args&&... args) { m_state->setValue(std::forward<Args>(args)...);}
+
+    void setException(std::exception_ptr error) { m_state->setException(error);}
+private:
+    typename FutureState<T>::ptr m_state;
+};
+
+namespace detail {
+
+// 执行fn并把返回值或异常写入promise
+template<class R>
+struct Fulfill {
+    template<class F>
+    static void run(Promise<R>& promise, F& fn) {
+        promise.setValue(fn());
+    }
+};
+
+template<>
+struct Fulfill<void> {
+    template<class F>
+    static void run(Promise<void>& promise, F& fn) {
+        fn();
+        promise.setValue();
+    }
+};
+
+}
+
+/**
+ * @brief 在调度器中执行fn, 返回其结果的Future
+ * @param[in] scheduler 调度器
+ * @param[in] fn 无参可调用对象
+ * @param[in] thread 指定线程, -1为任意线程
+ * @param[in] priority 优先级
+ */
+template<class F>
+Future<typename std::result_of<F()>::type> Async(Scheduler* scheduler, F fn
+        ,int thread = -1, Scheduler::Priority priority = Scheduler::NORMAL) {
+    typedef typename std::result_of<F()>::type R;
+    Promise<R> promise;
+    Future<R> future = promise.getFuture();
+    scheduler->schedule([promise, fn]() mutable {
+        try {
+            detail::Fulfill<R>::run(promise, fn);
+        } catch(...) {
+            promise.setException(std::current_exception());
+        }
+    }, thread, priority);
+    return future;
+}
+
+/**
+ * @brief 所有Future都就绪时就绪, 其中的异常不传递, 需要逐个get
+ */
+Future<void> WhenAll(const std::vector<FutureStateBase::ptr>& states);
+
+/**
+ * @brief 任一Future就绪时就绪, 结果为它的下标; 列表为空时永不就绪
+ */
+Future<size_t> WhenAny(const std::vector<FutureStateBase::ptr>& states);
+
+template<class T>
+Future<void> WhenAll(const std::vector<Future<T> >& futures) {
+    std::vector<FutureStateBase::ptr> states;
+    for(auto& i : futures) {
+        states.push_back(i.getState());
+    }
+    return WhenAll(states);
+}
+
+template<class T>
+Future<size_t> WhenAny(const std::vector<Future<T> >& futures) {
+    std::vector<FutureStateBase::ptr> states;
+    for(auto& i : futures) {
+        states.push_back(i.getState());
+    }
+    return WhenAny(states);
+}
+
+}
+
+#endif
@@ -0,0 +1,69 @@
+#include "histogram.h"
+#include <sstream>
+
+namespace sylar {
+
+Histogram::Histogram() {
+    for(int i = 0; i < BUCKETS; ++i) {
+        m_buckets[i] = 0;
+    }
+    m_count = 0;
+    m_sum = 0;
+    m_max = 0;
+}
+
+void Histogram::snapshot(Snapshot& s) const {
+    for(int i = 0; i < BUCKETS; ++i) {
+        s.buckets[i] = m_buckets[i].load(std::memory_order_relaxed);
+    }
+    s.count = m_count.load(std::memory_order_relaxed);
+    s.sum = m_sum.load(std::memory_order_relaxed);
+    s.max = m_max.load(std::memory_order_relaxed);
+}
+
+void Histogram::Snapshot::merge(const Snapshot& other) {
+    for(int i = 0; i < BUCKETS; ++i) {
+        buckets[i] += other.buckets[i];
+    }
+    count += other.count;
+    sum += other.sum;
+    if(other.max > max) {
+        max = other.max;
+    }
+}
+
+uint64_t Histogram::Snapshot::percentile(double p) const {
+    uint64_t total = 0;
+    for(int i = 0; i < BUCKETS; ++i) {
+        total += buckets[i];
+    }
+    if(total == 0) {
+        return 0;
+    }
+    uint64_t rank = (uint64_t)(p * total);
+    if(rank >= total) {
+        rank = total - 1;
+    }
+    uint64_t seen = 0;
+    for(int i = 0; i < BUCKETS; ++i) {
+        seen += buckets[i];
+        if(seen > rank) {
+            uint64_t upper = i ? (1ull << i) - 1 : 0;
+            return upper < max ? upper : max;
+        }
+    }
+    return max;
+}
+
+std::string Histogram::Snapshot::toString() const {
+    std::stringstream ss;
+    ss << "count=" << count
+       << " mean=" << (uint64_t)mean()
+       << " p50=" << percentile(0.5)
+       << " p90=" << percentile(0.9)
+       << " p99=" << percentile(0.99)
+       << " max=" << max;
+    return ss.str();
+}
+
+}
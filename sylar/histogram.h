@@ -0,0 +1,76 @@
+#ifndef __SYLAR_HISTOGRAM_H__
+#define __SYLAR_HISTOGRAM_H__
+
+/*
+  按2的幂分桶的直方图, 用于调度器的排队延迟和运行时长统计
+
+  第i个桶统计[2^(i-1), 2^i)范围的值, 第0个桶统计0.
+  只有一个线程写(所属工作线程), 写入用relaxed的load+store, 不需要加锁和原子加;
+  其他线程随时可以读快照, 各字段之间不保证一致, 用于监控足够
+*/
+
+#include <stdint.h>
+#include <atomic>
+#include <string>
+
+namespace sylar {
+
+class Histogram {
+public:
+    static const int BUCKETS = 48;
+
+    /**
+     * @brief 直方图快照, 可以合并多个线程的
+     */
+    struct Snapshot {
+        uint64_t buckets[BUCKETS] = {0};
+        uint64_t count = 0;     //// 样本数
+        uint64_t sum = 0;       //// 样本之和
+        uint64_t max = 0;       //// 最大值
+
+        void merge(const Snapshot& other);
+        double mean() const { return count ? (double)sum / count : 0;}
+        /**
+         * @brief 百分位数的近似值
+         * @param[in] p 0~1
+         * @return p所在桶的上界, 不超过max
+         */
+        uint64_t percentile(double p) const;
+        std::string toString() const;
+    };
+
+    Histogram();
+
+    // 记录一个样本, 只能由所属线程调用
+    void record(uint64_t v) {
+        int idx = v ? 64 - __builtin_clzll(v) : 0;
+        if(idx >= BUCKETS) {
+            idx = BUCKETS - 1;
+        }
+        add(m_buckets[idx], 1);
+        add(m_count, 1);
+        add(m_sum, v);
+        if(v > m_max.load(std::memory_order_relaxed)) {
+            m_max.store(v, std::memory_order_relaxed);
+        }
+    }
+
+    // 读取快照, 任何线程都可以调用
+    void snapshot(Snapshot& s) const;
+    // 只读样本数和总和, 比snapshot轻
+    uint64_t getCount() const { return m_count.load(std::memory_order_relaxed);}
+    uint64_t getSum() const { return m_sum.load(std::memory_order_relaxed);}
+private:
+    static void add(std::atomic<uint64_t>& a, uint64_t v) {
+        a.store(a.load(std::memory_order_relaxed) + v, std::memory_order_relaxed);
+    }
+private:
+    std::atomic<uint64_t> m_buckets[BUCKETS];
+    std::atomic<uint64_t> m_count;
+    std::atomic<uint64_t> m_sum;
+    std::atomic<uint64_t> m_max;
+};
+
+}
+
+#endif
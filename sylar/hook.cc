@@ -7,6 +7,10 @@
 
 #include "config.h"
 #include "fd_manager.h"
+#include "offload.h"
+
+#include <linux/io_uring.h>
+#include <sys/stat.h>
 
 sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("system");
 
@@ -17,6 +21,9 @@ static sylar::ConfigVar<int>::ptr g_tcp_connect_timeout =
 
 static thread_local bool t_hook_enable = false;
 
+//hook的socket IO真正发出的系统调用次数
+static std::atomic<uint64_t> s_io_calls(0);
+
 #define HOOK_FUN(XX) \
     XX(sleep) \
     XX(usleep) \
@@ -74,6 +81,10 @@ void set_hook_enable(bool flag) {
     t_hook_enable = flag;
 }
 
+uint64_t get_hook_io_calls() {
+    return s_io_calls;
+}
+
 }
 
 ///下边定时器可能用到条件定时器，定义条件
@@ -82,6 +93,25 @@ struct timer_info {
 };
 
 
+//在offload线程池中执行阻塞的文件读写, 当前协程挂起
+template<typename OriginFun, typename ... Args>
+static ssize_t do_file_io(int fd, OriginFun fun, Args&&... args) {
+    //普通文件总是"就绪", epoll不支持, 只能放到offload线程池里阻塞
+    ssize_t n = -1;
+    int error = 0;
+    sylar::Offload([&](){
+        n = fun(fd, args...);
+        error = errno;
+    });
+    errno = error;
+    return n;
+}
+
+static bool is_regular_file(int fd) {
+    struct stat st;
+    return fstat(fd, &st) == 0 && S_ISREG(st.st_mode);
+}
+
 /**
  * @brief 实现一个统一的IO读写的函数
  * @param fd 文件描述符
@@ -91,7 +121,7 @@ struct timer_info {
  * @param timeout_so 超时类型
  * @param args 参数
  */
-template<typename OriginFun, typename ... Args>
+template<typename OriginFun, typename... Args>
 static ssize_t do_io(int fd, OriginFun fun, const char* hook_fun_name, 
         uint32_t event, int timeout_so, Args&&... args) { 
     if(!sylar::t_hook_enable) {
@@ -100,6 +130,10 @@ static ssize_t do_io(int fd, OriginFun fun, const char* hook_fun_name,
     }
     
     sylar::FdCtx::ptr ctx = sylar::FdMgr::GetInstance()->get(fd);
+    if((!ctx || !ctx->isSocket()) && sylar::IsFileIOOffload()
+            && is_regular_file(fd)) {
+        return do_file_io(fd, fun, std::forward<Args>(args)...);
+    }
     if(!ctx) {
         // 获取文件描述符实例 -- 失败 -- 不存在
         return fun(fd, std::forward<Args>(args)...);
@@ -123,15 +157,21 @@ static ssize_t do_io(int fd, OriginFun fun, const char* hook_fun_name,
 retry:
 
     ///执行函数方法--如果返回有效直接返回 -- n
+    sylar::s_io_calls.fetch_add(1, std::memory_order_relaxed);
     ssize_t n = fun(fd, std::forward<Args>(args)...);
     /// 函数方法返回-1且错误码为EINTR--中断---那就重试 -- 读到数据返回
     while(n == -1 && errno == EINTR) {
+        sylar::s_io_calls.fetch_add(1, std::memory_order_relaxed);
         n = fun(fd, std::forward<Args>(args)...);
     }
 
     /// 重试后状态发生变化 -- 阻塞状态 -- 没有数据来 -- 进行IO操作  （阻塞状态需要进行异步操作）
     if(n == -1 && errno == EAGAIN) {
         sylar::IOManager* iom = sylar::IOManager::GetThis();
+        /// 没有等待时边沿已经来过, 数据可能是在上面的调用之后到的, 重试而不挂起
+        if(iom->consumeReady(fd, (sylar::IOManager::Event)(event))) {
+            goto retry;
+        }
         /// 定时器
         sylar::Timer::ptr timer;
         /// 条件变量
@@ -148,10 +188,10 @@ retry:
                 }
                 t->cancelled = ETIMEDOUT;
                 iom->cancelEvent(fd, (sylar::IOManager::Event)(event));
-            }, winfo);
+            }, winfo, false, true);
         }
         /// 取消之后会从Event中唤醒回来，那么就增加事件
-        int rt = iom->addEvent(fd, (sylar::IOManager::Event)(event));
+        int rt = iom->addEvent(fd, (sylar::IOManager::Event)(event), nullptr, true);
         if(rt) {
             /// 增加失败，取消定时器，报错退出
             SYLAR_LOG_ERROR(g_logger) << hook_fun_name << " addEvent("
@@ -180,6 +220,33 @@ retry:
     return n;
 }
 
+/**
+ * @brief io_uring后端: 直接提交SQE, 协程挂起到CQE到达, 省掉试探的系统调用和epoll_ctl
+ * @param[out] n 系统调用的返回值
+ * @return 是否已经执行, false时由调用者走epoll路径
+ */
+static bool do_uring_io(int fd, uint8_t opcode, int timeout_so, ssize_t& n
+        ,uint64_t addr, uint32_t len, uint64_t off, uint32_t op_flags) {
+    if(!sylar::t_hook_enable) {
+        return false;
+    }
+    sylar::IOManager* iom = sylar::IOManager::GetThis();
+    if(!iom || !iom->hasUring()) {
+        return false;
+    }
+    //内核在协程挂起期间填写addr, 共享栈协程挂起时栈上是别的协程
+    if(sylar::Fiber::GetThis()->isSharedStack()) {
+        return false;
+    }
+    sylar::FdCtx::ptr ctx = sylar::FdMgr::GetInstance()->get(fd);
+    if(!ctx || ctx->isClose() || !ctx->isSocket() || ctx->getUserNonblock()) {
+        return false;
+    }
+    n = iom->submitIO(opcode, fd, addr, len, off, op_flags, ctx->getTimeout(timeout_so));
+    //没能提交, 或老内核遵守O_NONBLOCK直接返回了EAGAIN
+    return !(n == -1 && errno == EAGAIN);
+}
+
 extern "C" { 
 #define XX(name) name ## _fun name ## _f = nullptr;
     HOOK_FUN(XX);
@@ -192,8 +259,9 @@ unsigned int sleep(unsigned int seconds) {
     sylar::Fiber::ptr fiber = sylar::Fiber::GetThis();
     sylar::IOManager* iom = sylar::IOManager::GetThis();
     iom->addTimer(seconds * 1000, std::bind((void(sylar::Scheduler::*)
-            (sylar::Fiber::ptr, int thread))&sylar::IOManager::schedule
-            ,iom, fiber, -1));
+            (sylar::Fiber::ptr, int thread, sylar::Scheduler::Priority))
+            &sylar::IOManager::schedule
+            ,iom, fiber, -1, sylar::Scheduler::NORMAL), false, true);
     sylar::Fiber::YieldToHold();
     return 0;
 }
@@ -205,8 +273,9 @@ int usleep(useconds_t usec) {
     sylar::Fiber::ptr fiber = sylar::Fiber::GetThis();
     sylar::IOManager* iom = sylar::IOManager::GetThis();
     iom->addTimer(usec / 1000, std::bind((void(sylar::Scheduler::*)
-            (sylar::Fiber::ptr, int thread))&sylar::IOManager::schedule
-            ,iom, fiber, -1));
+            (sylar::Fiber::ptr, int thread, sylar::Scheduler::Priority))
+            &sylar::IOManager::schedule
+            ,iom, fiber, -1, sylar::Scheduler::NORMAL), false, true);
     sylar::Fiber::YieldToHold();
     return 0;
 }
@@ -219,8 +288,9 @@ int nanosleep(const struct timespec *req, struct timespec *rem) {
     sylar::Fiber::ptr fiber = sylar::Fiber::GetThis();
     sylar::IOManager* iom = sylar::IOManager::GetThis();
     iom->addTimer(timeout_ms, std::bind((void(sylar::Scheduler::*)
-            (sylar::Fiber::ptr, int thread))&sylar::IOManager::schedule
-            ,iom, fiber, -1));
+            (sylar::Fiber::ptr, int thread, sylar::Scheduler::Priority))
+            &sylar::IOManager::schedule
+            ,iom, fiber, -1, sylar::Scheduler::NORMAL), false, true);
     sylar::Fiber::YieldToHold();
     return 0;
 }
@@ -259,14 +329,28 @@ int connect_with_timeout(int fd, const struct sockaddr* addr, socklen_t addrlen,
         return connect_f(fd, addr, addrlen);
     }
 
-    int n = connect_f(fd, addr, addrlen);
-    if(n == 0) {
-        return 0;
-    } else if(n != -1 || errno != EINPROGRESS) {
-        return n;
+    sylar::IOManager* iom = sylar::IOManager::GetThis();
+    int n = -1;
+    bool in_progress = false;
+    //共享栈协程不走io_uring, 见do_uring_io
+    if(iom->hasUring() && !sylar::Fiber::GetThis()->isSharedStack()) {
+        n = iom->submitIO(IORING_OP_CONNECT, fd, (uint64_t)addr, 0, addrlen, 0, timeout_ms);
+        if(n == 0 || (errno != EAGAIN && errno != EINPROGRESS)) {
+            return n;
+        }
+        //老内核对非阻塞socket返回EINPROGRESS, 连接已经发起, 和epoll路径一样等可写
+        in_progress = errno == EINPROGRESS;
+    }
+    if(!in_progress) {
+        sylar::s_io_calls.fetch_add(1, std::memory_order_relaxed);
+        n = connect_f(fd, addr, addrlen);
+        if(n == 0) {
+            return 0;
+        } else if(n != -1 || errno != EINPROGRESS) {
+            return n;
+        }
     }
 
-    sylar::IOManager* iom = sylar::IOManager::GetThis();
     sylar::Timer::ptr timer;
     std::shared_ptr<timer_info> tinfo(new timer_info);
     std::weak_ptr<timer_info> winfo(tinfo);
@@ -279,7 +363,7 @@ int connect_with_timeout(int fd, const struct sockaddr* addr, socklen_t addrlen,
                 }
                 t->cancelled = ETIMEDOUT;
                 iom->cancelEvent(fd, sylar::IOManager::WRITE);
-        }, winfo);
+        }, winfo, false, true);
     }
 
     int rt = iom->addEvent(fd, sylar::IOManager::WRITE);
@@ -316,7 +400,13 @@ int connect(int sockfd, const struct sockaddr *addr, socklen_t addrlen) {
 }
 
 int accept(int s, struct sockaddr *addr, socklen_t *addrlen) {
-    int fd = do_io(s, accept_f, "accept", sylar::IOManager::READ, SO_RCVTIMEO, addr, addrlen);
+    ssize_t n = 0;
+    int fd = -1;
+    if(do_uring_io(s, IORING_OP_ACCEPT, SO_RCVTIMEO, n, (uint64_t)addr, 0, (uint64_t)addrlen, 0)) {
+        fd = n;
+    } else {
+        fd = do_io(s, accept_f, "accept", sylar::IOManager::READ, SO_RCVTIMEO, addr, addrlen);
+    }
     if(fd >= 0) {
         sylar::FdMgr::GetInstance()->get(fd, true);
     }
@@ -329,6 +419,11 @@ int accept(int s, struct sockaddr *addr, socklen_t *addrlen) {
 
 
 ssize_t read(int fd, void *buf, size_t count) {
+    //只有socket走io_uring, 用RECV即可
+    ssize_t n = 0;
+    if(do_uring_io(fd, IORING_OP_RECV, SO_RCVTIMEO, n, (uint64_t)buf, count, 0, 0)) {
+        return n;
+    }
     return do_io(fd, read_f, "read", sylar::IOManager::READ, SO_RCVTIMEO, buf, count);
 }
 
@@ -337,6 +432,10 @@ ssize_t readv(int fd, const struct iovec *iov, int iovcnt) {
 }
 
 ssize_t recv(int sockfd, void *buf, size_t len, int flags) {
+    ssize_t n = 0;
+    if(do_uring_io(sockfd, IORING_OP_RECV, SO_RCVTIMEO, n, (uint64_t)buf, len, 0, flags)) {
+        return n;
+    }
     return do_io(sockfd, recv_f, "recv", sylar::IOManager::READ, SO_RCVTIMEO, buf, len, flags);
 }
 
@@ -357,6 +456,10 @@ ssize_t writev(int fd, const struct iovec *iov, int iovcnt) {
 }
 
 ssize_t send(int s, const void *msg, size_t len, int flags) {
+    ssize_t n = 0;
+    if(do_uring_io(s, IORING_OP_SEND, SO_SNDTIMEO, n, (uint64_t)msg, len, 0, flags)) {
+        return n;
+    }
     return do_io(s, send_f, "send", sylar::IOManager::WRITE, SO_SNDTIMEO, msg, len, flags);
 }
 
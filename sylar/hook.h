@@ -17,6 +17,8 @@
 namespace sylar {
     bool is_hook_enable();
     void set_hook_enable(bool flag);
+    //hook的socket IO真正发出的系统调用次数(不含io_uring_enter), 用于统计
+    uint64_t get_hook_io_calls();
 }
 
 extern "C" {
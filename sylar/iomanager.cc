@@ -1,18 +1,34 @@
 #include "iomanager.h"
 #include "macro.h"
 #include "log.h"
+#include "config.h"
+#include "util.h"
 
+#include <linux/io_uring.h>
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <unistd.h>
 #include <fcntl.h> 
 #include <errno.h>
 #include <string.h>
 #include <unistd.h>
+#include <algorithm>
 
 namespace sylar {
 
 static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("system");
 
+static ConfigVar<std::map<std::string, bool> >::ptr g_iomanager_per_thread_epoll =
+    Config::Lookup("iomanager.per_thread_epoll", std::map<std::string, bool>()
+            , "one epoll per worker thread, iomanager name => enable, fds stay on the thread that first waits on them");
+
+static ConfigVar<std::string>::ptr g_iomanager_backend =
+    Config::Lookup<std::string>("iomanager.backend", "epoll"
+            , "hooked socket io backend: epoll or io_uring(falls back to epoll if the kernel lacks support)");
+
+// 每个io_uring的SQ大小, 每次提交都立即进入内核, 不需要很大
+static const uint32_t URING_ENTRIES = 256;
+
 IOManager::FdContext::EventContext& IOManager::FdContext::getContext(IOManager::Event event) {
     switch (event) {
         case IOManager::READ:
@@ -28,84 +44,274 @@ void IOManager::FdContext::resetContext(EventContext& ctx) {
     ctx.fiber.reset();
     ctx.cb = nullptr;
 }
-void IOManager::FdContext::triggerEvent(IOManager::Event event) {
+void IOManager::FdContext::takeEvent(IOManager::Event event, int thread, Waiter& out) {
     SYLAR_ASSERT(events & event);
     events = (Event)(events & ~event);
     EventContext& ctx = getContext(event);
-    if(ctx.cb) {
-        ctx.scheduler->schedule(&ctx.cb);
+    out.ctx.scheduler = ctx.scheduler;
+    out.ctx.fiber.swap(ctx.fiber);
+    out.ctx.cb.swap(ctx.cb);
+    out.thread = thread;
+    ctx.scheduler = nullptr;
+}
+
+void IOManager::Dispatch(FdContext::Waiter& waiter, TaskList* batch) {
+    FdContext::EventContext& ctx = waiter.ctx;
+    if(!ctx.scheduler) {
+        return;
+    }
+    if(batch && ctx.scheduler == Scheduler::GetThis()) {
+        Task* task = ctx.cb ? MakeTask(&ctx.cb, waiter.thread) : MakeTask(&ctx.fiber, waiter.thread);
+        if(task) {
+            batch->push_back(task);
+        }
+    } else if(ctx.cb) {
+        ctx.scheduler->schedule(&ctx.cb, waiter.thread);
     } else {
-        ctx.scheduler->schedule(&ctx.fiber);
+        ctx.scheduler->schedule(&ctx.fiber, waiter.thread);
     }
     ctx.scheduler = nullptr;
-    return;
 }
 
 IOManager::IOManager(size_t threads, bool use_caller, const std::string& name)
-    :Scheduler(threads, use_caller, name) {
-    m_epfd = epoll_create(5000);
-    SYLAR_ASSERT(m_epfd > 0);
-    
-    int rt = pipe(m_tickleFds);
-    SYLAR_ASSERT(!rt);
+    :Scheduler(threads, use_caller, name)
+    ,m_fdChunks(FD_TABLE_SIZE) {
+    std::map<std::string, bool> per_thread = g_iomanager_per_thread_epoll->getValue();
+    auto it = per_thread.find(getName());
+    m_perThreadEpoll = it != per_thread.end() && it->second;
+    //worker在Scheduler构造时已按线程数上限分配好, 之后不再变化. Poll含原子量不能resize
+    m_polls = std::vector<Poll>(m_perThreadEpoll ? getWorkerCount() : 1);
+    for(auto& i : m_polls) {
+        initPoll(i);
+    }
+    for(size_t i = 0; i < getWorkerCount(); ++i) {
+        m_wakeLatency.push_back(new Histogram);
+    }
+    if(g_iomanager_backend->getValue() == "io_uring") {
+        initUring();
+    }
+
+    start();
+
+}
+IOManager::~IOManager() {
+    stop();
+    for(auto& i : m_polls) {
+        close(i.epfd);
+        close(i.wakeFd);
+    }
+    for(auto i : m_wakeLatency) {
+        delete i;
+    }
+
+    for(auto& i : m_fdChunks) {
+        FdChunk* chunk = i.load(std::memory_order_relaxed);
+        if(!chunk) {
+            continue;
+        }
+        for(auto& j : chunk->ctxs) {
+            delete j.load(std::memory_order_relaxed);
+        }
+        delete chunk;
+    }
+}
+
+void IOManager::initPoll(Poll& poll) {
+    poll.epfd = epoll_create(5000);
+    SYLAR_ASSERT(poll.epfd > 0);
+
+    poll.wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    SYLAR_ASSERT(poll.wakeFd >= 0);
 
     epoll_event event;
     memset(&event, 0, sizeof(epoll_event));
     //水平触发 | 边沿触发--只触发一次
     event.events = EPOLLIN | EPOLLET;
-    event.data.fd = m_tickleFds[0];
+    //fd上下文的指针不会为空, 用空指针标识eventfd
+    event.data.ptr = nullptr;
 
-    rt = fcntl(m_tickleFds[0], F_SETFL, O_NONBLOCK);
+    int rt = epoll_ctl(poll.epfd, EPOLL_CTL_ADD, poll.wakeFd, &event);
     SYLAR_ASSERT(!rt);
+}
 
-    rt = epoll_ctl(m_epfd, EPOLL_CTL_ADD, m_tickleFds[0], &event);
-    SYLAR_ASSERT(!rt);
+void IOManager::initUring() {
+    for(auto& i : m_polls) {
+        i.ring = IoUring::Create(URING_ENTRIES);
+        if(!i.ring) {
+            break;
+        }
+        epoll_event event;
+        memset(&event, 0, sizeof(epoll_event));
+        event.events = EPOLLIN | EPOLLET;
+        event.data.ptr = i.ring.get();
+        int rt = epoll_ctl(i.epfd, EPOLL_CTL_ADD, i.ring->getFd(), &event);
+        if(rt) {
+            SYLAR_LOG_ERROR(g_logger) << "epoll_ctl(" << i.epfd << ", ADD, io_uring "
+                << i.ring->getFd() << ") errno=" << errno << " errstr=" << strerror(errno);
+            i.ring.reset();
+            break;
+        }
+    }
+    if(!m_polls.back().ring) {
+        SYLAR_LOG_WARN(g_logger) << "name=" << getName()
+            << " io_uring not supported, fall back to epoll";
+        for(auto& i : m_polls) {
+            i.ring.reset();
+        }
+    }
+}
 
-    contextResize(32);
+IOManager::Poll& IOManager::currentPoll() {
+    if(!m_perThreadEpoll) {
+        return m_polls[0];
+    }
+    int idx = getWorkerIndex();
+    SYLAR_ASSERT(idx >= 0);
+    return m_polls[idx];
+}
 
-    start();
+int IOManager::pickOwner() {
+    if(!m_perThreadEpoll) {
+        return 0;
+    }
+    int cur = getWorkerIndex();
+    if(cur >= 0 && !isCallerWorker(cur)) {
+        return cur;
+    }
+    //外部线程和use_caller线程(只在stop()时调度)注册的fd轮流分给有线程的worker
+    size_t n = m_polls.size();
+    uint32_t start = m_nextPoll.fetch_add(1, std::memory_order_relaxed);
+    for(size_t i = 0; i < n; ++i) {
+        size_t idx = (start + i) % n;
+        if(!isCallerWorker(idx) && getWorkerThread(idx) != -1) {
+            return idx;
+        }
+    }
+    //只有use_caller线程
+    return 0;
+}
 
+int IOManager::eventThread(FdContext* fd_ctx, Event event) {
+    if(!m_perThreadEpoll) {
+        return -1;
+    }
+    FdContext::EventContext& ctx = fd_ctx->getContext(event);
+    //其他调度器上等待的协程回到原调度器, 共享栈协程只能回到绑定的线程
+    if(ctx.scheduler != this
+            || (ctx.fiber && ctx.fiber->getBoundThread() != -1)) {
+        return -1;
+    }
+    return getWorkerThread(fd_ctx->owner);
 }
-IOManager::~IOManager() {
-    stop();
-    close(m_epfd);
-    close(m_tickleFds[0]);
-    close(m_tickleFds[1]);
 
-    for(size_t i = 0; i < m_fdContexts.size(); ++i) {
-        if(m_fdContexts[i]) {
-            delete m_fdContexts[i];
+IOManager::FdContext* IOManager::getFdContext(int fd, bool create) {
+    if(fd < 0 || fd >= FD_TABLE_SIZE * FD_CHUNK_SIZE) {
+        return nullptr;
+    }
+    //创建时多个线程竞争同一个槽位, CAS失败的一方释放自己的, 用赢家的
+    std::atomic<FdChunk*>& chunk_slot = m_fdChunks[fd >> FD_CHUNK_BITS];
+    FdChunk* chunk = chunk_slot.load(std::memory_order_acquire);
+    if(!chunk) {
+        if(!create) {
+            return nullptr;
+        }
+        FdChunk* new_chunk = new FdChunk();
+        if(chunk_slot.compare_exchange_strong(chunk, new_chunk
+                    ,std::memory_order_acq_rel, std::memory_order_acquire)) {
+            chunk = new_chunk;
+            ++m_fdChunkCount;
+        } else {
+            delete new_chunk;
         }
     }
+
+    std::atomic<FdContext*>& ctx_slot = chunk->ctxs[fd & (FD_CHUNK_SIZE - 1)];
+    FdContext* fd_ctx = ctx_slot.load(std::memory_order_acquire);
+    if(!fd_ctx && create) {
+        FdContext* new_ctx = new FdContext;
+        new_ctx->fd = fd;
+        if(ctx_slot.compare_exchange_strong(fd_ctx, new_ctx
+                    ,std::memory_order_acq_rel, std::memory_order_acquire)) {
+            fd_ctx = new_ctx;
+            ++m_fdContextCount;
+        } else {
+            delete new_ctx;
+        }
+    }
+    return fd_ctx;
 }
 
-void IOManager::contextResize(size_t size) {
-    m_fdContexts.resize(size);
+int IOManager::registerFd(FdContext* fd_ctx, int epfd, bool modify) {
+    int op = modify ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+    epoll_event epevent;
+    memset(&epevent, 0, sizeof(epevent));
+    epevent.events = EPOLLIN | EPOLLOUT | EPOLLET;
+    epevent.data.ptr = fd_ctx;
 
-    for(size_t i = 0; i < m_fdContexts.size(); ++i) {
-        if(!m_fdContexts[i]) {
-            m_fdContexts[i] = new FdContext;
-            m_fdContexts[i]->fd = i;
+    m_epollCtlCount.fetch_add(1, std::memory_order_relaxed);
+    int rt = epoll_ctl(epfd, op, fd_ctx->fd, &epevent);
+    if(rt && (errno == ENOENT || errno == EEXIST)) {
+        //和内核不一致: fd被关闭后复用, 旧的注册已经没了; 或dup出的fd还留着注册
+        op = errno == ENOENT ? EPOLL_CTL_ADD : EPOLL_CTL_MOD;
+        m_epollCtlCount.fetch_add(1, std::memory_order_relaxed);
+        rt = epoll_ctl(epfd, op, fd_ctx->fd, &epevent);
+    }
+    if(rt) {
+        SYLAR_LOG_ERROR(g_logger) << "epoll_ctl(" << epfd << ", "
+                                  << op << ", " << fd_ctx->fd << ", " << epevent.events << "):"
+                                  << rt << " (" << errno << ") (" << strerror(errno) << ")";
+        return -1;
+    }
+    return 0;
+}
+
+size_t IOManager::cancelUring(FdContext* fd_ctx, Event event
+                              ,std::vector<std::shared_ptr<UringOp> >& ops) {
+    size_t n = 0;
+    for(auto& i : fd_ctx->uringOps) {
+        if(event == NONE || i->event == event) {
+            if(i->submitted) {
+                ops.push_back(i);
+            } else {
+                i->cancelPending = true;
+            }
+            ++n;
         }
     }
+    return n;
 }
 
 
-int IOManager::addEvent(int fd, Event event, std::function<void()> cb) {
-    FdContext* fd_ctx = nullptr;
-    RWMutexType::ReadLock lock(m_mutex);
+int IOManager::addEvent(int fd, Event event, std::function<void()> cb, bool drained) {
+    FdContext* fd_ctx = getFdContext(fd, true);
+    if(!fd_ctx) {
+        SYLAR_LOG_ERROR(g_logger) << "addEvent fd=" << fd << " out of fd table";
+        return -1;
+    }
 
-    if((int)m_fdContexts.size() > fd) {
-        fd_ctx = m_fdContexts[fd];
-        lock.unlock();
-    } else {
+    FdContext::MutexType::Lock lock(fd_ctx->mutex);
+    //已注册的fd只有读写到EAGAIN后在调度线程上的等待不用epoll_ctl. 否则fd中可能还有数据,
+    //边沿不会再来; 外部线程注册时fd还可能已被不经hook的close关闭又复用. 都重新注册一次
+    if(!fd_ctx->registered || !drained || Scheduler::GetThis() != this) {
+        if(!fd_ctx->registered) {
+            fd_ctx->owner = pickOwner();
+        }
+        int epfd = m_polls[fd_ctx->owner].epfd;
+        bool modify = fd_ctx->registered;
+        //先标记为已注册, epoll_ctl之后马上到来的边沿才不会被processEvents丢掉.
+        //注册时内核按当前状态再报一次边沿, 之前的就绪标记作废
+        fd_ctx->registered = true;
+        fd_ctx->ready = NONE;
         lock.unlock();
-        RWMutexType::WriteLock lock2(m_mutex);
-        contextResize(fd * 1.5);
-        fd_ctx = m_fdContexts[fd];
+        //注册完成前到来的边沿没有等待者, 记为就绪, 下面登记等待者时看到
+        int rt = registerFd(fd_ctx, epfd, modify);
+        lock.lock();
+        if(rt) {
+            fd_ctx->registered = false;
+            return -1;
+        }
     }
 
-    FdContext::MutexType::Lock lock2(fd_ctx->mutex);
     if(fd_ctx->events & event) {
         SYLAR_LOG_ERROR(g_logger) << "addEvent assert fd=" << fd
                                   << " event=" << event
@@ -113,19 +319,6 @@ int IOManager::addEvent(int fd, Event event, std::function<void()> cb) {
         SYLAR_ASSERT(!(fd_ctx->events & event));
     }
 
-    int op = fd_ctx->events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
-    epoll_event epevent;
-    epevent.events = EPOLLET | fd_ctx->events | event;
-    epevent.data.ptr = fd_ctx;
-
-    int rt = epoll_ctl(m_epfd, op, fd, &epevent);
-    if(rt) {
-        SYLAR_LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", "
-                                  << op << ", " << fd << ", " << epevent.events << "):"
-                                  << rt << " (" << errno << ") (" << strerror(errno) << ")";
-        return -1;
-    }
-
     ++m_pendingEventCount;
     fd_ctx->events = (Event)(fd_ctx->events | event);
     FdContext::EventContext& event_ctx = fd_ctx->getContext(event);
@@ -133,119 +326,130 @@ int IOManager::addEvent(int fd, Event event, std::function<void()> cb) {
                  && !event_ctx.fiber
                  && !event_ctx.cb);
                 
-    event_ctx.scheduler = Scheduler::GetThis();
+    //不在调度线程上注册的回调在本IOManager上执行
+    event_ctx.scheduler = Scheduler::GetThis() ? Scheduler::GetThis() : this;
     if(cb) {
         event_ctx.cb.swap(cb);
     } else {
         event_ctx.fiber = Fiber::GetThis();
         SYLAR_ASSERT(event_ctx.fiber->getState() == Fiber::EXEC);
     }
+    FdContext::Waiter waiter;
+    if(fd_ctx->ready & event) {
+        //边沿已经来过, 不会再来, 直接触发. 协程挂起后才会被执行
+        fd_ctx->ready &= ~event;
+        fd_ctx->takeEvent(event, eventThread(fd_ctx, event), waiter);
+        --m_pendingEventCount;
+    }
+    lock.unlock();
+    Dispatch(waiter);
     return 0;
 }
 
 bool IOManager::delEvent(int fd, Event event) {
-    RWMutexType::ReadLock lock(m_mutex);
-    if((int)m_fdContexts.size() <= fd) {
+    FdContext* fd_ctx = getFdContext(fd, false);
+    if(!fd_ctx) {
         return false;
     }
-    FdContext* fd_ctx = m_fdContexts[fd];
-    lock.unlock();
 
-    FdContext::MutexType::Lock lock2(fd_ctx->mutex);
+    //取出的协程或回调在解锁后析构
+    FdContext::Waiter waiter;
+    FdContext::MutexType::Lock lock(fd_ctx->mutex);
     if(!(fd_ctx->events & event)) {
         return false;
     }
 
-    Event new_events = (Event)(fd_ctx->events & ~event);
-    int op = new_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
-    epoll_event epevent;
-    epevent.events = new_events | EPOLLET;
-    epevent.data.ptr = fd_ctx;
-
-    int rt = epoll_ctl(m_epfd, op, fd, &epevent);
-    if(rt) {
-        SYLAR_LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", "
-                                  << op << ", " << fd << ", " << epevent.events << "):"
-                                  << rt << " (" << errno << ") (" << strerror(errno) << ")";
-        return false;
-    }
-
+    //注册保留, 之后的边沿记为就绪
     --m_pendingEventCount;
-    fd_ctx->events = new_events;
-    FdContext::EventContext& event_ctx = fd_ctx->getContext(event);
-    fd_ctx->resetContext(event_ctx);
+    fd_ctx->takeEvent(event, -1, waiter);
     return true;
 }
 
 bool IOManager::cancelEvent(int fd, Event event) {
-    RWMutexType::ReadLock lock(m_mutex);
-    if((int)m_fdContexts.size() <= fd) {
+    FdContext* fd_ctx = getFdContext(fd, false);
+    if(!fd_ctx) {
         return false;
     }
-    FdContext* fd_ctx = m_fdContexts[fd];
-    lock.unlock();
 
-    FdContext::MutexType::Lock lock2(fd_ctx->mutex);
-    if(!(fd_ctx->events & event)) {
-        return false;
+    std::vector<std::shared_ptr<UringOp> > ops;
+    FdContext::Waiter waiter;
+    FdContext::MutexType::Lock lock(fd_ctx->mutex);
+    size_t canceled = cancelUring(fd_ctx, event, ops);
+    bool triggered = fd_ctx->events & event;
+    if(triggered) {
+        fd_ctx->takeEvent(event, eventThread(fd_ctx, event), waiter);
+        --m_pendingEventCount;
     }
+    lock.unlock();
 
-    Event new_events = (Event)(fd_ctx->events & ~event);
-    int op = new_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
-    epoll_event epevent;
-    epevent.events = new_events | EPOLLET;
-    epevent.data.ptr = fd_ctx;
-
-    int rt = epoll_ctl(m_epfd, op, fd, &epevent);
-    if(rt) {
-        SYLAR_LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", "
-                                  << op << ", " << fd << ", " << epevent.events << "):"
-                                  << rt << " (" << errno << ") (" << strerror(errno) << ")";
-        return false;
+    for(auto& i : ops) {
+        i->ring->cancel((uint64_t)i.get());
     }
-
-    fd_ctx->triggerEvent(event);
-    --m_pendingEventCount;
-    return true;
+    Dispatch(waiter);
+    return triggered || canceled > 0;
 }
 
 bool IOManager::cancelAll(int fd) {
-    RWMutexType::ReadLock lock(m_mutex);
-    if((int)m_fdContexts.size() <= fd) {
+    FdContext* fd_ctx = getFdContext(fd, false);
+    if(!fd_ctx) {
         return false;
     }
-    FdContext* fd_ctx = m_fdContexts[fd];
-    lock.unlock();
 
-    FdContext::MutexType::Lock lock2(fd_ctx->mutex);
-    if(!fd_ctx->events) {
-        return false;
+    std::vector<std::shared_ptr<UringOp> > ops;
+    FdContext::Waiter read_waiter;
+    FdContext::Waiter write_waiter;
+    int epfd = -1;
+    FdContext::MutexType::Lock lock(fd_ctx->mutex);
+    size_t canceled = cancelUring(fd_ctx, NONE, ops);
+    if(fd_ctx->registered) {
+        //fd要关闭了, 删除注册后fd号复用时重新注册.
+        //解锁后才删除, 期间并发的addEvent是在对正在关闭的fd等待, 本身就是错误用法
+        epfd = m_polls[fd_ctx->owner].epfd;
+        fd_ctx->registered = false;
+        fd_ctx->ready = NONE;
     }
-
-    int op = EPOLL_CTL_DEL;
-    epoll_event epevent;
-    epevent.events = 0;
-    epevent.data.ptr = fd_ctx;
-
-    int rt = epoll_ctl(m_epfd, op, fd, &epevent);
-    if(rt) {
-        SYLAR_LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", "
-                                  << op << ", " << fd << ", " << epevent.events << "):"
-                                  << rt << " (" << errno << ") (" << strerror(errno) << ")";
-        return false;
-    }
-
+    bool triggered = fd_ctx->events != NONE;
     if(fd_ctx->events & READ) {
-        fd_ctx->triggerEvent(READ);
+        fd_ctx->takeEvent(READ, eventThread(fd_ctx, READ), read_waiter);
         --m_pendingEventCount;
     }
-
     if(fd_ctx->events & WRITE) {
-        fd_ctx->triggerEvent(WRITE);
+        fd_ctx->takeEvent(WRITE, eventThread(fd_ctx, WRITE), write_waiter);
         --m_pendingEventCount;
     }
-
     SYLAR_ASSERT(fd_ctx->events == 0);
+    lock.unlock();
+
+    if(epfd >= 0) {
+        epoll_event epevent;
+        memset(&epevent, 0, sizeof(epevent));
+        m_epollCtlCount.fetch_add(1, std::memory_order_relaxed);
+        int rt = epoll_ctl(epfd, EPOLL_CTL_DEL, fd, &epevent);
+        if(rt) {
+            SYLAR_LOG_ERROR(g_logger) << "epoll_ctl(" << epfd << ", "
+                                      << EPOLL_CTL_DEL << ", " << fd << ", 0):"
+                                      << rt << " (" << errno << ") (" << strerror(errno) << ")";
+        }
+    }
+    for(auto& i : ops) {
+        i->ring->cancel((uint64_t)i.get());
+    }
+    Dispatch(read_waiter);
+    Dispatch(write_waiter);
+    return triggered || canceled > 0;
+}
+
+bool IOManager::consumeReady(int fd, Event event) {
+    FdContext* fd_ctx = getFdContext(fd, false);
+    if(!fd_ctx) {
+        return false;
+    }
+
+    FdContext::MutexType::Lock lock(fd_ctx->mutex);
+    if(!(fd_ctx->ready & event)) {
+        return false;
+    }
+    fd_ctx->ready &= ~event;
     return true;
 }
 
@@ -253,12 +457,62 @@ IOManager * IOManager::GetThis() {
     return dynamic_cast<IOManager*>(Scheduler::GetThis());
 }
 
+bool IOManager::wakePoll(Poll& poll, bool force) {
+    //任务放入之后才看sleepers, 和idle()中先登记sleepers再检查任务配对, 至少有一边看到对方
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int wakes = poll.wakes.load();
+    do {
+        //没有睡眠的线程时任务会被正在运行的线程取走或偷走; 睡眠的线程都已在被唤醒时合并
+        if(!force && wakes >= poll.sleepers.load()) {
+            return false;
+        }
+    } while(!poll.wakes.compare_exchange_weak(wakes, wakes + 1));
+    if(wakes == 0) {
+        poll.wakeTime.store(GetMonotonicNS(), std::memory_order_relaxed);
+    }
+    countTickle();
+    uint64_t one = 1;
+    int rt = write(poll.wakeFd, &one, sizeof(one));
+    SYLAR_ASSERT(rt == sizeof(one));
+    return true;
+}
+
 void IOManager::tickle() {
-    if(hasIdleThreads()) {
+    if(m_stopping) {
+        //每个线程都要看到停止; 正要阻塞的线程还没登记, 写入的唤醒留给它
+        for(auto& i : m_polls) {
+            wakePoll(i, true);
+        }
+        return;
+    }
+    if(!m_perThreadEpoll) {
+        wakePoll(m_polls[0]);
+        return;
+    }
+    //每次从不同的位置找一个睡眠的线程, 分散唤醒
+    size_t n = m_polls.size();
+    uint32_t start = m_nextPoll.fetch_add(1, std::memory_order_relaxed);
+    for(size_t i = 0; i < n; ++i) {
+        if(wakePoll(m_polls[(start + i) % n])) {
+            return;
+        }
+    }
+}
+
+void IOManager::tickle(int thread) {
+    int idx = m_perThreadEpoll ? getWorkerIndex(thread) : -1;
+    if(idx < 0) {
+        //所有线程阻塞在同一个epoll上, 无法只唤醒指定线程
+        tickle();
         return;
     }
-    int rt = write(m_tickleFds[1], "T", 1);
-    SYLAR_ASSERT(rt == 1);
+    //没在睡眠的线程每轮调度都会看自己的mailbox
+    wakePoll(m_polls[idx]);
+}
+
+bool IOManager::canRetire() const {
+    //退出的线程epoll上的fd没有人等待
+    return !m_perThreadEpoll;
 }
 
  bool IOManager::stopping(uint64_t& timeout) {
@@ -273,6 +527,7 @@ bool IOManager::stopping() {
 }
 
 void IOManager::idle() {
+    Poll& poll = currentPoll();
     epoll_event* events = new epoll_event[64]();
     std::shared_ptr<epoll_event> shared_events(events, [](epoll_event* ptr) {
         delete[] ptr;
@@ -282,11 +537,21 @@ void IOManager::idle() {
         uint64_t next_timeout = 0;
         if(stopping(next_timeout)) {
             SYLAR_LOG_INFO(g_logger) << "name=" << getName() << " idle stopping exit";
+            //stop()的唤醒可能都被还没能退出的线程读走了, 退出前把唤醒传给还在睡眠的线程
+            tickle();
+            break;
+        }
+        if(isRetiring()) {
             break;
         }
 
         int rt = 0;
 
+        //先登记为睡眠再检查一遍任务, 登记前放入的任务在这里看到, 之后放入的由tickle唤醒
+        poll.sleepers.fetch_add(1);
+        if(hasTasks()) {
+            next_timeout = 0;
+        }
         do {
             static const int MAX_TIMEOUT = 3000;
             if(next_timeout != ~0ull) {
@@ -294,75 +559,317 @@ void IOManager::idle() {
             } else {
                 next_timeout = MAX_TIMEOUT;
             }
-            rt = epoll_wait(m_epfd, events, 64, (int)next_timeout);
+            rt = epoll_wait(poll.epfd, events, 64, (int)next_timeout);
             if(rt < 0 && errno == EINTR) {
             } else {
                 break;
             }
         } while(true);
+        poll.sleepers.fetch_sub(1);
 
+        //到期的定时器和就绪的事件攒成一批, 最后一次放入队列, 只tickle一次
+        TaskList batch;
         std::vector<std::function<void()> > cbs;
-        listExpiredCb(cbs);
-        if(!cbs.empty()) {
-            //SYLAR_LOG_DEBUG(g_logger) << "on timer cbs.size= " << cbs.size();
-            schedule(cbs.begin(), cbs.end());
-            cbs.clear();
-        }
-
-        for(int i = 0; i < rt; ++i) {
-            epoll_event& event = events[i];
-            if(event.data.fd == m_tickleFds[0]) {
-                uint8_t dummy;
-                while(read(m_tickleFds[0], &dummy, 1) == 1);
-                continue;
-            }
-
-            FdContext* fd_ctx = (FdContext*)event.data.ptr;
-            FdContext::MutexType::Lock lock(fd_ctx->mutex);
-            if(event.events & (EPOLLERR | EPOLLHUP)) {
-                event.events |= EPOLLIN | EPOLLOUT;
-            }
-            int real_events = NONE;
-            if(event.events & EPOLLIN) {
-                real_events |= READ;
+        std::vector<std::function<void()> > inline_cbs;
+        listExpiredCb(cbs, inline_cbs);
+        m_epollWaitCount.fetch_add(1, std::memory_order_relaxed);
+        if(!cbs.empty() || !inline_cbs.empty()) {
+            m_timerCount.fetch_add(cbs.size() + inline_cbs.size(), std::memory_order_relaxed);
+        }
+        for(auto& cb : cbs) {
+            if(Task* task = MakeTask(&cb, -1)) {
+                batch.push_back(task);
             }
-            if(event.events & EPOLLOUT) {
-                real_events |= WRITE;
+        }
+        for(auto& cb : inline_cbs) {
+            if(Task* task = MakeTask(&cb, -1, true)) {
+                batch.push_back(task);
             }
+        }
 
-            if((fd_ctx->events & real_events) == NONE) {
-                continue;
-            }
+        bool woken = false;
+        uint64_t triggered = processEvents(poll, events, rt, batch, woken);
+        if(triggered) {
+            m_eventCount.fetch_add(triggered, std::memory_order_relaxed);
+        }
+        if(woken && batch.empty() && !hasTasks()) {
+            //唤醒它的任务已被别的线程取走, 或者是停止时的唤醒
+            m_spuriousWakeupCount.fetch_add(1, std::memory_order_relaxed);
+        }
+        if(enqueue(batch)) {
+            tickle();
+        }
+
+        Fiber::ptr cur = Fiber::GetThis();
+        auto raw_ptr = cur.get();
+        cur.reset();
 
-            int left_events = (fd_ctx->events & ~real_events);
-            int op = left_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
-            event.events = EPOLLET | left_events;
+        raw_ptr->swapOut();
 
-            int rt2 = epoll_ctl(m_epfd, op, fd_ctx->fd, &event);
-            if(rt2) {
-                SYLAR_LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", " 
-                    << op << ", " << fd_ctx->fd << ", " << event.events << "):" 
-                    << rt2 << " (" << errno << ") (" << strerror(errno) << ")";
-                continue;
-            }
+    }
+}
 
-            if(real_events & READ) {
-                fd_ctx->triggerEvent(READ);
-                --m_pendingEventCount;
+uint64_t IOManager::processEvents(Poll& poll, epoll_event* events, int n, TaskList& batch
+                                  ,bool& woken) {
+    uint64_t triggered = 0;
+    for(int i = 0; i < n; ++i) {
+        epoll_event& event = events[i];
+        if(!event.data.ptr) {
+            //共享epoll上可能被其他线程先读走
+            uint64_t count = 0;
+            if(read(poll.wakeFd, &count, sizeof(count)) == sizeof(count)) {
+                uint64_t begin = poll.wakeTime.load(std::memory_order_relaxed);
+                uint64_t now = GetMonotonicNS();
+                poll.wakes.fetch_sub(count);
+                int idx = getWorkerIndex();
+                if(idx >= 0 && begin && now >= begin) {
+                    m_wakeLatency[idx]->record(now - begin);
+                }
+                m_wakeupCount.fetch_add(1, std::memory_order_relaxed);
+                woken = true;
+                //连续几次写入在共享epoll上可能只唤醒了本线程(边沿合并), 补发给其他睡眠的线程
+                for(uint64_t j = 1; j < count && !m_perThreadEpoll; ++j) {
+                    if(!wakePoll(poll, m_stopping)) {
+                        break;
+                    }
+                }
             }
+            continue;
+        }
+        if(event.data.ptr == poll.ring.get()) {
+            //完成事件在下面统一收取
+            continue;
+        }
 
-            if(real_events & WRITE) {
-                fd_ctx->triggerEvent(WRITE);
-                --m_pendingEventCount;
+        FdContext* fd_ctx = (FdContext*)event.data.ptr;
+        FdContext::Waiter read_waiter;
+        FdContext::Waiter write_waiter;
+        FdContext::MutexType::Lock lock(fd_ctx->mutex);
+        if(event.events & (EPOLLERR | EPOLLHUP)) {
+            event.events |= EPOLLIN | EPOLLOUT;
+        }
+        int real_events = NONE;
+        if(event.events & EPOLLIN) {
+            real_events |= READ;
+        }
+        if(event.events & EPOLLOUT) {
+            real_events |= WRITE;
+        }
+
+        //期间fd删除了注册, 或又注册到了别的线程的epoll上, 由那边处理
+        if(!fd_ctx->registered || &m_polls[fd_ctx->owner] != &poll) {
+            continue;
+        }
+        //没有等待者的方向记为就绪, 注册一直保留, 不用epoll_ctl
+        fd_ctx->ready |= real_events & ~fd_ctx->events;
+        real_events &= fd_ctx->events;
+
+        if(real_events & READ) {
+            fd_ctx->takeEvent(READ, eventThread(fd_ctx, READ), read_waiter);
+            --m_pendingEventCount;
+            ++triggered;
+        }
+
+        if(real_events & WRITE) {
+            fd_ctx->takeEvent(WRITE, eventThread(fd_ctx, WRITE), write_waiter);
+            --m_pendingEventCount;
+            ++triggered;
+        }
+        lock.unlock();
+        Dispatch(read_waiter, &batch);
+        Dispatch(write_waiter, &batch);
+    }
+    if(poll.ring) {
+        //没有等到io_uring的可读事件也收一次, 只读共享内存
+        bool self_done = false;
+        triggered += reapRing(poll, batch, nullptr, self_done);
+    }
+    return triggered;
+}
+
+uint64_t IOManager::reapRing(Poll& poll, TaskList& batch, UringOp* self, bool& self_done) {
+    std::vector<IoUring::Completion> cqes;
+    poll.ring->reap(cqes);
+    uint64_t n = 0;
+    for(auto& i : cqes) {
+        //取消操作自身的完成事件
+        if(!i.userData) {
+            continue;
+        }
+        UringOp* op = (UringOp*)i.userData;
+        {
+            FdContext::MutexType::Lock lock(op->fdCtx->mutex);
+            auto& ops = op->fdCtx->uringOps;
+            ops.erase(std::find_if(ops.begin(), ops.end()
+                        ,[op](const std::shared_ptr<UringOp>& i){ return i.get() == op;}));
+        }
+        op->res = i.res;
+        --m_pendingEventCount;
+        ++n;
+        if(op == self) {
+            op->done = true;
+            self_done = true;
+            continue;
+        }
+        //唤醒后协程可能马上返回并释放op, 之后不能再访问
+        Fiber::ptr fiber;
+        fiber.swap(op->fiber);
+        Scheduler* scheduler = op->scheduler;
+        int thread = op->thread;
+        op->done = true;
+        if(scheduler == Scheduler::GetThis()) {
+            if(Task* task = MakeTask(&fiber, thread)) {
+                batch.push_back(task);
             }
+        } else {
+            scheduler->schedule(&fiber, thread);
         }
-        Fiber::ptr cur = Fiber::GetThis();
-        auto raw_ptr = cur.get();
-        cur.reset();
+    }
+    if(n) {
+        m_uringOpCount.fetch_add(n, std::memory_order_relaxed);
+    }
+    return n;
+}
 
-        raw_ptr->swapOut();
+ssize_t IOManager::submitIO(uint8_t opcode, int fd, uint64_t addr, uint32_t len
+                            ,uint64_t off, uint32_t op_flags, uint64_t timeout_ms) {
+    Poll& poll = currentPoll();
+    SYLAR_ASSERT(poll.ring);
+    //超时定时器持有弱引用, 回调取消时op地址不会被新的IO复用
+    std::shared_ptr<UringOp> op(new UringOp);
+    op->fdCtx = getFdContext(fd, true);
+    if(!op->fdCtx) {
+        //超出fd表, 调用者退回epoll后由addEvent报错
+        errno = EAGAIN;
+        return -1;
+    }
+    op->ring = poll.ring.get();
+    op->event = opcode == IORING_OP_SEND || opcode == IORING_OP_CONNECT ? WRITE : READ;
+    op->scheduler = this;
+    op->fiber = Fiber::GetThis();
+    if(m_perThreadEpoll && op->fiber->getBoundThread() == -1) {
+        //完成事件由本线程的io_uring收取, 协程回到本线程
+        op->thread = GetThreadId();
+    }
+
+    ++m_pendingEventCount;
+    //先登记再解锁提交: 提交前被取消的op由这里在提交后取消
+    FdContext::MutexType::Lock lock(op->fdCtx->mutex);
+    op->fdCtx->uringOps.push_back(op);
+    lock.unlock();
+    int rt = poll.ring->submit(opcode, fd, addr, len, off, op_flags, (uint64_t)op.get());
+    lock.lock();
+    if(rt) {
+        auto& ops = op->fdCtx->uringOps;
+        ops.erase(std::find(ops.begin(), ops.end(), op));
+        lock.unlock();
+        --m_pendingEventCount;
+        errno = rt == -EBUSY ? EAGAIN : -rt;
+        return -1;
+    }
+    op->submitted = true;
+    bool cancel = op->cancelPending;
+    lock.unlock();
+    if(cancel) {
+        poll.ring->cancel((uint64_t)op.get());
+    }
 
+    Timer::ptr timer;
+    if(timeout_ms != ~0ull) {
+        std::weak_ptr<UringOp> wop(op);
+        IoUring::ptr ring = poll.ring;
+        timer = addConditionTimer(timeout_ms, [wop, ring](){
+            std::shared_ptr<UringOp> op = wop.lock();
+            if(!op || op->done) {
+                return;
+            }
+            op->timedout = true;
+            ring->cancel((uint64_t)op.get());
+        }, wop, false, true);
+    }
+
+    //数据已经就绪时在提交中就完成了, 不用挂起
+    TaskList batch;
+    bool self_done = false;
+    reapRing(poll, batch, op.get(), self_done);
+    if(enqueue(batch)) {
+        tickle();
     }
+    if(self_done) {
+        op->fiber.reset();
+    } else {
+        Fiber::YieldToHold();
+    }
+    if(timer) {
+        timer->cancel();
+    }
+
+    if(op->res >= 0) {
+        return op->res;
+    }
+    errno = op->res == -ECANCELED && op->timedout ? ETIMEDOUT : -op->res;
+    return -1;
+}
+
+void IOManager::poll() {
+    if(!m_perThreadEpoll) {
+        return;
+    }
+    Poll& cur = currentPoll();
+    epoll_event events[64];
+    int rt = epoll_wait(cur.epfd, events, 64, 0);
+    m_epollWaitCount.fetch_add(1, std::memory_order_relaxed);
+    TaskList batch;
+    bool woken = false;
+    uint64_t triggered = processEvents(cur, events, rt < 0 ? 0 : rt, batch, woken);
+    if(triggered) {
+        m_eventCount.fetch_add(triggered, std::memory_order_relaxed);
+    }
+    if(enqueue(batch)) {
+        tickle();
+    }
+}
+
+IOManager::IOStats IOManager::getIOStats() const {
+    IOStats s;
+    s.pendingEvents = m_pendingEventCount;
+    s.epollWaits = m_epollWaitCount;
+    s.events = m_eventCount;
+    s.timers = m_timerCount;
+    s.epollCtls = m_epollCtlCount;
+    for(auto& i : m_polls) {
+        if(i.ring) {
+            s.uringEnters += i.ring->getEnterCount();
+        }
+    }
+    s.uringOps = m_uringOpCount;
+    s.wakeups = m_wakeupCount;
+    s.spuriousWakeups = m_spuriousWakeupCount;
+    s.fdChunks = m_fdChunkCount;
+    s.fdContexts = m_fdContextCount;
+    for(auto i : m_wakeLatency) {
+        Histogram::Snapshot h;
+        i->snapshot(h);
+        s.wakeLatency.merge(h);
+    }
+    return s;
+}
+
+std::string IOManager::IOStats::toString() const {
+    std::stringstream ss;
+    ss << "pending_events=" << pendingEvents
+       << " epoll_waits=" << epollWaits
+       << " events=" << events
+       << " timers=" << timers
+       << " epoll_ctls=" << epollCtls
+       << " uring_enters=" << uringEnters
+       << " uring_ops=" << uringOps
+       << " wakeups=" << wakeups
+       << " spurious_wakeups=" << spuriousWakeups
+       << " wake_latency_ns={" << wakeLatency.toString() << "}"
+       << " fd_chunks=" << fdChunks
+       << " fd_contexts=" << fdContexts;
+    return ss.str();
 }
 
 void IOManager::onTimerInsertedAtFront() {
@@ -3,6 +3,8 @@
 
 #include "scheduler.h"
 #include "timer.h"
+#include "uring.h"
+#include "histogram.h"
 
 /*
   IOManager(epoll) --> Scheduler
@@ -22,13 +24,36 @@
 
 
 异步IO, 等待数据返回。 epoll_wait()如果没有数据会阻塞在epoll_wait()上，直到有数据返回。或有人向里边放任务
+
+每线程epoll模式(iomanager.per_thread_epoll):
+  每个worker一个epoll和唤醒管道, fd第一次注册事件时归属当前工作线程(外部线程注册时轮流分配),
+  注册在该线程的epoll上, 事件触发后协程回到该线程执行, 连接的数据一直留在同一个核的缓存中.
+  忙碌的线程通过poll()顺带收取自己epoll上的事件. 该模式下弹性线程只增不减
+
+io_uring后端(iomanager.backend: io_uring):
+  hook的read/recv/send/accept/connect不再先试一次系统调用再epoll_ctl注册事件, 而是直接提交SQE,
+  协程挂起到CQE到达. 完成队列的fd注册在epoll上(每线程epoll模式下每个线程一个io_uring),
+  idle()/poll()收取CQE并唤醒协程. 内核不支持时退回epoll
+
+fd的注册:
+  fd第一次等待事件时以EPOLLIN|EPOLLOUT|EPOLLET注册一次, 之后一直保留到cancelAll(hook的close会调用),
+  触发事件不再epoll_ctl; hook的IO读写到EAGAIN后等待(addEvent的drained)也不再epoll_ctl.
+  边沿到来时没有协程等待的方向记为就绪, 下次等待时直接触发, hook的IO看到就绪就重试而不挂起.
+  没有读写到EAGAIN就等待的调用者(如只读一个字节)等不到新的边沿, 仍然重新注册一次
+
+唤醒:
+  每个epoll一个eventfd(每线程epoll模式下即每个worker一个). 线程阻塞前把epoll的sleepers加1,
+  再检查一遍有没有任务; tickle只在有睡眠且没在被唤醒的线程时写eventfd, 多余的唤醒合并掉.
+  每线程epoll模式下tickle挑一个睡眠的线程唤醒, 指定线程的任务只唤醒该线程;
+  共享epoll上的唤醒由内核交给任意一个阻塞的线程
 */
+struct epoll_event;
+
 namespace sylar {
 
 class IOManager : public Scheduler, public TimerManager {
 public:
     typedef std::shared_ptr<IOManager> ptr;
-    typedef RWMutex RWMutexType;
 
     enum Event {
         NONE    = 0x0,
@@ -37,22 +62,39 @@ public:
     };
 
 private:
+    struct UringOp;
     struct FdContext {
-        typedef Mutex MutexType;
+        //只保护下面的状态, epoll_ctl/io_uring提交和schedule都在解锁后做, 用自旋锁
+        typedef Spinlock MutexType;
         struct EventContext {
             Scheduler* scheduler = nullptr;         //表示在哪一个调度器上执行
             Fiber::ptr fiber;                       //表示要执行的fiber
             std::function<void()> cb;               //表示要执行的函数
         };
+        //从fd上取出的等待者, 解锁后由IOManager::Dispatch放入调度器
+        struct Waiter {
+            EventContext ctx;
+            int thread = -1;                        //指定执行的线程, -1为任意线程
+        };
 
         EventContext& getContext(Event event);
         void resetContext(EventContext& ctx);
-        void triggerEvent(Event event);
+        /**
+         * @brief 触发事件: 清除该事件, 把等待的协程或回调取到out, 持有mutex调用
+         * @param[in] thread 指定执行的线程, -1为任意线程
+         */
+        void takeEvent(Event event, int thread, Waiter& out);
 
         int fd = 0;                  //事件描述符
+        int owner = 0;               //注册在哪个epoll上(m_polls的下标), 没有注册时无意义
         EventContext read;       //读事件
         EventContext write;      //写事件
-        Event events = NONE;   //已经注册的事件
+        Event events = NONE;   //正在等待的事件
+        //是否已注册到owner的epoll上, 不经hook的close关闭的fd要由外部线程重新注册时纠正
+        bool registered = false;
+        int ready = NONE;            //边沿到来时没有等待者的事件
+        //进行中的io_uring操作, cancelAll时取消. 持有引用, 解锁后取消时地址不会被复用
+        std::vector<std::shared_ptr<UringOp> > uringOps;
         MutexType mutex;
     };
 
@@ -62,16 +104,23 @@ public:
 
     /**
      * @brief 增加事件
-     * @param
-     * @return 0 success -1 error
+     * @param[in] drained 调用者刚在fd的这个方向上读写到EAGAIN. 边沿触发下只有这时才能直接等下一个边沿,
+     *            否则重新注册一次, 由内核按fd当前状态决定是否立即触发
+     * @return 0 success -1 error(epoll_ctl失败或fd超出fd表)
      */
-    int addEvent(int fd, Event event, std::function<void()> cb = nullptr);
+    int addEvent(int fd, Event event, std::function<void()> cb = nullptr, bool drained = false);
 
     /**
      * @brief 删除事件--直接删除了
      */
     bool delEvent(int fd, Event event);
 
+    /**
+     * @brief fd上一次边沿到来时没有等待者, 则清除就绪标记并返回true
+     * @details 调用者应该重试IO而不是addEvent挂起, 重试仍EAGAIN时再等待
+     */
+    bool consumeReady(int fd, Event event);
+
     /**
      * @brief 取消事件--如果存在触发条件，那么先触发事件再删除事件
      */
@@ -84,24 +133,169 @@ public:
      */
     static IOManager * GetThis();
 
+    /**
+     * @brief IO相关的运行时统计, 调度相关的见Scheduler::getStats
+     */
+    struct IOStats {
+        size_t pendingEvents = 0;       //// 等待中的事件数
+        uint64_t epollWaits = 0;        //// epoll_wait返回的次数
+        uint64_t events = 0;            //// 触发的事件数
+        uint64_t timers = 0;            //// 到期的定时器数
+        uint64_t epollCtls = 0;         //// epoll_ctl调用次数
+        uint64_t uringEnters = 0;       //// io_uring_enter调用次数
+        uint64_t uringOps = 0;          //// 通过io_uring完成的IO数
+        uint64_t wakeups = 0;           //// 被tickle唤醒的次数
+        uint64_t spuriousWakeups = 0;   //// 被唤醒后没有任务可做的次数
+        Histogram::Snapshot wakeLatency;    //// 从tickle到被唤醒的线程收到(ns)
+        size_t fdChunks = 0;            //// fd表中已分配的块数
+        size_t fdContexts = 0;          //// 已分配的FdContext数
+        std::string toString() const;
+    };
+
+    /**
+     * @brief 读取IO统计, 任何线程都可以调用
+     */
+    IOStats getIOStats() const;
+
+    /**
+     * @brief 是否是每线程epoll模式, 构造时由iomanager.per_thread_epoll决定
+     */
+    bool isPerThreadEpoll() const { return m_perThreadEpoll;}
+
+    /**
+     * @brief 是否使用io_uring后端, iomanager.backend为io_uring且内核支持时为true
+     */
+    bool hasUring() const { return (bool)m_polls[0].ring;}
+
+    /**
+     * @brief 通过io_uring执行一次IO, 当前协程挂起到完成
+     * @details 只能在本IOManager的协程中调用, hasUring()为true时可用, 参数含义同IoUring::submit
+     * @param[in] timeout_ms 超时后取消, ~0ull为不超时
+     * @return 同系统调用, 失败返回-1并设置errno, 超时为ETIMEDOUT, 被cancelEvent/cancelAll取消为ECANCELED.
+     *         没能提交或老内核对非阻塞fd直接返回EAGAIN时errno为EAGAIN, 调用者可以退回epoll
+     */
+    ssize_t submitIO(uint8_t opcode, int fd, uint64_t addr, uint32_t len
+                     ,uint64_t off, uint32_t op_flags, uint64_t timeout_ms = ~0ull);
+
 protected:
     void tickle() override;
+    void tickle(int thread) override;
     bool stopping() override;
     bool stopping(uint64_t& timeout);
     void idle() override;
 
+    void poll() override;
+    bool canRetire() const override;
+
     void onTimerInsertedAtFront() override;
+private:
+    /**
+     * @brief 一个epoll实例和唤醒阻塞在它上面的线程的管道
+     */
+    struct Poll {
+        int epfd = -1;
+        //通过eventfd来唤醒, 计数为还没读走的唤醒次数
+        int wakeFd = -1;
+        //阻塞在(或正要阻塞在)epoll_wait上的线程数, 每线程epoll模式下就是睡眠标志
+        std::atomic<int> sleepers = {0};
+        //已经发出还没读走的唤醒数, 达到sleepers后再tickle就合并掉
+        std::atomic<int> wakes = {0};
+        //wakes从0变1的时间(ns), 用于统计唤醒延迟
+        std::atomic<uint64_t> wakeTime = {0};
+        //io_uring后端的完成队列, epoll后端为空
+        IoUring::ptr ring;
+    };
 
-    void contextResize(size_t size);
+    /**
+     * @brief 一个提交给io_uring的IO, 地址作为user_data
+     */
+    struct UringOp {
+        FdContext* fdCtx = nullptr;
+        IoUring* ring = nullptr;            //// 提交到的io_uring, 取消时用
+        Event event = NONE;                 //// 读还是写, cancelEvent时用
+        Scheduler* scheduler = nullptr;     //// 在哪个调度器上唤醒
+        Fiber::ptr fiber;                   //// 等待的协程
+        int thread = -1;                    //// 唤醒后在哪个线程执行
+        int32_t res = 0;                    //// CQE的结果
+        bool submitted = false;             //// 是否已提交, 持有fdCtx->mutex访问
+        bool cancelPending = false;         //// 提交前被cancelEvent/cancelAll取消, 持有fdCtx->mutex访问
+        std::atomic<bool> done = {false};
+        std::atomic<bool> timedout = {false};
+    };
+
+    void initPoll(Poll& poll);
+    //iomanager.backend为io_uring时给每个Poll创建io_uring, 有一个失败就全部退回epoll
+    void initUring();
+    /**
+     * @brief fd对应的上下文, 不加锁
+     * @param[in] create 不存在时是否创建
+     * @return 不存在且不创建, 或fd超出fd表时返回nullptr
+     */
+    FdContext* getFdContext(int fd, bool create);
+    //以EPOLLIN|EPOLLOUT|EPOLLET在epfd上注册fd, modify为true时重新注册, 不持有fd_ctx->mutex调用
+    int registerFd(FdContext* fd_ctx, int epfd, bool modify);
+    /**
+     * @brief 找出fd上某个方向(NONE为全部)进行中的io_uring操作, 持有fd_ctx->mutex调用
+     * @param[out] ops 已提交的操作, 解锁后逐个取消; 还没提交的由提交者提交后取消
+     * @return 找到的个数
+     */
+    size_t cancelUring(FdContext* fd_ctx, Event event, std::vector<std::shared_ptr<UringOp> >& ops);
+    /**
+     * @brief 把takeEvent取出的等待者放入调度器, 没有等待者时什么都不做, 不持有fd的锁调用
+     * @param[in] batch 非空且等待者属于当前调度器时放入batch, 由调用者统一放入队列
+     */
+    static void Dispatch(FdContext::Waiter& waiter, TaskList* batch = nullptr);
+    //当前线程等待的epoll
+    Poll& currentPoll();
+    //给没有事件的fd选择所属的epoll
+    int pickOwner();
+    //事件触发后在哪个线程执行, 每线程epoll模式下为fd所属的线程
+    int eventThread(FdContext* fd_ctx, Event event);
+    /**
+     * @brief 唤醒一个阻塞在poll上的线程
+     * @param[in] force 不管有没有睡眠的线程都写eventfd, 下一个阻塞的线程会立即返回
+     * @return 是否写了eventfd, 没有睡眠的线程或都已在被唤醒时返回false
+     */
+    bool wakePoll(Poll& poll, bool force = false);
+    /**
+     * @brief 处理epoll_wait返回的事件, 触发的任务放入batch
+     * @param[out] woken 是否收到了tickle
+     * @return 触发的事件数
+     */
+    uint64_t processEvents(Poll& poll, epoll_event* events, int n, TaskList& batch, bool& woken);
+    /**
+     * @brief 收取io_uring的完成事件, 唤醒的协程放入batch
+     * @param[in] self 当前协程自己的IO, 它完成时不唤醒, 由self_done返回
+     * @return 完成的IO数
+     */
+    uint64_t reapRing(Poll& poll, TaskList& batch, UringOp* self, bool& self_done);
 private:
-    int m_epfd = 0;
-    //通过管道来唤醒，不通过异步IO来唤醒，即进程间通讯方式
-    //不通过信号量+1-1的方式，而是通过向里边写数据的方式
-    int m_tickleFds[2];
+    //单epoll模式只有1个, 每线程epoll模式和worker一一对应
+    std::vector<Poll> m_polls;
+    bool m_perThreadEpoll = false;
+    std::atomic<uint32_t> m_nextPoll = {0};
     //现在等待执行的事件数量
     std::atomic<size_t> m_pendingEventCount = {0};
-    RWMutexType m_mutex;
-    std::vector<FdContext*> m_fdContexts;
+    std::atomic<uint64_t> m_epollWaitCount = {0};
+    std::atomic<uint64_t> m_eventCount = {0};
+    std::atomic<uint64_t> m_timerCount = {0};
+    std::atomic<uint64_t> m_epollCtlCount = {0};
+    std::atomic<uint64_t> m_uringOpCount = {0};
+    std::atomic<uint64_t> m_wakeupCount = {0};
+    std::atomic<uint64_t> m_spuriousWakeupCount = {0};
+    //各worker收到唤醒的延迟, 下标同worker, 只由对应的线程写
+    std::vector<Histogram*> m_wakeLatency;
+    //fd表分两级: FD_TABLE_SIZE个块, 每块FD_CHUNK_SIZE个FdContext指针.
+    //块和FdContext都在第一次用到时分配, 之后不移动不释放, 查找只是两次acquire load
+    static const int FD_CHUNK_BITS = 10;
+    static const int FD_CHUNK_SIZE = 1 << FD_CHUNK_BITS;
+    static const int FD_TABLE_SIZE = 4096;
+    struct FdChunk {
+        std::atomic<FdContext*> ctxs[FD_CHUNK_SIZE];
+    };
+    std::vector<std::atomic<FdChunk*> > m_fdChunks;
+    std::atomic<size_t> m_fdChunkCount = {0};
+    std::atomic<size_t> m_fdContextCount = {0};
 };
 
 }
@@ -0,0 +1,215 @@
+#include "numa.h"
+#include "log.h"
+#include "thread.h"
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <fstream>
+
+#ifndef MPOL_PREFERRED
+#define MPOL_PREFERRED 1
+#endif
+
+namespace sylar {
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("system");
+
+static const char* NODE_DIR = "/sys/devices/system/node";
+static const char* CPU_DIR = "/sys/devices/system/cpu";
+
+static std::string ReadLine(const std::string& path) {
+    std::ifstream ifs(path);
+    std::string line;
+    std::getline(ifs, line);
+    return line;
+}
+
+/**
+ * @brief 启动后第一次使用时读取的拓扑, 之后不变
+ */
+struct Topology {
+    Topology() {
+        DIR* dir = opendir(NODE_DIR);
+        if(dir) {
+            struct dirent* dp = nullptr;
+            while((dp = readdir(dir))) {
+                if(strncmp(dp->d_name, "node", 4) || !isdigit(dp->d_name[4])) {
+                    continue;
+                }
+                int node = atoi(dp->d_name + 4);
+                std::vector<int> cpus;
+                if(!Numa::ParseCpuList(ReadLine(std::string(NODE_DIR) + "/"
+                                + dp->d_name + "/cpulist"), cpus)) {
+                    continue;
+                }
+                if(node >= (int)nodes.size()) {
+                    nodes.resize(node + 1);
+                }
+                nodes[node] = cpus;
+            }
+            closedir(dir);
+        }
+        if(nodes.empty()) {
+            // 没有NUMA信息, 所有在线CPU都算node0
+            nodes.resize(1);
+            if(!Numa::ParseCpuList(ReadLine(std::string(CPU_DIR) + "/online"), nodes[0])) {
+                long n = sysconf(_SC_NPROCESSORS_ONLN);
+                for(long i = 0; i < n; ++i) {
+                    nodes[0].push_back(i);
+                }
+            }
+        }
+        for(size_t i = 0; i < nodes.size(); ++i) {
+            std::sort(nodes[i].begin(), nodes[i].end());
+            for(auto& cpu : nodes[i]) {
+                if(cpu >= (int)cpuNode.size()) {
+                    cpuNode.resize(cpu + 1, 0);
+                }
+                cpuNode[cpu] = i;
+            }
+        }
+    }
+
+    std::vector<std::vector<int> > nodes;   //// 节点 -> CPU
+    std::vector<int> cpuNode;               //// CPU -> 节点
+};
+
+static Topology& GetTopology() {
+    static Topology s_topology;
+    return s_topology;
+}
+
+bool Numa::ParseCpuList(const std::string& str, std::vector<int>& cpus) {
+    size_t pos = 0;
+    while(pos < str.size()) {
+        size_t end = str.find(',', pos);
+        if(end == std::string::npos) {
+            end = str.size();
+        }
+        std::string item = str.substr(pos, end - pos);
+        pos = end + 1;
+        if(item.empty()) {
+            continue;
+        }
+        char* p = nullptr;
+        long first = strtol(item.c_str(), &p, 10);
+        long last = first;
+        if(p == item.c_str() || first < 0) {
+            return false;
+        }
+        if(*p == '-') {
+            const char* b = p + 1;
+            last = strtol(b, &p, 10);
+            if(p == b || last < first) {
+                return false;
+            }
+        }
+        if(*p) {
+            return false;
+        }
+        for(long i = first; i <= last; ++i) {
+            cpus.push_back(i);
+        }
+    }
+    return true;
+}
+
+bool Numa::ParseAffinity(const std::string& spec, std::vector<int>& cpus) {
+    if(spec.compare(0, 5, "node:") == 0) {
+        char* p = nullptr;
+        long node = strtol(spec.c_str() + 5, &p, 10);
+        if(p == spec.c_str() + 5 || *p || node < 0 || node >= GetNodeCount()) {
+            return false;
+        }
+        cpus = GetNodeCpus(node, true);
+        return !cpus.empty();
+    }
+    std::vector<int> tmp;
+    if(!ParseCpuList(spec, tmp) || tmp.empty()) {
+        return false;
+    }
+    cpus.swap(tmp);
+    return true;
+}
+
+int Numa::GetNodeCount() {
+    return GetTopology().nodes.size();
+}
+
+int Numa::GetCpuNode(int cpu) {
+    const Topology& t = GetTopology();
+    if(cpu < 0 || cpu >= (int)t.cpuNode.size()) {
+        return 0;
+    }
+    return t.cpuNode[cpu];
+}
+
+std::vector<int> Numa::GetNodeCpus(int node, bool one_per_core) {
+    const Topology& t = GetTopology();
+    if(node < 0 || node >= (int)t.nodes.size()) {
+        return std::vector<int>();
+    }
+    if(!one_per_core) {
+        return t.nodes[node];
+    }
+    std::vector<int> cpus;
+    for(auto& cpu : t.nodes[node]) {
+        std::vector<int> siblings;
+        if(!ParseCpuList(ReadLine(std::string(CPU_DIR) + "/cpu" + std::to_string(cpu)
+                        + "/topology/thread_siblings_list"), siblings)
+                || siblings.empty()
+                || *std::min_element(siblings.begin(), siblings.end()) == cpu) {
+            cpus.push_back(cpu);
+        }
+    }
+    return cpus;
+}
+
+int Numa::GetCurrentNode() {
+    int cpu = Thread::GetCpu();
+    return cpu < 0 ? -1 : GetCpuNode(cpu);
+}
+
+bool Numa::Bind(void* addr, size_t len, int node) {
+    if(node < 0 || GetNodeCount() <= 1) {
+        return false;
+    }
+    unsigned long mask[16] = {0};
+    if(node >= (int)sizeof(mask) * 8) {
+        return false;
+    }
+    mask[node / (sizeof(unsigned long) * 8)] |= 1ul << (node % (sizeof(unsigned long) * 8));
+    if(syscall(SYS_mbind, addr, len, MPOL_PREFERRED, mask, sizeof(mask) * 8, 0)) {
+        SYLAR_LOG_DEBUG(g_logger) << "mbind node=" << node << " fail errno="
+            << errno << " errstr=" << strerror(errno);
+        return false;
+    }
+    return true;
+}
+
+void* Numa::Alloc(size_t size, int node) {
+    void* addr = mmap(nullptr, size, PROT_READ | PROT_WRITE
+                      ,MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(addr == MAP_FAILED) {
+        SYLAR_LOG_ERROR(g_logger) << "mmap size=" << size << " fail errno="
+            << errno << " errstr=" << strerror(errno);
+        return nullptr;
+    }
+    Bind(addr, size, node);
+    return addr;
+}
+
+void Numa::Free(void* addr, size_t size) {
+    if(addr) {
+        munmap(addr, size);
+    }
+}
+
+}
@@ -0,0 +1,76 @@
+#ifndef __SYLAR_NUMA_H__
+#define __SYLAR_NUMA_H__
+
+/*
+  CPU拓扑和NUMA节点本地内存
+
+  拓扑从/sys/devices/system读取, 不依赖libnuma; 没有node目录的机器当作只有node0.
+  内存绑定直接调用mbind系统调用, 用MPOL_PREFERRED: 节点内存不够时退回其他节点, 不会分配失败
+
+  CPU列表格式同内核的cpulist: "0-3,8,10-11"
+  亲和性配置格式:
+    "0-3,8"     : 指定CPU列表
+    "node:N"    : 节点N上每个物理核取一个逻辑CPU(超线程只用第一个)
+*/
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+namespace sylar {
+
+class Numa {
+public:
+    /**
+     * @brief 解析CPU列表
+     * @param[in] str 如"0-3,8"
+     * @param[out] cpus 解析结果, 按出现顺序
+     * @return 格式错误返回false
+     */
+    static bool ParseCpuList(const std::string& str, std::vector<int>& cpus);
+
+    /**
+     * @brief 解析亲和性配置
+     * @param[in] spec CPU列表或"node:N"
+     * @param[out] cpus 要绑定的CPU, 按出现顺序分配给各线程
+     * @return 格式错误或节点不存在返回false
+     */
+    static bool ParseAffinity(const std::string& spec, std::vector<int>& cpus);
+
+    // NUMA节点数, 至少为1
+    static int GetNodeCount();
+
+    // CPU所在的节点, 未知返回0
+    static int GetCpuNode(int cpu);
+
+    /**
+     * @brief 节点上的CPU
+     * @param[in] one_per_core 为true时每个物理核只取编号最小的逻辑CPU
+     */
+    static std::vector<int> GetNodeCpus(int node, bool one_per_core);
+
+    /**
+     * @brief 当前线程所在的节点
+     * @return 线程未绑定CPU返回-1
+     */
+    static int GetCurrentNode();
+
+    /**
+     * @brief 把内存优先放到节点上, 对之后首次访问才分配的页生效
+     * @param[in] node 小于0或只有一个节点时什么也不做
+     */
+    static bool Bind(void* addr, size_t len, int node);
+
+    /**
+     * @brief 在节点上分配内存, 按页对齐, 内容为0
+     * @param[in] node 小于0时不绑定
+     */
+    static void* Alloc(size_t size, int node);
+
+    // 释放Alloc分配的内存
+    static void Free(void* addr, size_t size);
+};
+
+}
+
+#endif
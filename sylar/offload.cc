@@ -0,0 +1,217 @@
+#include "offload.h"
+#include "config.h"
+#include "log.h"
+#include "macro.h"
+#include "scheduler.h"
+#include "util.h"
+
+#include <exception>
+#include <sstream>
+
+namespace sylar {
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("system");
+
+static ConfigVar<uint32_t>::ptr g_offload_threads =
+    Config::Lookup<uint32_t>("offload.threads", 4, "default offload pool threads");
+
+static ConfigVar<uint32_t>::ptr g_offload_max_queue =
+    Config::Lookup<uint32_t>("offload.max_queue", 1024
+            , "default offload pool max queued calls, more are run inline");
+
+static ConfigVar<bool>::ptr g_offload_file_io =
+    Config::Lookup<bool>("offload.file_io", false
+            , "hooked read/write/readv/writev on regular files run on the default offload pool");
+
+static std::atomic<bool> s_file_io(false);
+
+struct _OffloadIniter {
+    _OffloadIniter() {
+        s_file_io = g_offload_file_io->getValue();
+        g_offload_file_io->addListener([](const bool& ov, const bool& nv){
+            s_file_io = nv;
+        });
+    }
+};
+
+static _OffloadIniter _init;
+
+/**
+ * @brief 一次调用, 放在调用协程的栈上, 协程挂起期间有效
+ * @details 共享栈协程的栈在挂起期间被其他协程使用, 它们在run中直接执行, 不会提交job
+ */
+struct OffloadPool::Job {
+    const std::function<void()>* fn = nullptr;
+    Scheduler* scheduler = nullptr;
+    Fiber::ptr fiber;
+    uint64_t enqueueTime = 0;
+    std::exception_ptr error;
+};
+
+/**
+ * @brief 池线程的统计, 只有本线程写
+ */
+struct OffloadPool::Worker {
+    Histogram queueDelay;
+    Histogram runTime;
+};
+
+OffloadPool::OffloadPool(size_t threads, size_t max_queue, const std::string& name)
+    :m_name(name)
+    ,m_maxQueue(max_queue) {
+    SYLAR_ASSERT(threads > 0);
+    for(size_t i = 0; i < threads; ++i) {
+        m_workers.push_back(new Worker);
+    }
+    for(size_t i = 0; i < threads; ++i) {
+        m_threads.push_back(Thread::ptr(new Thread(
+                        std::bind(&OffloadPool::work, this, m_workers[i])
+                        ,m_name + "_" + std::to_string(i))));
+    }
+}
+
+OffloadPool::~OffloadPool() {
+    stop();
+    for(auto& i : m_workers) {
+        delete i;
+    }
+}
+
+void OffloadPool::stop() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_cond.notify_all();
+    for(auto& i : m_threads) {
+        i->join();
+    }
+    m_threads.clear();
+}
+
+bool OffloadPool::run(const std::function<void()>& fn) {
+    Scheduler* scheduler = Scheduler::GetThis();
+    //共享栈协程挂起后栈上是同线程的其他协程, 池线程不能再访问job和fn引用的栈上变量
+    if(!Scheduler::CanPark() || Fiber::GetThis()->isSharedStack()) {
+        ++m_inlined;
+        fn();
+        return true;
+    }
+
+    Job job;
+    job.fn = &fn;
+    job.scheduler = scheduler;
+    job.fiber = Fiber::GetThis();
+    job.enqueueTime = GetMonotonicNS();
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if(m_stopping || m_jobs.size() >= m_maxQueue) {
+            ++m_rejected;
+            return false;
+        }
+        m_jobs.push_back(&job);
+        //挂起期间调度器不能停止
+        scheduler->addPending();
+    }
+    ++m_submitted;
+    m_cond.notify_one();
+
+    //池线程可能在让出前就把协程放回调度器, 调度循环会等它切出后再执行
+    Fiber::YieldToHold();
+    if(job.error) {
+        std::rethrow_exception(job.error);
+    }
+    return true;
+}
+
+void OffloadPool::work(Worker* worker) {
+    while(true) {
+        Job* job = nullptr;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            while(!m_stopping && m_jobs.empty()) {
+                m_cond.wait(lock);
+            }
+            if(m_jobs.empty()) {
+                break;
+            }
+            job = m_jobs.front();
+            m_jobs.pop_front();
+        }
+        ++m_running;
+        uint64_t begin = GetMonotonicNS();
+        worker->queueDelay.record(begin - job->enqueueTime);
+        try {
+            (*job->fn)();
+        } catch(...) {
+            job->error = std::current_exception();
+        }
+        worker->runTime.record(GetMonotonicNS() - begin);
+        --m_running;
+        ++m_completed;
+
+        //放回调度器后job所在的栈随时会失效, 之后不能再访问
+        Scheduler* scheduler = job->scheduler;
+        Fiber::ptr fiber;
+        fiber.swap(job->fiber);
+        scheduler->schedule(fiber);
+        scheduler->donePending();
+    }
+}
+
+OffloadPool::Stats OffloadPool::getStats() const {
+    Stats s;
+    s.submitted = m_submitted;
+    s.completed = m_completed;
+    s.rejected = m_rejected;
+    s.inlined = m_inlined;
+    s.running = m_running;
+    s.threads = m_workers.size();
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        s.queued = m_jobs.size();
+    }
+    for(auto& i : m_workers) {
+        Histogram::Snapshot h;
+        i->queueDelay.snapshot(h);
+        s.queueDelay.merge(h);
+        i->runTime.snapshot(h);
+        s.runTime.merge(h);
+    }
+    return s;
+}
+
+std::string OffloadPool::Stats::toString() const {
+    std::stringstream ss;
+    ss << "submitted=" << submitted
+       << " completed=" << completed
+       << " rejected=" << rejected
+       << " inlined=" << inlined
+       << " queued=" << queued
+       << " running=" << running
+       << " threads=" << threads
+       << " queue_delay_ns={" << queueDelay.toString() << "}"
+       << " run_time_ns={" << runTime.toString() << "}";
+    return ss.str();
+}
+
+OffloadPool* OffloadPool::GetDefault() {
+    static OffloadPool s_pool(g_offload_threads->getValue()
+                              ,g_offload_max_queue->getValue(), "offload");
+    return &s_pool;
+}
+
+void Offload(const std::function<void()>& fn) {
+    OffloadPool* pool = OffloadPool::GetDefault();
+    if(!pool->run(fn)) {
+        SYLAR_LOG_DEBUG(g_logger) << "offload pool " << pool->getName()
+            << " full, run inline";
+        fn();
+    }
+}
+
+bool IsFileIOOffload() {
+    return s_file_io;
+}
+
+}
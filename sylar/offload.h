@@ -0,0 +1,115 @@
+#ifndef __SYLAR_OFFLOAD_H__
+#define __SYLAR_OFFLOAD_H__
+
+/*
+  阻塞调用的offload线程池
+
+  普通文件的read/write, getaddrinfo, 压缩这类调用会阻塞整个工作线程, 其他协程都得等.
+  OffloadPool::run把调用交给独立的有界线程池执行, 调用协程挂起(HOLD),
+  完成后由池线程把协程放回它原来的调度器, 工作线程在此期间继续调度其他协程.
+
+  不在协程调度器中(例如main线程), 或在scheduleInline的回调中(不能让出)时直接在当前线程执行.
+  共享栈协程也直接执行: 挂起后它的栈被同线程的其他协程使用, 池线程不能访问fn捕获的栈上变量.
+  排队数达到上限时拒绝, 由调用者决定是直接执行还是报错.
+
+  offload.threads   : 默认池的线程数
+  offload.max_queue : 默认池的排队上限
+  offload.file_io   : hook的read/write/readv/writev遇到普通文件时是否走默认池
+*/
+
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "histogram.h"
+#include "thread.h"
+
+namespace sylar {
+
+class OffloadPool {
+public:
+    typedef std::shared_ptr<OffloadPool> ptr;
+
+    /**
+     * @brief 运行时统计, 时间单位ns
+     */
+    struct Stats {
+        uint64_t submitted = 0;         //// 放入池中的调用数
+        uint64_t completed = 0;         //// 执行完的调用数
+        uint64_t rejected = 0;          //// 排队满被拒绝的调用数
+        uint64_t inlined = 0;           //// 不能挂起或在共享栈协程中直接执行的调用数
+        size_t queued = 0;              //// 排队中的调用数
+        size_t running = 0;             //// 正在执行的调用数
+        size_t threads = 0;             //// 线程数
+        Histogram::Snapshot queueDelay; //// 从提交到开始执行
+        Histogram::Snapshot runTime;    //// 执行时长
+        std::string toString() const;
+    };
+
+    /**
+     * @brief 创建并启动线程池
+     * @param[in] threads 线程数
+     * @param[in] max_queue 排队上限, 不含正在执行的
+     */
+    OffloadPool(size_t threads, size_t max_queue, const std::string& name = "offload");
+    ~OffloadPool();
+
+    /**
+     * @brief 在池中执行fn, 当前协程挂起直到fn执行完
+     * @details fn在执行完之前一直由调用者持有, 不拷贝; fn抛出的异常在调用协程中重新抛出.
+     *          不能挂起或在共享栈协程中时直接执行, 计入inlined
+     * @return 排队满被拒绝返回false, fn没有执行
+     */
+    bool run(const std::function<void()>& fn);
+
+    // 停止并等待所有线程, 排队中的调用仍会执行完
+    void stop();
+
+    const std::string& getName() const { return m_name;}
+    Stats getStats() const;
+
+    /**
+     * @brief 默认线程池, 第一次使用时按offload.threads/offload.max_queue创建
+     */
+    static OffloadPool* GetDefault();
+private:
+    struct Job;
+    struct Worker;
+
+    void work(Worker* worker);
+private:
+    std::string m_name;
+    size_t m_maxQueue;
+    mutable std::mutex m_mutex;
+    std::condition_variable m_cond;
+    std::deque<Job*> m_jobs;
+    bool m_stopping = false;
+    std::vector<Worker*> m_workers;
+    std::vector<Thread::ptr> m_threads;
+
+    std::atomic<uint64_t> m_submitted {0};
+    std::atomic<uint64_t> m_completed {0};
+    std::atomic<uint64_t> m_rejected {0};
+    std::atomic<uint64_t> m_inlined {0};
+    std::atomic<size_t> m_running {0};
+};
+
+/**
+ * @brief 在默认offload线程池中执行fn, 当前协程挂起直到完成
+ * @details 排队满时在当前线程直接执行
+ */
+void Offload(const std::function<void()>& fn);
+
+/**
+ * @brief hook的read/write是否把普通文件交给默认线程池, 见offload.file_io
+ */
+bool IsFileIOOffload();
+
+}
+
+#endif
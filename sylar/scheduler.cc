@@ -1,23 +1,463 @@
 #include "scheduler.h"
 #include "macro.h"
 #include "log.h"
+#include "config.h"
+#include "util.h"
+#include "numa.h"
 
 #include "hook.h"
+#include <algorithm>
+#include <execinfo.h>
+#include <sched.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
 
 namespace sylar {
 
 static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("system");
 
+static ConfigVar<bool>::ptr g_scheduler_metrics =
+    Config::Lookup<bool>("scheduler.metrics", true
+            , "record scheduler queue delay and run time histograms");
+
+static ConfigVar<uint32_t>::ptr g_scheduler_watchdog_threshold =
+    Config::Lookup<uint32_t>("scheduler.watchdog_threshold", 0
+            , "log fibers running longer than this without yielding(ms), 0 disables watchdog");
+
+static ConfigVar<int>::ptr g_scheduler_watchdog_signal =
+    Config::Lookup<int>("scheduler.watchdog_signal", SIGURG
+            , "signal the watchdog sends to capture a stuck thread's backtrace, fixed once the first watchdog starts");
+
+static ConfigVar<std::map<std::string, std::string> >::ptr g_scheduler_affinity =
+    Config::Lookup("scheduler.affinity", std::map<std::string, std::string>()
+            , "pin scheduler threads to cpus, scheduler name => cpu list(0-3,8) or node:N(one cpu per core on node N)");
+
+static ConfigVar<std::map<std::string, uint32_t> >::ptr g_scheduler_max_threads =
+    Config::Lookup("scheduler.max_threads", std::map<std::string, uint32_t>()
+            , "elastic thread count, scheduler name => max threads, constructor threads is the min");
+
+static ConfigVar<uint32_t>::ptr g_scheduler_elastic_grow_delay =
+    Config::Lookup<uint32_t>("scheduler.elastic_grow_delay", 2000
+            , "elastic scheduler adds a thread while average queue delay stays above this(us)");
+
+static ConfigVar<uint32_t>::ptr g_scheduler_elastic_idle_timeout =
+    Config::Lookup<uint32_t>("scheduler.elastic_idle_timeout", 10000
+            , "elastic scheduler retires a thread idle for this long(ms)");
+
+static std::atomic<bool> s_metrics(true);
+static std::atomic<uint32_t> s_watchdog_threshold(0);
+static std::atomic<uint32_t> s_elastic_grow_delay(2000);
+static std::atomic<uint32_t> s_elastic_idle_timeout(10000);
+
+struct _SchedulerIniter {
+    _SchedulerIniter() {
+        s_metrics = g_scheduler_metrics->getValue();
+        g_scheduler_metrics->addListener([](const bool& ov, const bool& nv){
+            s_metrics = nv;
+        });
+        s_watchdog_threshold = g_scheduler_watchdog_threshold->getValue();
+        g_scheduler_watchdog_threshold->addListener([](const uint32_t& ov, const uint32_t& nv){
+            s_watchdog_threshold = nv;
+        });
+        s_elastic_grow_delay = g_scheduler_elastic_grow_delay->getValue();
+        g_scheduler_elastic_grow_delay->addListener([](const uint32_t& ov, const uint32_t& nv){
+            s_elastic_grow_delay = nv;
+        });
+        s_elastic_idle_timeout = g_scheduler_elastic_idle_timeout->getValue();
+        g_scheduler_elastic_idle_timeout->addListener([](const uint32_t& ov, const uint32_t& nv){
+            s_elastic_idle_timeout = nv;
+        });
+    }
+};
+
+static _SchedulerIniter _init;
+
 
 // 当前线程的调度器
 static thread_local Scheduler* t_scheduler = nullptr;
 // 当前线程的主协程
 static thread_local Fiber* t_fiber = nullptr;
+// 调度循环当前切入的协程, 直接交接后会变为交接目标
+static thread_local Fiber::ptr t_running = nullptr;
+// 直接交接后让出的协程, 调度循环下一轮优先执行
+static thread_local Fiber::ptr t_handoff = nullptr;
+
+/**
+ * @brief 工作线程的本地队列
+ * @details 固定大小的环形队列, 只有所属线程在tail放入, 所属线程和偷任务的线程
+ *          都通过CAS head取出; runnext存放本线程最新唤醒的任务, 优先执行以利用缓存.
+ *          head/tail分开在不同缓存行, 避免偷任务时和所属线程互相失效
+ */
+struct Scheduler::Worker {
+    static const uint32_t QUEUE_SIZE = 256;
+    // 连续执行runnext的上限, 防止两个协程互相唤醒饿死队列中的任务
+    static const uint32_t RUNNEXT_LIMIT = 16;
+    // 每隔多少次调度先看一次全局队列, 防止全局队列饿死
+    static const uint32_t GLOBAL_CHECK_TICKS = 61;
+    // 本地队列空时一次从全局队列最多取多少个任务
+    static const uint32_t GLOBAL_BATCH = 32;
+    // 连续执行HIGH任务的上限, 之后让其他任务执行一个
+    static const uint32_t HIGH_LIMIT = 32;
+    // 每隔多少次调度先看一次LOW队列, 防止LOW饿死
+    static const uint32_t LOW_CHECK_TICKS = 31;
+    // running为此值表示在调度循环上直接执行inlined任务
+    static const uint64_t INLINE_RUNNING = ~0ull;
+    // 看门狗抓取的调用栈深度
+    static const int BACKTRACE_SIZE = 64;
+    // 弹性模式检查排队延迟的周期(ms), 连续GROW_STREAK个周期偏高才加线程
+    static const uint32_t ELASTIC_PERIOD = 10;
+    static const uint32_t GROW_STREAK = 3;
 
+    Worker(Scheduler* s, int n)
+        :scheduler(s)
+        ,node(n) {
+        for(uint32_t i = 0; i < QUEUE_SIZE; ++i) {
+            ring[i] = nullptr;
+        }
+    }
+
+    // 放到队尾, 队列满返回false, 只能由所属线程调用
+    bool push(Task* task) {
+        uint32_t h = head.load(std::memory_order_acquire);
+        uint32_t t = tail.load(std::memory_order_relaxed);
+        if(t - h >= QUEUE_SIZE) {
+            return false;
+        }
+        ring[t % QUEUE_SIZE].store(task, std::memory_order_relaxed);
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    // 队列满时取出前一半, 由调用者转到全局队列
+    bool popHalf(TaskList& tasks) {
+        uint32_t h = head.load(std::memory_order_acquire);
+        uint32_t t = tail.load(std::memory_order_relaxed);
+        uint32_t n = (t - h) / 2;
+        if(n < QUEUE_SIZE / 2) {
+            // 刚被偷走了一部分, 已经不满
+            return false;
+        }
+        Task* batch[QUEUE_SIZE / 2];
+        for(uint32_t i = 0; i < n; ++i) {
+            batch[i] = ring[(h + i) % QUEUE_SIZE].load(std::memory_order_relaxed);
+        }
+        if(!head.compare_exchange_strong(h, h + n, std::memory_order_acq_rel)) {
+            return false;
+        }
+        for(uint32_t i = 0; i < n; ++i) {
+            tasks.push_back(batch[i]);
+        }
+        return true;
+    }
+
+    // 本地队列的空位数, 只有所属线程放入, 所属线程读到的值只会偏小
+    uint32_t freeSlots() const {
+        return QUEUE_SIZE - (tail.load(std::memory_order_relaxed)
+                - head.load(std::memory_order_acquire));
+    }
+
+    // 所属线程取任务, runnext优先
+    Task* pop() {
+        if(runnextStreak < RUNNEXT_LIMIT) {
+            Task* task = runnext.exchange(nullptr, std::memory_order_acquire);
+            if(task) {
+                ++runnextStreak;
+                return task;
+            }
+        }
+        runnextStreak = 0;
+        while(true) {
+            uint32_t h = head.load(std::memory_order_acquire);
+            uint32_t t = tail.load(std::memory_order_relaxed);
+            if(t == h) {
+                return runnext.exchange(nullptr, std::memory_order_acquire);
+            }
+            Task* task = ring[h % QUEUE_SIZE].load(std::memory_order_relaxed);
+            if(head.compare_exchange_weak(h, h + 1, std::memory_order_acq_rel)) {
+                return task;
+            }
+        }
+    }
+
+    // 从victim偷一半任务到本队列, 返回其中一个直接执行; 只能由所属线程调用
+    Task* stealFrom(Worker* victim, bool steal_runnext) {
+        uint32_t t = tail.load(std::memory_order_relaxed);
+        while(true) {
+            uint32_t h = victim->head.load(std::memory_order_acquire);
+            uint32_t vt = victim->tail.load(std::memory_order_acquire);
+            uint32_t n = vt - h;
+            n = n - n / 2;
+            if(n == 0) {
+                if(!steal_runnext) {
+                    return nullptr;
+                }
+                // 对方正忙于执行其他任务, runnext等不到它
+                return victim->runnext.exchange(nullptr, std::memory_order_acquire);
+            }
+            if(n > QUEUE_SIZE / 2) {
+                // head和tail读取不一致, 重试
+                continue;
+            }
+            for(uint32_t i = 0; i < n; ++i) {
+                ring[(t + i) % QUEUE_SIZE].store(
+                        victim->ring[(h + i) % QUEUE_SIZE].load(std::memory_order_relaxed)
+                        , std::memory_order_relaxed);
+            }
+            if(!victim->head.compare_exchange_weak(h, h + n, std::memory_order_acq_rel)) {
+                continue;
+            }
+            --n;
+            Task* task = ring[(t + n) % QUEUE_SIZE].load(std::memory_order_relaxed);
+            if(n) {
+                tail.store(t + n, std::memory_order_release);
+            }
+            return task;
+        }
+    }
+
+    /**
+     * @brief 放入指定在本线程执行的任务
+     * @param[out] empty 放入前是否为空
+     * @return 线程已退出返回false
+     */
+    bool pushMailbox(Task* task, bool& empty) {
+        MailboxMutexType::Lock lock(mailboxMutex);
+        if(closed) {
+            return false;
+        }
+        empty = mailbox.empty();
+        mailbox.push_back(task);
+        ++mailboxSize;
+        return true;
+    }
+
+    // 线程退出时取出所有任务并关闭mailbox, 只能由所属线程调用, 可能和偷任务并发
+    void close(TaskList& tasks) {
+        runnextStreak = 0;
+        while(Task* task = pop()) {
+            tasks.push_back(task);
+        }
+        tasks.splice(pinned);
+        tasks.splice(switching);
+        MailboxMutexType::Lock lock(mailboxMutex);
+        closed = true;
+        tasks.splice(mailbox);
+        mailboxSize = 0;
+    }
+
+    // 给新线程复用前重新打开mailbox
+    void reopen() {
+        MailboxMutexType::Lock lock(mailboxMutex);
+        closed = false;
+        idleSince = 0;
+        retiring = false;
+    }
+
+    // 取指定在本线程执行的任务, 一次把mailbox全部取到本线程私有的pinned中
+    Task* popPinned() {
+        if(pinned.empty() && mailboxSize.load(std::memory_order_relaxed)) {
+            MailboxMutexType::Lock lock(mailboxMutex);
+            pinned.splice(mailbox);
+            mailboxSize = 0;
+        }
+        return pinned.pop_front();
+    }
+
+    // 取switching中协程已切出的任务, 取到的协程才能切入
+    Task* popSwitched() {
+        Task* task = nullptr;
+        for(size_t i = switching.size; i > 0; --i) {
+            Task* t = switching.pop_front();
+            if(!task && t->fiber->getState() != Fiber::EXEC) {
+                task = t;
+            } else {
+                switching.push_back(t);
+            }
+        }
+        return task;
+    }
+
+    // 开始一次切入, 只有两次relaxed写, 看门狗通过slice是否变化判断运行时长
+    void beginSlice(uint64_t fiber_id) {
+        running.store(fiber_id, std::memory_order_relaxed);
+        slice.store(slice.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+    void endSlice() {
+        running.store(0, std::memory_order_relaxed);
+    }
+
+    // 析构时取出剩余任务
+    void drain(TaskList& tasks) {
+        Task* task = runnext.exchange(nullptr);
+        if(task) {
+            tasks.push_back(task);
+        }
+        tasks.splice(mailbox);
+        tasks.splice(pinned);
+        tasks.splice(switching);
+        for(uint32_t h = head; h != tail; ++h) {
+            tasks.push_back(ring[h % QUEUE_SIZE]);
+        }
+        head.store(tail);
+    }
+
+    typedef Spinlock MailboxMutexType;
+
+    Scheduler* scheduler;
+    int node;                       //// 内存所在的NUMA节点, -1为普通new
+    std::atomic<int> thread {-1};   //// 所属线程, 弹性模式下空闲的worker为-1
+    uint64_t idleSince = 0;         //// 从何时开始一直没取到任务(ms), 0表示忙
+    bool retiring = false;          //// 所属线程正在退出
+    std::atomic<bool> idle {false}; //// 所属线程正在idle()中
+    uint32_t ticks = 0;
+    uint32_t runnextStreak = 0;
+    uint32_t highStreak = 0;
+    uint32_t rand = 0;
+    std::atomic<Task*> runnext {nullptr};
+    char pad0[64];
+    std::atomic<uint32_t> head {0};
+    char pad1[64];
+    std::atomic<uint32_t> tail {0};
+    char pad2[64];
+    std::atomic<Task*> ring[QUEUE_SIZE];
+
+    // 其他线程放入的指定本线程执行的任务
+    MailboxMutexType mailboxMutex;
+    TaskList mailbox;
+    std::atomic<size_t> mailboxSize {0};
+    // 所属线程已退出, 不再接收, 由mailboxMutex保护
+    bool closed = false;
+    // 从mailbox取出待执行的, 只有本线程访问
+    TaskList pinned;
+    // 取到时协程还在其他线程上切出的任务, 等它切出后再执行, 只有本线程访问
+    TaskList switching;
+
+    // 运行时统计, 只有本线程写, Scheduler::getStats随时读
+    Histogram queueDelay;
+    Histogram runTime;
+    std::atomic<uint64_t> steals {0};
+    std::atomic<uint64_t> idles {0};
+    std::atomic<uint64_t> longSlices {0};
+    // 本线程已结束协程的对象池
+    Fiber::Pool fiberPool;
+
+    // 看门狗采样: 当前执行的协程id(0表示没有)和切入次数
+    std::atomic<uint64_t> running {0};
+    std::atomic<uint64_t> slice {0};
+    // 线程在run()中时alive为true, 看门狗持锁确认后才能向它发信号
+    Spinlock aliveMutex;
+    bool alive = false;
+    pthread_t pthread;
+    // 看门狗请求的调用栈, 由本线程的信号处理函数填写
+    void* backtrace[BACKTRACE_SIZE];
+    std::atomic<int> backtraceSize {-1};
+};
+
+// 当前线程的工作队列
+static thread_local Scheduler::Worker* t_worker = nullptr;
+
+// 在cb_fiber中执行回调任务, 结束(包括抛出异常)后回收task
+static void RunTask(Task* task) {
+    struct Guard {
+        ~Guard() { Task::Destroy(task);}
+        Task* task;
+    } guard = {task};
+    task->invoke();
+}
+
+// 看门狗抓取调用栈的信号, 安装后才不为0
+static std::atomic<int> s_watchdog_signal(0);
+// 安装前该信号的处理方式, 不是看门狗发来的信号交给它
+static struct sigaction s_watchdog_old_action;
+
+// 把信号交给安装看门狗之前的处理方式
+static void ForwardWatchdogSignal(int sig, siginfo_t* info, void* context) {
+    const struct sigaction& old = s_watchdog_old_action;
+    if(old.sa_flags & SA_SIGINFO) {
+        if(old.sa_sigaction) {
+            old.sa_sigaction(sig, info, context);
+        }
+        return;
+    }
+    if(old.sa_handler == SIG_IGN) {
+        return;
+    }
+    if(old.sa_handler == SIG_DFL) {
+        //默认忽略的信号直接丢掉, 其余恢复默认处理后重新发出, 返回后按默认动作处理
+        if(sig == SIGURG || sig == SIGCHLD || sig == SIGWINCH || sig == SIGCONT) {
+            return;
+        }
+        sigaction(sig, &old, nullptr);
+        raise(sig);
+        return;
+    }
+    old.sa_handler(sig);
+}
+
+// 在运行超时的线程上执行, 只记录返回地址, 符号化由看门狗线程做
+static void WatchdogSignalHandler(int sig, siginfo_t* info, void* context) {
+    Scheduler::Worker* worker = t_worker;
+    //看门狗用pthread_kill发送, 并且先把backtraceSize置0
+    if(info->si_code != SI_TKILL || info->si_pid != getpid()
+            || !worker || worker->backtraceSize.load(std::memory_order_acquire) != 0) {
+        ForwardWatchdogSignal(sig, info, context);
+        return;
+    }
+    int n = ::backtrace(worker->backtrace, Scheduler::Worker::BACKTRACE_SIZE);
+    worker->backtraceSize.store(n, std::memory_order_release);
+}
+
+static void InstallWatchdogSignal() {
+    static Spinlock s_mutex;
+    Spinlock::Lock lock(s_mutex);
+    if(s_watchdog_signal) {
+        return;
+    }
+    int sig = g_scheduler_watchdog_signal->getValue();
+    //backtrace第一次调用会加载libgcc_s, 不能发生在信号处理函数里
+    void* dummy[1];
+    ::backtrace(dummy, 1);
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_sigaction = &WatchdogSignalHandler;
+    sa.sa_flags = SA_RESTART | SA_SIGINFO;
+    sigemptyset(&sa.sa_mask);
+    if(sigaction(sig, &sa, &s_watchdog_old_action)) {
+        SYLAR_LOG_ERROR(g_logger) << "install watchdog signal " << sig << " errno=" << errno
+            << " errstr=" << strerror(errno) << ", backtrace unavailable";
+        return;
+    }
+    s_watchdog_signal = sig;
+}
+
+// 在调度循环的栈上直接执行inlined任务, 期间禁止让出
+static void RunInline(Task* task) {
+    Fiber::SetYieldable(false);
+    try {
+        task->invoke();
+    } catch (std::exception& e) {
+        SYLAR_LOG_ERROR(g_logger) << "Inline Task Except: " << e.what()
+            << std::endl
+            << sylar::BacktraceToString();
+    } catch(...) {
+        SYLAR_LOG_ERROR(g_logger) << "Inline Task Except"
+            << std::endl
+            << sylar::BacktraceToString();
+    }
+    Fiber::SetYieldable(true);
+    Task::Destroy(task);
+}
 
 Scheduler::Scheduler(size_t threads, bool use_caller, const std::string& name)
     :m_name(name){
     SYLAR_ASSERT(threads > 0);
+    for(int i = 0; i < PRIORITY_COUNT; ++i) {
+        m_globalCount[i] = 0;
+        m_queued[i] = 0;
+    }
 
     if(use_caller) {
         //创建线程的主协程
@@ -37,13 +477,54 @@ Scheduler::Scheduler(size_t threads, bool use_caller, const std::string& name)
         m_rootThread = -1;
     }
     m_threadCount = threads;
+
+    std::map<std::string, std::string> affinity = g_scheduler_affinity->getValue();
+    auto it = affinity.find(m_name);
+    if(it != affinity.end()
+            && !Numa::ParseAffinity(it->second, m_cpus)) {
+        SYLAR_LOG_ERROR(g_logger) << "invalid scheduler.affinity " << m_name
+            << "=" << it->second << ", threads not pinned";
+    }
+
+    m_minThreads = m_threadCount;
+    m_maxThreads = m_threadCount;
+    std::map<std::string, uint32_t> max_threads = g_scheduler_max_threads->getValue();
+    auto mit = max_threads.find(m_name);
+    if(mit != max_threads.end() && mit->second > m_maxThreads) {
+        m_maxThreads = mit->second;
+    }
+
+    //use_caller的线程不绑核, 它的worker按默认策略分配.
+    //弹性模式按上限分配worker, m_workers之后不再变化
+    if(m_rootFiber) {
+        m_workers.push_back(newWorker(-1));
+    }
+    for(size_t i = 0; i < m_maxThreads; ++i) {
+        m_workers.push_back(newWorker(workerNode(i)));
+    }
+    if(m_rootFiber) {
+        m_workers[0]->thread = m_rootThread;
+    }
 }
 
 Scheduler::~Scheduler() {
     SYLAR_ASSERT(m_stopping);
+    stopWatchdog();
     if(GetThis() == this) {
         t_scheduler = nullptr;
     }
+    TaskList tasks;
+    for(auto& i : m_fibers) {
+        tasks.splice(i);
+    }
+    for(auto& i : m_workers) {
+        i->drain(tasks);
+        deleteWorker(i);
+    }
+    m_workers.clear();
+    while(Task* task = tasks.pop_front()) {
+        Task::Destroy(task);
+    }
 }
 
 Scheduler* Scheduler::GetThis() {
@@ -54,6 +535,11 @@ Fiber* Scheduler::GetMainFiber() {
     return t_fiber;
 }
 
+bool Scheduler::CanPark() {
+    return t_scheduler && Fiber::GetFiberId() != 0 && Fiber::IsYieldable()
+        && Fiber::GetThis().get() != t_fiber;
+}
+
 void Scheduler::start() {
     MutexType::Lock lock(m_mutex);
     if(!m_stopping) {
@@ -65,11 +551,24 @@ void Scheduler::start() {
     m_threads.resize(m_threadCount);
     for(size_t i = 0; i < m_threadCount; ++i) {
         m_threads[i].reset(new Thread(std::bind(&Scheduler::run, this),
-                                      m_name + "_" + std::to_string(i)));
+                                      m_name + "_" + std::to_string(i)
+                                      ,m_cpus.empty() ? -1 : m_cpus[i % m_cpus.size()]));
         m_threadIds.push_back(m_threads[i]->getId());
+        m_workers[i + (m_rootFiber ? 1 : 0)]->thread = m_threads[i]->getId();
     }
     lock.unlock();
 
+    uint32_t threshold = s_watchdog_threshold;
+    if((threshold || m_maxThreads > m_minThreads) && !m_watchdog) {
+        //只在弹性模式下启动时用不到信号, 不改动进程的信号处理
+        if(threshold) {
+            InstallWatchdogSignal();
+        }
+        m_watchdogStop = false;
+        m_watchdog.reset(new Thread(std::bind(&Scheduler::watchdog, this, threshold),
+                                    m_name + "_watchdog"));
+    }
+
     // if(m_rootFiber) {
     //     m_rootFiber->call();
     //     SYLAR_LOG_INFO(g_logger) << "call out " << m_rootFiber->getState();
@@ -130,6 +629,112 @@ void Scheduler::stop() {
     for(auto& i : thrs) {
         i->join();
     }
+    stopWatchdog();
+}
+
+void Scheduler::stopWatchdog() {
+    if(!m_watchdog) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_watchdogMutex);
+        m_watchdogStop = true;
+    }
+    m_watchdogCond.notify_all();
+    m_watchdog->join();
+    m_watchdog.reset();
+}
+
+void Scheduler::watchdog(uint32_t threshold_ms) {
+    //每个worker上一次采样看到的切入次数, 以及第一次看到它的时间
+    struct Sample {
+        uint64_t slice = 0;
+        uint64_t since = 0;
+        bool reported = false;
+    };
+    std::vector<Sample> samples(m_workers.size());
+    bool elastic = m_maxThreads > m_minThreads;
+    uint32_t period = threshold_ms ? std::max(threshold_ms / 4, 1u) : Worker::ELASTIC_PERIOD;
+    if(elastic) {
+        period = std::min(period, (uint32_t)Worker::ELASTIC_PERIOD);
+    }
+    uint64_t delay_count = 0;
+    uint64_t delay_sum = 0;
+    uint32_t streak = 0;
+
+    std::unique_lock<std::mutex> lock(m_watchdogMutex);
+    while(!m_watchdogStop) {
+        m_watchdogCond.wait_for(lock, std::chrono::milliseconds(period));
+        if(m_watchdogStop) {
+            break;
+        }
+        if(elastic) {
+            adjustThreads(delay_count, delay_sum, streak);
+        }
+        if(!threshold_ms) {
+            continue;
+        }
+        uint64_t now = GetCurrentMS();
+        for(size_t i = 0; i < m_workers.size(); ++i) {
+            Worker* worker = m_workers[i];
+            Sample& sample = samples[i];
+            uint64_t running = worker->running.load(std::memory_order_relaxed);
+            uint64_t slice = worker->slice.load(std::memory_order_relaxed);
+            if(!running || slice != sample.slice) {
+                sample.slice = slice;
+                sample.since = now;
+                sample.reported = false;
+                continue;
+            }
+            //切入时间只精确到一个采样周期
+            if(sample.reported || now - sample.since + period < threshold_ms) {
+                continue;
+            }
+            sample.reported = true;
+            worker->longSlices.fetch_add(1, std::memory_order_relaxed);
+
+            //让该线程在信号处理函数里记录调用栈
+            worker->backtraceSize.store(0, std::memory_order_release);
+            bool sent = false;
+            int sig = s_watchdog_signal;
+            if(sig) {
+                Spinlock::Lock alive_lock(worker->aliveMutex);
+                if(worker->alive) {
+                    sent = pthread_kill(worker->pthread, sig) == 0;
+                }
+            }
+            int n = -1;
+            for(int wait = 0; sent && wait < 100; ++wait) {
+                n = worker->backtraceSize.load(std::memory_order_acquire);
+                if(n > 0) {
+                    break;
+                }
+                usleep(1000);
+            }
+            worker->backtraceSize.store(-1, std::memory_order_release);
+
+            std::stringstream ss;
+            ss << "scheduler " << m_name << " thread " << worker->thread;
+            if(running == Worker::INLINE_RUNNING) {
+                ss << " inline task";
+            } else {
+                ss << " fiber_id=" << running;
+            }
+            ss << " running over " << (now - sample.since + period) << "ms without yield";
+            if(n > 0 && worker->slice.load(std::memory_order_relaxed) == slice) {
+                char** symbols = backtrace_symbols(worker->backtrace, n);
+                ss << std::endl;
+                //跳过信号处理函数和信号跳板
+                for(int j = 2; symbols && j < n; ++j) {
+                    ss << "    " << symbols[j] << std::endl;
+                }
+                free(symbols);
+            } else {
+                ss << ", backtrace unavailable";
+            }
+            SYLAR_LOG_WARN(g_logger) << ss.str();
+        }
+    }
 }
 
 void Scheduler::setThis() {
@@ -147,65 +752,140 @@ void Scheduler::run() {
         t_fiber = Fiber::GetThis().get();
     }
 
+    Worker* worker = nullptr;
+    {
+        //等start()把线程号填到worker上
+        MutexType::Lock lock(m_mutex);
+        worker = getWorker(sylar::GetThreadId());
+    }
+    SYLAR_ASSERT2(worker, "scheduler " + m_name + " worker not found");
+    worker->rand = worker->thread * 2654435761u + 1;
+    {
+        Spinlock::Lock lock(worker->aliveMutex);
+        worker->pthread = pthread_self();
+        worker->alive = true;
+    }
+    t_worker = worker;
+    Fiber::SetThreadPool(&worker->fiberPool);
+
     Fiber::ptr idle_fiber(new Fiber(std::bind(&Scheduler::idle, this)));
     Fiber::ptr cb_fiber;
 
-    FiberAndThread ft;
     while(true) {
-        ft.reset();
-        bool tickle_me = false;
+        Fiber::ptr fiber;
+        Task* task = nullptr;
         bool is_active = false;
-        {
-            MutexType::Lock lock(m_mutex);
-            auto it = m_fibers.begin();
-            while(it != m_fibers.end()) {
-                if(it->thread != -1 && it->thread != sylar::GetThreadId()) {
-                    ++it;
-                    tickle_me = true;
-                    continue;
+        //本轮开始执行的时间, 为0时不统计
+        uint64_t begin = 0;
+        if(t_handoff) {
+            //交接让出的协程不经过队列, 活跃计数在上一轮没有减
+            fiber.swap(t_handoff);
+            is_active = true;
+            if(s_metrics) {
+                begin = GetMonotonicNS();
+            }
+        } else {
+            //先加活跃计数再取任务, stopping()不会看到任务在途时两个计数都为0
+            ++m_activeThreadCount;
+            task = worker->switching.empty() ? nullptr : worker->popSwitched();
+            if(!task) {
+                task = dequeue(worker);
+            }
+            if(task && task->fiber && task->fiber->getState() == Fiber::EXEC) {
+                //还在其他线程上切出, 放回队列会被本线程立刻再取到(指定线程的必然如此),
+                //留在本线程等它切出, 每轮开始时再看. 排队延迟从这里重新计算
+                if(task->enqueueTime) {
+                    task->enqueueTime = GetMonotonicNS();
                 }
-
-                SYLAR_ASSERT(it->fiber || it->cb);
-                if(it->fiber && it->fiber->getState() == Fiber::EXEC) {
-                    ++it;
+                worker->switching.push_back(task);
+                task = nullptr;
+            }
+            if(task) {
+                --m_taskCount;
+                --m_queued[task->priority];
+                is_active = true;
+                worker->idleSince = 0;
+                if(task->enqueueTime) {
+                    begin = GetMonotonicNS();
+                    worker->queueDelay.record(begin - task->enqueueTime);
+                }
+                if(task->inlined) {
+                    worker->beginSlice(Worker::INLINE_RUNNING);
+                    RunInline(task);
+                    worker->endSlice();
+                    if(begin) {
+                        worker->runTime.record(GetMonotonicNS() - begin);
+                    }
+                    --m_activeThreadCount;
                     continue;
                 }
-
-                ft = *it;
-                m_fibers.erase(it);
-                ++m_activeThreadCount;
-                is_active = true;
-                break;
+                if(task->fiber) {
+                    fiber.swap(task->fiber);
+                    Task::Destroy(task);
+                    task = nullptr;
+                }
+            } else {
+                --m_activeThreadCount;
             }
         }
 
-        if(tickle_me) {
-            tickle();
-        }
-
-        if(ft.fiber && (ft.fiber->getState() != Fiber::TERM
-                        && ft.fiber->getState() != Fiber::EXCEPT)) {
-            ft.fiber->swapIn();
-            --m_activeThreadCount;
+        if(fiber && (fiber->getState() != Fiber::TERM
+                        && fiber->getState() != Fiber::EXCEPT)) {
+            t_running.swap(fiber);
+            worker->beginSlice(t_running->getId());
+            t_running->swapIn();
+            worker->endSlice();
+            //切回来的可能是交接链上的最后一个协程
+            fiber.swap(t_running);
+            if(begin) {
+                worker->runTime.record(GetMonotonicNS() - begin);
+            }
+            if(!t_handoff) {
+                --m_activeThreadCount;
+            }
 
-            if(ft.fiber->getState() == Fiber::READY) {
-                schedule(ft.fiber);
-            } else if(ft.fiber->getState() != Fiber::TERM
-                    && ft.fiber->getState() != Fiber::EXCEPT) {
-                ft.fiber->m_state = Fiber::HOLD;
+            if(fiber->getState() == Fiber::READY) {
+                requeue(fiber);
+            } else if(fiber->getState() != Fiber::TERM
+                    && fiber->getState() != Fiber::EXCEPT) {
+                fiber->m_state = Fiber::HOLD;
+            } else {
+                worker->fiberPool.put(fiber);
             }
-            ft.reset();
-        } else if(ft.cb) {
+        } else if(task) {
+            //回调在执行完后回收task, 捕获一个指针的lambda不会让std::function分配内存
+            std::function<void()> cb = [task](){ RunTask(task); };
             if(cb_fiber) {
-                cb_fiber->reset(ft.cb);
+                cb_fiber->reset(cb);
             } else {
-                cb_fiber.reset(new Fiber(ft.cb));
+                //上一个cb_fiber让出了, 从池中取一个结束的协程
+                cb_fiber = Fiber::Create(cb);
             }
-            ft.reset();
+            cb = nullptr;
+            t_running = cb_fiber;
+            worker->beginSlice(cb_fiber->getId());
             cb_fiber->swapIn();
-            --m_activeThreadCount;
-            if(cb_fiber->getState() == Fiber::READY) {
-                schedule(cb_fiber);
+            worker->endSlice();
+            fiber.swap(t_running);
+            if(begin) {
+                worker->runTime.record(GetMonotonicNS() - begin);
+            }
+            if(!t_handoff) {
+                --m_activeThreadCount;
+            }
+            if(fiber != cb_fiber) {
+                //cb_fiber交接给了别的协程, 它已不能复用
+                if(fiber->getState() == Fiber::READY) {
+                    requeue(fiber);
+                } else if(fiber->getState() != Fiber::TERM
+                        && fiber->getState() != Fiber::EXCEPT) {
+                    fiber->m_state = Fiber::HOLD;
+                } else {
+                    worker->fiberPool.put(fiber);
+                }
+                cb_fiber.reset();
+            } else if(cb_fiber->getState() == Fiber::READY) {
+                requeue(cb_fiber);
                 cb_fiber.reset();
             } else if(cb_fiber->getState() == Fiber::EXCEPT
                     || cb_fiber->getState() == Fiber::TERM) {
@@ -219,33 +899,599 @@ void Scheduler::run() {
                 --m_activeThreadCount;
                 continue;
             }
+            if(!worker->switching.empty()) {
+                //对方线程可能在切出途中被抢占, 让出CPU而不是进入idle()
+                sched_yield();
+                continue;
+            }
             if(idle_fiber->getState() == Fiber::TERM) {
                 SYLAR_LOG_INFO(g_logger) << "idle fiber term";
                 break;
             }
+            if(m_maxThreads > m_minThreads && retire(worker)) {
+                //idle()看到isRetiring后返回
+                worker->retiring = true;
+            }
 
+            worker->idle = true;
             ++m_idleThreadCount;
+            worker->idles.fetch_add(1, std::memory_order_relaxed);
             idle_fiber->swapIn();
             --m_idleThreadCount;
+            worker->idle = false;
+            if(worker->retiring) {
+                if(idle_fiber->getState() == Fiber::TERM) {
+                    break;
+                }
+                cancelRetire(worker);
+            }
             if(idle_fiber->getState() != Fiber::TERM
                     && idle_fiber->getState() != Fiber::EXCEPT) {
                 idle_fiber->m_state = Fiber::HOLD;
             }
         }
     }
+    {
+        Spinlock::Lock lock(worker->aliveMutex);
+        worker->alive = false;
+    }
+    if(worker->retiring) {
+        releaseWorker(worker);
+    }
+    Fiber::SetThreadPool(nullptr);
+    t_worker = nullptr;
+}
+
+void Scheduler::requeue(Fiber::ptr fiber) {
+    Task* task = Task::Create();
+    task->assign(&fiber);
+    enqueue(task, true);
+}
+
+bool Scheduler::enqueue(Task* task, bool yield) {
+    if(s_metrics) {
+        task->enqueueTime = GetMonotonicNS();
+    }
+    ++m_taskCount;
+    ++m_queued[task->priority];
+    if(task->thread != -1) {
+        return pushPinned(task);
+    }
+    Worker* worker = t_worker;
+    if(!worker || worker->scheduler != this || task->priority != NORMAL) {
+        return pushGlobal(task);
+    }
+
+    if(!yield) {
+        //新唤醒的任务放入runnext, 原来的排到队尾
+        task = worker->runnext.exchange(task, std::memory_order_acq_rel);
+        if(!task) {
+            return hasIdleThreads();
+        }
+    }
+    while(!worker->push(task)) {
+        //本地队列满, 把一半转到全局队列
+        TaskList tasks;
+        if(worker->popHalf(tasks)) {
+            tasks.push_back(task);
+            MutexType::Lock lock(m_mutex);
+            m_globalCount[NORMAL] += tasks.size;
+            m_fibers[NORMAL].splice(tasks);
+            break;
+        }
+    }
+    return hasIdleThreads();
+}
+
+bool Scheduler::enqueue(TaskList& tasks) {
+    if(tasks.empty()) {
+        return false;
+    }
+    m_taskCount += tasks.size;
+    Worker* worker = t_worker;
+    if(worker && worker->scheduler != this) {
+        worker = nullptr;
+    }
+
+    bool need_tickle = false;
+    bool has_global = false;
+    TaskList global[PRIORITY_COUNT];
+    uint64_t now = s_metrics ? GetMonotonicNS() : 0;
+    while(Task* task = tasks.pop_front()) {
+        task->enqueueTime = now;
+        ++m_queued[task->priority];
+        if(task->thread != -1) {
+            need_tickle = pushPinned(task) || need_tickle;
+        } else if(!worker || task->priority != NORMAL || !worker->push(task)) {
+            global[task->priority].push_back(task);
+            has_global = true;
+        }
+    }
+    if(has_global) {
+        MutexType::Lock lock(m_mutex);
+        for(int i = 0; i < PRIORITY_COUNT; ++i) {
+            need_tickle = need_tickle || m_fibers[i].empty();
+            m_globalCount[i] += global[i].size;
+            m_fibers[i].splice(global[i]);
+        }
+    }
+    return need_tickle || (worker && hasIdleThreads());
+}
+
+bool Scheduler::pushGlobal(Task* task) {
+    MutexType::Lock lock(m_mutex);
+    bool need_tickle = true;
+    for(auto& i : m_fibers) {
+        need_tickle = need_tickle && i.empty();
+    }
+    m_fibers[task->priority].push_back(task);
+    ++m_globalCount[task->priority];
+    return need_tickle;
+}
+
+bool Scheduler::pushPinned(Task* task) {
+    Worker* worker = getWorker(task->thread);
+    bool empty = false;
+    if(!worker || !worker->pushMailbox(task, empty)) {
+        //弹性模式下线程可能已经退出
+        LogLevel::Level level = m_maxThreads > m_minThreads
+                ? LogLevel::DEBUG : LogLevel::ERROR;
+        SYLAR_LOG_LEVEL(g_logger, level)
+            << "schedule to thread " << task->thread
+            << " not in scheduler " << m_name << ", run on any thread";
+        task->thread = -1;
+        return pushGlobal(task);
+    }
+    if(empty && worker != t_worker) {
+        tickle(task->thread);
+    }
+    return false;
+}
+
+int Scheduler::workerNode(size_t i) const {
+    return m_cpus.empty() ? -1 : Numa::GetCpuNode(m_cpus[i % m_cpus.size()]);
+}
+
+bool Scheduler::addThread() {
+    MutexType::Lock lock(m_mutex);
+    if(m_stopping || m_threadCount >= m_maxThreads) {
+        return false;
+    }
+    size_t base = m_rootFiber ? 1 : 0;
+    for(size_t i = base; i < m_workers.size(); ++i) {
+        Worker* worker = m_workers[i];
+        if(worker->thread != -1) {
+            continue;
+        }
+        //第i个worker固定对应第i - base个线程的名字和CPU
+        size_t idx = i - base;
+        worker->reopen();
+        Thread::ptr thr(new Thread(std::bind(&Scheduler::run, this)
+                                   ,m_name + "_" + std::to_string(idx)
+                                   ,m_cpus.empty() ? -1 : m_cpus[idx % m_cpus.size()]));
+        worker->thread = thr->getId();
+        m_threads.push_back(thr);
+        m_threadIds.push_back(thr->getId());
+        ++m_threadCount;
+        SYLAR_LOG_INFO(g_logger) << "scheduler " << m_name << " add thread "
+            << thr->getName() << " threads=" << m_threadCount;
+        return true;
+    }
+    return false;
+}
+
+bool Scheduler::retire(Worker* worker) {
+    uint64_t now = GetCurrentMS();
+    if(!worker->idleSince) {
+        worker->idleSince = now;
+        return false;
+    }
+    if(now - worker->idleSince < s_elastic_idle_timeout
+            || worker->thread == m_rootThread
+            || Fiber::HasBoundFibers()
+            || !canRetire()) {
+        return false;
+    }
+    MutexType::Lock lock(m_mutex);
+    if(m_stopping || m_threadCount <= m_minThreads) {
+        return false;
+    }
+    --m_threadCount;
+    m_threadIds.erase(std::find(m_threadIds.begin(), m_threadIds.end()
+                                ,worker->thread.load()));
+    SYLAR_LOG_INFO(g_logger) << "scheduler " << m_name << " retire thread "
+        << Thread::GetName() << " threads=" << m_threadCount;
+    return true;
+}
+
+void Scheduler::cancelRetire(Worker* worker) {
+    MutexType::Lock lock(m_mutex);
+    worker->retiring = false;
+    worker->idleSince = 0;
+    ++m_threadCount;
+    m_threadIds.push_back(worker->thread);
+}
+
+void Scheduler::releaseWorker(Worker* worker) {
+    TaskList tasks;
+    worker->close(tasks);
+    size_t n = tasks.size;
+    //指定在本线程的任务改为任意线程执行, 绑定共享栈的协程在retire时已排除
+    TaskList global[PRIORITY_COUNT];
+    while(Task* task = tasks.pop_front()) {
+        task->thread = -1;
+        global[task->priority].push_back(task);
+    }
+    {
+        MutexType::Lock lock(m_mutex);
+        for(int i = 0; i < PRIORITY_COUNT; ++i) {
+            m_globalCount[i] += global[i].size;
+            m_fibers[i].splice(global[i]);
+        }
+        worker->retiring = false;
+        worker->thread = -1;
+    }
+    if(n) {
+        SYLAR_LOG_INFO(g_logger) << "scheduler " << m_name << " thread "
+            << Thread::GetName() << " exit, move " << n << " tasks to global queue";
+        tickle();
+    }
+}
+
+void Scheduler::joinRetired() {
+    std::vector<Thread::ptr> thrs;
+    {
+        MutexType::Lock lock(m_mutex);
+        for(auto it = m_threads.begin(); it != m_threads.end();) {
+            if(std::find(m_threadIds.begin(), m_threadIds.end(), (*it)->getId())
+                    == m_threadIds.end()) {
+                thrs.push_back(*it);
+                it = m_threads.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+    for(auto& i : thrs) {
+        i->join();
+    }
+}
+
+void Scheduler::adjustThreads(uint64_t& count, uint64_t& sum, uint32_t& streak) {
+    joinRetired();
+    uint64_t c = 0;
+    uint64_t s = 0;
+    for(auto& i : m_workers) {
+        c += i->queueDelay.getCount();
+        s += i->queueDelay.getSum();
+    }
+    uint64_t n = c - count;
+    uint64_t d = s - sum;
+    count = c;
+    sum = s;
+
+    bool slow = false;
+    if(m_taskCount > 0 && m_idleThreadCount == 0) {
+        //这个周期一个任务都没开始执行(或scheduler.metrics关闭)而队列不空, 也算偏高
+        slow = !n || d / n > (uint64_t)s_elastic_grow_delay * 1000;
+    }
+    if(!slow) {
+        streak = 0;
+        return;
+    }
+    if(++streak < Worker::GROW_STREAK) {
+        return;
+    }
+    //新线程要几个周期才能降下延迟, 重新计数
+    streak = 0;
+    addThread();
+}
+
+bool Scheduler::isRetiring() const {
+    return t_worker && t_worker->scheduler == this && t_worker->retiring;
+}
+
+Scheduler::Worker* Scheduler::newWorker(int node) {
+    if(node < 0 || Numa::GetNodeCount() <= 1) {
+        return new Worker(this, -1);
+    }
+    //本地队列和统计每次调度都要读写, 先绑定节点再构造, 页在目标节点上分配
+    void* mem = Numa::Alloc(sizeof(Worker), node);
+    if(!mem) {
+        return new Worker(this, -1);
+    }
+    return new (mem) Worker(this, node);
+}
+
+void Scheduler::deleteWorker(Worker* worker) {
+    if(worker->node < 0) {
+        delete worker;
+        return;
+    }
+    worker->~Worker();
+    Numa::Free(worker, sizeof(Worker));
+}
+
+Scheduler::Worker* Scheduler::getWorker(int thread) {
+    //线程数很少, 顺序查找比哈希更快
+    for(auto& i : m_workers) {
+        if(i->thread == thread) {
+            return i;
+        }
+    }
+    return nullptr;
+}
+
+int Scheduler::getWorkerIndex() const {
+    if(!t_worker || t_worker->scheduler != this) {
+        return -1;
+    }
+    for(size_t i = 0; i < m_workers.size(); ++i) {
+        if(m_workers[i] == t_worker) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+int Scheduler::getWorkerIndex(int thread) const {
+    for(size_t i = 0; i < m_workers.size(); ++i) {
+        if(m_workers[i]->thread == thread) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+int Scheduler::getWorkerThread(size_t index) const {
+    return m_workers[index]->thread;
+}
+
+bool Scheduler::hasTasks() const {
+    for(int i = 0; i < PRIORITY_COUNT; ++i) {
+        if(m_globalCount[i] > 0) {
+            return true;
+        }
+    }
+    Worker* self = t_worker && t_worker->scheduler == this ? t_worker : nullptr;
+    if(self && self->mailboxSize > 0) {
+        return true;
+    }
+    //m_taskCount还包括其他线程mailbox中只能由它们执行的任务, 不能直接用
+    for(auto i : m_workers) {
+        if(i->runnext.load() || i->tail.load() != i->head.load()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool Scheduler::isWorkerIdle(size_t index) const {
+    return m_workers[index]->idle.load(std::memory_order_relaxed);
+}
+
+Task* Scheduler::popGlobal(Worker* worker, Priority priority, size_t max) {
+    if(m_globalCount[priority].load(std::memory_order_relaxed) == 0) {
+        return nullptr;
+    }
+    //多取的要放得进本地队列
+    max = std::min(max, (size_t)worker->freeSlots() + 1);
+    TaskList tasks;
+    {
+        MutexType::Lock lock(m_mutex);
+        TaskList& global = m_fibers[priority];
+        if(global.empty()) {
+            return nullptr;
+        }
+        size_t n = std::min(max, global.size / (m_threadCount + (m_rootFiber ? 1 : 0)) + 1);
+        n = std::min(n, global.size);
+        for(size_t i = 0; i < n; ++i) {
+            tasks.push_back(global.pop_front());
+        }
+        m_globalCount[priority] -= n;
+    }
+    Task* task = tasks.pop_front();
+    while(Task* t = tasks.pop_front()) {
+        worker->push(t);
+    }
+    return task;
+}
+
+Task* Scheduler::dequeue(Worker* worker) {
+    Task* task = nullptr;
+    ++worker->ticks;
+    if(worker->ticks % Worker::LOW_CHECK_TICKS == 0) {
+        task = popGlobal(worker, LOW, 1);
+        if(task) {
+            return task;
+        }
+    }
+    if(worker->ticks % Worker::GLOBAL_CHECK_TICKS == 0) {
+        //忙碌的线程不进入idle(), 顺便收取本线程事件源上就绪的任务
+        poll();
+        task = popGlobal(worker, NORMAL, 1);
+        if(task) {
+            return task;
+        }
+    }
+    if(worker->highStreak < Worker::HIGH_LIMIT) {
+        task = popGlobal(worker, HIGH, 1);
+        if(task) {
+            ++worker->highStreak;
+            return task;
+        }
+    }
+    worker->highStreak = 0;
+    task = worker->popPinned();
+    if(task) {
+        return task;
+    }
+    task = worker->pop();
+    if(task) {
+        return task;
+    }
+    task = popGlobal(worker, NORMAL, Worker::GLOBAL_BATCH);
+    if(task) {
+        return task;
+    }
+    //只剩HIGH时不受连续次数限制
+    task = popGlobal(worker, HIGH, 1);
+    if(task) {
+        return task;
+    }
+    task = popGlobal(worker, LOW, 1);
+    if(task) {
+        return task;
+    }
+    return steal(worker);
+}
+
+Task* Scheduler::steal(Worker* worker) {
+    size_t n = m_workers.size();
+    if(n <= 1) {
+        return nullptr;
+    }
+    //xorshift
+    worker->rand ^= worker->rand << 13;
+    worker->rand ^= worker->rand >> 17;
+    worker->rand ^= worker->rand << 5;
+    size_t start = worker->rand % n;
+    //第一轮只偷队列, 第二轮才偷runnext, 尽量保留对方的缓存局部性
+    for(int pass = 0; pass < 2; ++pass) {
+        for(size_t i = 0; i < n; ++i) {
+            Worker* victim = m_workers[(start + i) % n];
+            if(victim == worker) {
+                continue;
+            }
+            Task* task = worker->stealFrom(victim, pass == 1);
+            if(task) {
+                worker->steals.fetch_add(1, std::memory_order_relaxed);
+                return task;
+            }
+        }
+    }
+    return nullptr;
+}
+
+bool Scheduler::handoff(Fiber::ptr fiber) {
+    SYLAR_ASSERT(fiber);
+    Fiber::ptr cur = t_running;
+    bool direct = cur && GetThis() == this
+        && cur.get() == Fiber::GetThis().get()
+        && fiber != cur;
+    if(direct) {
+        if(fiber == t_handoff) {
+            //上一次交接让出的协程, 已在本线程就绪
+        } else if(fiber->getState() == Fiber::INIT) {
+            //从未运行过, 任何线程都可以切入
+        } else if(fiber->getState() != Fiber::HOLD
+                || fiber->m_lastMain != GetMainFiber()) {
+            //可能仍在其他线程上执行切出, 不能直接切入
+            direct = false;
+        }
+    }
+    if(direct && cur->m_shared && fiber->m_shared
+            && (!fiber->m_sharedStack
+                || fiber->m_sharedStack == cur->m_sharedStack)) {
+        //正在运行的协程占着这个共享栈, 无法换栈
+        direct = false;
+    }
+    if(!direct) {
+        if(fiber != t_handoff) {
+            schedule(fiber);
+        }
+        return false;
+    }
+
+    if(fiber == t_handoff) {
+        t_handoff.reset();
+    } else if(t_handoff) {
+        //只保留一个待继续的协程
+        schedule(t_handoff);
+        t_handoff.reset();
+    }
+    cur->m_state = Fiber::READY;
+    t_handoff = cur;
+    t_running = fiber;
+    if(t_worker) {
+        t_worker->beginSlice(fiber->getId());
+    }
+
+    //栈上不保留引用, 由t_handoff/t_running持有
+    Fiber* from = cur.get();
+    Fiber* to = fiber.get();
+    cur.reset();
+    fiber.reset();
+    from->swapTo(to);
+    return true;
 }
 
 void Scheduler::tickle() {
+    countTickle();
     SYLAR_LOG_INFO(g_logger) << "tickle";
 }
+
+void Scheduler::tickle(int thread) {
+    tickle();
+}
+
+Scheduler::Stats Scheduler::getStats(int thread) const {
+    Stats s;
+    for(int i = 0; i < PRIORITY_COUNT; ++i) {
+        s.queued[i] = m_queued[i];
+    }
+    s.activeThreads = m_activeThreadCount;
+    s.idleThreads = m_idleThreadCount;
+    s.threads = m_threadCount;
+    s.tickles = m_tickleCount;
+    //m_workers构造后不再变化, 可以不加锁遍历
+    for(auto& i : m_workers) {
+        if(thread != -1 && i->thread != thread) {
+            continue;
+        }
+        s.steals += i->steals;
+        s.idles += i->idles;
+        s.longSlices += i->longSlices;
+        s.fiberPoolHits += i->fiberPool.getHits();
+        s.fiberPoolMisses += i->fiberPool.getMisses();
+        s.fiberPoolRecycled += i->fiberPool.getRecycled();
+        s.fiberPooled += i->fiberPool.size();
+        Histogram::Snapshot h;
+        i->queueDelay.snapshot(h);
+        s.queueDelay.merge(h);
+        i->runTime.snapshot(h);
+        s.runTime.merge(h);
+    }
+    return s;
+}
+
+std::string Scheduler::Stats::toString() const {
+    std::stringstream ss;
+    ss << "queued=[" << queued[HIGH] << "," << queued[NORMAL] << "," << queued[LOW] << "]"
+       << " active=" << activeThreads
+       << " idle=" << idleThreads
+       << " threads=" << threads
+       << " tickles=" << tickles
+       << " steals=" << steals
+       << " idles=" << idles
+       << " long_slices=" << longSlices
+       << " fiber_pool={hits=" << fiberPoolHits
+       << " misses=" << fiberPoolMisses
+       << " recycled=" << fiberPoolRecycled
+       << " pooled=" << fiberPooled << "}"
+       << " queue_delay_ns={" << queueDelay.toString() << "}"
+       << " run_time_ns={" << runTime.toString() << "}";
+    return ss.str();
+}
+
 bool Scheduler::stopping() {
-    MutexType::Lock lock(m_mutex);
     return m_autostop && m_stopping
-        && m_fibers.empty() && m_activeThreadCount == 0;
+        && m_taskCount == 0 && m_activeThreadCount == 0
+        && m_pendingCount == 0;
 }
 void Scheduler::idle() {
     SYLAR_LOG_INFO(g_logger) << "idle";
-    while(!stopping()) {
+    while(!stopping() && !isRetiring()) {
         sylar::Fiber::YieldToHold();
     }
 }
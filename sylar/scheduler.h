@@ -13,11 +13,16 @@ N : M
 
 #include <memory>
 #include <vector>
-#include <list>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
 #include "fiber.h"
+#include "task.h"
+#include "histogram.h"
 #include "thread.h"
 #include "mutex.h"
 #include "log.h"
+#include "macro.h"
 
 namespace sylar {
 
@@ -25,10 +30,27 @@ class Scheduler {
 public:
     typedef std::shared_ptr<Scheduler> ptr;
     typedef Mutex MutexType;
+    //每个工作线程的本地队列, 定义见scheduler.cc
+    struct Worker;
+
+    /**
+     * @brief 任务优先级
+     * @details HIGH优先于其他任务执行, 连续执行一定数量后让出一次;
+     *          LOW只在没有其他任务时执行, 但每隔一定调度次数至少执行一个, 不会饿死.
+     *          HIGH和LOW的任务总是放入全局队列, 本地队列和runnext只放NORMAL
+     */
+    enum Priority {
+        HIGH = 0,
+        NORMAL = 1,
+        LOW = 2,
+        PRIORITY_COUNT = 3
+    };
 
     /**
      * @brief 协程调度器构造函数
-     * @param thread_num 线程数量
+     * @param thread_num 线程数量. 配置了scheduler.max_threads时为弹性模式的下限:
+     *        平均排队延迟持续超过scheduler.elastic_grow_delay时逐个加线程直到上限,
+     *        多出的线程空闲超过scheduler.elastic_idle_timeout后退出
      * @param use_caller main函数所处的线程是否纳入到协程调度器当中管理
      */
     Scheduler(size_t threads = 1, bool use_caller = true, const std::string& name = "");
@@ -42,6 +64,13 @@ public:
     //获取调度器的主协程-->与线程的主协程是不一样的
     static Fiber* GetMainFiber();
 
+    /**
+     * @brief 当前能否挂起等待被schedule唤醒
+     * @details 在调度器调度的协程中且允许让出; 线程主协程, 调度循环自己,
+     *          scheduleInline的回调中都不能挂起
+     */
+    static bool CanPark();
+
     //启动
     void start();
 
@@ -50,104 +79,289 @@ public:
 
     //单个线程放入
     template<class FiberOrCb>
-    void schedule(FiberOrCb fc, int thread = -1){
-        bool need_tickle = false;
-        {
-            MutexType::Lock lock(m_mutex);
-            need_tickle = scheduleNoLock(fc, thread);
-        }
-        if(need_tickle) {
+    void schedule(FiberOrCb fc, int thread = -1, Priority priority = NORMAL){
+        if(scheduleNoLock(fc, thread, false, priority)) {
             tickle();
         }
     }
 
-    //批量线程放入
+    //批量线程放入, 整批只加一次锁, 只tickle一次
     template<class InputIterator>
     void schedule(InputIterator begin, InputIterator end){
-        bool need_tickle = false;
-        {
-            MutexType::Lock lock(m_mutex);
-            while(begin != end) {
-                need_tickle = scheduleNoLock(&*begin, -1) || need_tickle;
-                ++begin;
+        TaskList tasks;
+        while(begin != end) {
+            Task* task = MakeTask(&*begin, -1);
+            if(task) {
+                tasks.push_back(task);
             }
+            ++begin;
+        }
+        if(enqueue(tasks)) {
+            tickle();
         }
-        if(need_tickle) {
+    }
+
+    /**
+     * @brief 放入不会让出的回调, 由调度循环在自己的栈上直接执行, 不切换协程
+     * @details 适合定时器, 唤醒协程这类很短且不阻塞的回调, 省去cb_fiber的切入切出.
+     *          回调中让出(包括调用会挂起的hook函数)会断言失败
+     */
+    template<class Cb>
+    void scheduleInline(Cb cb, int thread = -1) {
+        if(scheduleNoLock(cb, thread, true)) {
             tickle();
         }
     }
 
+    template<class InputIterator>
+    void scheduleInline(InputIterator begin, InputIterator end) {
+        TaskList tasks;
+        while(begin != end) {
+            Task* task = MakeTask(&*begin, -1, true);
+            if(task) {
+                tasks.push_back(task);
+            }
+            ++begin;
+        }
+        if(enqueue(tasks)) {
+            tickle();
+        }
+    }
+
+    /**
+     * @brief 从当前协程直接切换到fiber, 不经过调度主协程和任务队列
+     * @details 当前协程变为READY, fiber让出后由本线程的调度循环优先继续执行;
+     *          fiber必须处于挂起状态且调用者是它唯一的唤醒者(例如从等待队列中取出).
+     *          不在本调度器的协程中调用, fiber可能仍在其他线程上切出,
+     *          或与当前协程抢同一个共享栈时退化为schedule(fiber)
+     * @return 是否直接切换
+     */
+    bool handoff(Fiber::ptr fiber);
+
+    /**
+     * @brief 某个优先级排队中的任务数, 包括各线程本地队列和mailbox中的
+     * @details 用于观察混合负载下各优先级的队列深度
+     */
+    size_t getQueueSize(Priority priority) const { return m_queued[priority];}
+
+    /**
+     * @brief 协程挂起等待调度器之外的线程唤醒(例如OffloadPool)期间计数, 不为0时调度器不会停止
+     * @details 唤醒方先schedule再调用donePending
+     */
+    void addPending() { ++m_pendingCount;}
+    void donePending() {
+        //协程可能在这之前已经执行完, 线程看到计数不为0又睡下了, 停止时要再唤醒一次
+        if(--m_pendingCount == 0 && m_stopping) {
+            tickle();
+        }
+    }
+
+    /**
+     * @brief 调度器运行时统计
+     * @details 时间单位为ns. 配置scheduler.metrics为false时不记录两个直方图
+     */
+    struct Stats {
+        size_t queued[PRIORITY_COUNT] = {0};    //// 各优先级排队中的任务数
+        size_t activeThreads = 0;               //// 正在执行任务的线程数
+        size_t idleThreads = 0;                 //// 空闲的线程数
+        size_t threads = 0;                     //// 当前的工作线程数, 不含use_caller的线程
+        uint64_t tickles = 0;                   //// 唤醒空闲线程的次数
+        uint64_t steals = 0;                    //// 从其他线程偷到任务的次数
+        uint64_t idles = 0;                     //// 进入idle的次数
+        uint64_t longSlices = 0;                //// 看门狗发现的运行超时次数
+        uint64_t fiberPoolHits = 0;             //// 新协程从协程池中取到的次数
+        uint64_t fiberPoolMisses = 0;           //// 协程池空只能新建的次数
+        uint64_t fiberPoolRecycled = 0;         //// 结束的协程回收进协程池的次数
+        size_t fiberPooled = 0;                 //// 协程池中的协程数
+        Histogram::Snapshot queueDelay;         //// 从放入队列到开始执行
+        Histogram::Snapshot runTime;            //// 每次切入到让出的运行时长
+        std::string toString() const;
+    };
+
+    /**
+     * @brief 读取运行时统计, 不停止调度, 任何线程都可以调用
+     * @param[in] thread 为-1时合并所有工作线程, 否则只取该线程的steals/idles/直方图
+     */
+    Stats getStats(int thread = -1) const;
+
 protected:
     virtual void tickle();
+    /**
+     * @brief 只唤醒指定线程, 用于放入该线程mailbox的任务
+     * @details 默认退化为tickle()
+     */
+    virtual void tickle(int thread);
     void run();
     virtual bool stopping();
     virtual void idle();
 
     void setThis();
 
-    bool hasIdleThreads() { return m_idleThreadCount > 0;}
-private:
+    bool hasIdleThreads() {
+        //放入任务和读空闲数之间的全屏障, 和进入idle的线程先登记再检查任务配对, 不会漏掉唤醒
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        return m_idleThreadCount > 0;
+    }
+    /**
+     * @brief 当前线程是否可能取到任务: 全局队列, 本线程mailbox, 各线程的本地队列(可偷)
+     * @details idle()阻塞前登记为睡眠后再调用一次, 避免在tickle看到睡眠之前放入的任务上睡过去
+     */
+    bool hasTasks() const;
+    //弹性模式下当前线程是否要退出, idle()看到为true时应当返回, 让线程结束
+    bool isRetiring() const;
+    //弹性模式下空闲太久的线程能否退出, 线程持有不能转移的资源时重载返回false
+    virtual bool canRetire() const { return true;}
+    /**
+     * @brief 忙碌的工作线程每隔一定次数的调度调用一次, 不能阻塞
+     * @details 每个线程有独立事件源的子类重载, 收取本线程的就绪任务, 否则要等线程空闲才处理
+     */
+    virtual void poll() {}
+
+    //worker总数, 含use_caller线程的(下标0), 弹性模式按线程数上限, 构造后不再变化
+    size_t getWorkerCount() const { return m_workers.size();}
+    //当前线程在本调度器中的worker下标, 不是本调度器的工作线程返回-1
+    int getWorkerIndex() const;
+    //线程号对应的worker下标, 不属于本调度器返回-1
+    int getWorkerIndex(int thread) const;
+    //worker所属的线程, 弹性模式下没有线程的worker为-1
+    int getWorkerThread(size_t index) const;
+    //worker所属的线程是否阻塞在idle()中
+    bool isWorkerIdle(size_t index) const;
+    //是否是use_caller线程的worker, 该线程只在stop()时参与调度
+    bool isCallerWorker(size_t index) const { return m_rootFiber && index == 0;}
+
+    //tickle的实现真正发出唤醒时调用, 计入统计
+    void countTickle() { m_tickleCount.fetch_add(1, std::memory_order_relaxed);}
+
+    /**
+     * @brief 构造任务节点, 内容为空返回nullptr
+     * @param[in] inlined 是否是不会让出的回调, 见scheduleInline
+     */
     template<class FiberOrCb>
-    bool scheduleNoLock(FiberOrCb fc, int thread){
-        bool need_tickle = m_fibers.empty();
-        FiberAndThread ft(fc, thread);
-        if(ft.fiber || ft.cb) {
-            m_fibers.push_back(ft);
+    static Task* MakeTask(FiberOrCb fc, int thread, bool inlined = false
+                          ,Priority priority = NORMAL) {
+        Task* task = Task::Create();
+        if(!task->assign(std::move(fc))) {
+            Task::Destroy(task);
+            return nullptr;
+        }
+        SYLAR_ASSERT(!inlined || task->hasCallback());
+        task->thread = thread;
+        task->inlined = inlined;
+        task->priority = priority;
+        if(task->fiber && task->thread == -1) {
+            //共享栈协程的栈内容留在绑定线程的共享栈上, 只能回到该线程执行
+            task->thread = task->fiber->getBoundThread();
         }
-        return need_tickle;
+        return task;
     }
 
+    /**
+     * @brief 批量放入MakeTask构造的任务, 全局队列只加一次锁
+     * @details 在本调度器的工作线程上放入本线程队列(满了转全局队列), 否则放入全局队列,
+     *          指定线程的放入对应mailbox. 调用者根据返回值只tickle一次
+     * @return 是否需要tickle
+     */
+    bool enqueue(TaskList& tasks);
 private:
-    //调度器可以支持的协程：包括（函数，协程）
-    struct FiberAndThread {
-        Fiber::ptr fiber;
-        std::function<void()> cb;
-        int thread;
-
-        //指定协程是在那个线程上运行
-        FiberAndThread(Fiber::ptr f, int thr)
-            :fiber(f)
-            ,thread(thr){}
-
-        //指定协程是在那个线程上运行
-        //传入智能指针的形式用于管理内存，智能指针的智能指针的引用计数会减一
-        FiberAndThread(Fiber::ptr* f, int thr)
-            :thread(thr){
-            fiber.swap(*f);
-        }
-
-        //指定函数在那个线程上运行
-        FiberAndThread(std::function<void()> f, int thread)
-            :cb(f)
-            ,thread(thread){}
-
-        //指定函数在那个线程上运行
-        FiberAndThread(std::function<void()>* f, int thread)
-            :thread(thread){
-            cb.swap(*f);
+    //放入任务队列, 在本调度器的工作线程上放入本线程队列, 否则放入全局队列
+    template<class FiberOrCb>
+    bool scheduleNoLock(FiberOrCb fc, int thread, bool inlined = false
+                        ,Priority priority = NORMAL){
+        Task* task = MakeTask(std::move(fc), thread, inlined, priority);
+        if(!task) {
+            return false;
         }
+        return enqueue(task, false);
+    }
 
-        //默认构造函数
-        FiberAndThread()
-            :thread(-1){}
-
-        void reset() {
-            fiber = nullptr;
-            cb = nullptr;
-            thread = -1;
-        }        
-    };
+    /**
+     * @brief 放入任务
+     * @param[in] yield 是否是主动让出的协程, 是则排到本地队列尾部而不是runnext
+     * @return 是否需要tickle
+     */
+    bool enqueue(Task* task, bool yield);
+    //放回主动让出(READY)的协程
+    void requeue(Fiber::ptr fiber);
+    //按优先级放入全局队列, 返回放入前是否全部为空
+    bool pushGlobal(Task* task);
+    //放入指定线程的mailbox, 只唤醒该线程
+    bool pushPinned(Task* task);
+    //在NUMA节点node上创建/销毁worker, node小于0时普通new
+    Worker* newWorker(int node);
+    void deleteWorker(Worker* worker);
+    //第i个创建的线程的worker所在的NUMA节点
+    int workerNode(size_t i) const;
+    //弹性模式: 用空闲的worker再创建一个线程
+    bool addThread();
+    //弹性模式: 在工作线程上判断是否空闲太久该退出, 是则从线程数中去掉
+    bool retire(Worker* worker);
+    //取消retire, idle()没有响应isRetiring时使用
+    void cancelRetire(Worker* worker);
+    //退出的线程把剩余任务转到全局队列, 空出worker
+    void releaseWorker(Worker* worker);
+    //回收已退出的线程
+    void joinRetired();
+    /**
+     * @brief 弹性模式: 由看门狗线程每个周期调用, 回收退出的线程, 排队延迟持续偏高时加一个线程
+     * @param[in,out] count, sum 上个周期各线程排队延迟直方图的样本数和总和
+     * @param[in,out] streak 连续偏高的周期数
+     */
+    void adjustThreads(uint64_t& count, uint64_t& sum, uint32_t& streak);
+    //线程号对应的worker, 不属于本调度器返回nullptr
+    Worker* getWorker(int thread);
+    /**
+     * @brief 从某个优先级的全局队列取任务
+     * @details 一次加锁最多取max个(不超过平均每个线程的份额), 返回第一个,
+     *          其余放入worker的本地队列, 因此max大于1只能用于NORMAL
+     */
+    Task* popGlobal(Worker* worker, Priority priority, size_t max);
+    //依次从HIGH, mailbox, 本地队列, 全局队列, LOW, 其他线程取任务
+    Task* dequeue(Worker* worker);
+    //从随机的其他线程偷一半任务
+    Task* steal(Worker* worker);
+    /**
+     * @brief 看门狗线程, 每threshold_ms / 4采样一次各线程正在执行的协程
+     * @details 同一次切入运行超过threshold_ms时, 用信号抓取该线程的调用栈并打印.
+     *          弹性模式下同时负责加线程和回收退出的线程, threshold_ms为0时只做这个
+     */
+    void watchdog(uint32_t threshold_ms);
+    //停止并等待看门狗线程
+    void stopWatchdog();
 
 private:
     MutexType m_mutex;
     std::vector<Thread::ptr> m_threads;
-    std::list<FiberAndThread> m_fibers;
+    //全局队列, 每个优先级一个: 外部线程放入的, 本地队列溢出的, HIGH和LOW的任务;
+    //指定线程的任务在各线程的mailbox
+    TaskList m_fibers[PRIORITY_COUNT];
+    std::atomic<size_t> m_globalCount[PRIORITY_COUNT];
+    //各工作线程的本地队列, 构造时按线程数分配, 配置了绑核时分配在线程所在的NUMA节点
+    std::vector<Worker*> m_workers;
+    //scheduler.affinity配置的CPU, 创建的第i个线程绑定到m_cpus[i % size], 为空不绑定
+    std::vector<int> m_cpus;
+    //所有队列中的任务数
+    std::atomic<size_t> m_taskCount {0};
+    //各优先级在所有队列中的任务数
+    std::atomic<size_t> m_queued[PRIORITY_COUNT];
+    std::atomic<uint64_t> m_tickleCount {0};
+    //见addPending
+    std::atomic<size_t> m_pendingCount {0};
+    //弹性模式的线程数上限, 等于m_minThreads时线程数固定
+    size_t m_minThreads = 0;
+    size_t m_maxThreads = 0;
+    //看门狗, scheduler.watchdog_threshold为0且不是弹性模式时不启动
+    Thread::ptr m_watchdog;
+    std::mutex m_watchdogMutex;
+    std::condition_variable m_watchdogCond;
+    bool m_watchdogStop = false;
     Fiber::ptr m_rootFiber;             //主协程
     std::string m_name;
 
 protected:
     std::vector<int> m_threadIds;
-    size_t m_threadCount = 0;
+    //当前的工作线程数, 弹性模式下会变, 修改时持有m_mutex
+    std::atomic<size_t> m_threadCount {0};
     std::atomic<size_t> m_activeThreadCount {0};
     std::atomic<size_t> m_idleThreadCount {0};
     bool m_stopping = true;
@@ -0,0 +1,203 @@
+#include "stack_allocator.h"
+#include "config.h"
+#include "log.h"
+#include "macro.h"
+#include "numa.h"
+
+#include <sys/mman.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <atomic>
+#include <vector>
+
+namespace sylar {
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("system");
+
+static ConfigVar<std::string>::ptr g_fiber_stack_allocator =
+    Config::Lookup<std::string>("fiber.stack_allocator", "pooled"
+            , "fiber stack allocator, malloc or pooled");
+
+static ConfigVar<uint32_t>::ptr g_fiber_stack_pool_size =
+    Config::Lookup<uint32_t>("fiber.stack_pool_size", 64
+            , "max recycled fiber stacks cached per thread");
+
+static std::atomic<int> s_type(StackAllocator::POOLED);
+static std::atomic<uint32_t> s_pool_size(64);
+
+static std::atomic<uint64_t> s_allocs(0);
+static std::atomic<uint64_t> s_frees(0);
+static std::atomic<uint64_t> s_pool_hits(0);
+static std::atomic<uint64_t> s_pool_misses(0);
+static std::atomic<uint64_t> s_mapped_bytes(0);
+static std::atomic<uint64_t> s_resident_bytes(0);
+
+static StackAllocator::Type ParseType(const std::string& v) {
+    if(v == "malloc") {
+        return StackAllocator::MALLOC;
+    }
+    if(v != "pooled") {
+        SYLAR_LOG_ERROR(g_logger) << "invalid fiber.stack_allocator=" << v
+            << ", use pooled";
+    }
+    return StackAllocator::POOLED;
+}
+
+namespace {
+struct _StackAllocatorIniter {
+    _StackAllocatorIniter() {
+        s_type = ParseType(g_fiber_stack_allocator->getValue());
+        s_pool_size = g_fiber_stack_pool_size->getValue();
+
+        g_fiber_stack_allocator->addListener(
+                [](const std::string& ov, const std::string& nv){
+                SYLAR_LOG_INFO(g_logger) << "fiber.stack_allocator changed from "
+                                         << ov << " to " << nv;
+                s_type = ParseType(nv);
+        });
+
+        g_fiber_stack_pool_size->addListener(
+                [](const uint32_t& ov, const uint32_t& nv){
+                s_pool_size = nv;
+        });
+    }
+};
+
+static _StackAllocatorIniter _init;
+}
+
+static size_t GetPageSize() {
+    static size_t s_page_size = sysconf(_SC_PAGESIZE);
+    return s_page_size;
+}
+
+// 栈大小按页对齐, 再加一个保护页
+static size_t MappedSize(size_t size) {
+    size_t page = GetPageSize();
+    return (size + page - 1) / page * page + page;
+}
+
+static void* MapStack(size_t size) {
+    size_t len = MappedSize(size);
+    void* base = mmap(nullptr, len, PROT_READ | PROT_WRITE
+                      ,MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+    if(base == MAP_FAILED) {
+        SYLAR_LOG_ERROR(g_logger) << "mmap fiber stack fail size=" << len
+            << " errno=" << errno << " errstr=" << strerror(errno);
+        return nullptr;
+    }
+    //线程绑了核时栈页放在所在节点上, 不管首次访问是创建者还是执行者
+    Numa::Bind(base, len, Numa::GetCurrentNode());
+    if(mprotect(base, GetPageSize(), PROT_NONE)) {
+        SYLAR_LOG_ERROR(g_logger) << "mprotect fiber stack guard page fail errno="
+            << errno << " errstr=" << strerror(errno);
+    }
+    s_mapped_bytes += len;
+    return (char*)base + GetPageSize();
+}
+
+static void UnmapStack(void* vp, size_t size) {
+    size_t len = MappedSize(size);
+    munmap((char*)vp - GetPageSize(), len);
+    s_mapped_bytes -= len;
+}
+
+/**
+ * @brief 线程本地的空闲栈链表, 按栈大小分组
+ * @details 通常所有协程都用fiber.stack_size, 只会有一组
+ */
+struct StackCache {
+    struct List {
+        size_t size;
+        std::vector<void*> stacks;
+    };
+
+    ~StackCache();
+
+    std::vector<void*>* get(size_t size, bool auto_create) {
+        for(auto& i : lists) {
+            if(i.size == size) {
+                return &i.stacks;
+            }
+        }
+        if(!auto_create) {
+            return nullptr;
+        }
+        lists.push_back(List());
+        lists.back().size = size;
+        return &lists.back().stacks;
+    }
+
+    std::vector<List> lists;
+};
+
+// 线程退出时t_stack_cache先于部分协程析构, 之后释放的栈直接munmap
+static thread_local bool t_stack_cache_dead = false;
+static thread_local StackCache t_stack_cache;
+
+StackCache::~StackCache() {
+    t_stack_cache_dead = true;
+    for(auto& i : lists) {
+        for(auto& vp : i.stacks) {
+            s_resident_bytes -= MappedSize(i.size);
+            UnmapStack(vp, i.size);
+        }
+    }
+    lists.clear();
+}
+
+void* StackAllocator::Alloc(size_t size, Type& type) {
+    ++s_allocs;
+    type = (Type)s_type.load(std::memory_order_relaxed);
+    if(type == MALLOC) {
+        return malloc(size);
+    }
+
+    if(!t_stack_cache_dead) {
+        std::vector<void*>* stacks = t_stack_cache.get(size, false);
+        if(stacks && !stacks->empty()) {
+            void* vp = stacks->back();
+            stacks->pop_back();
+            s_resident_bytes -= MappedSize(size);
+            ++s_pool_hits;
+            return vp;
+        }
+    }
+    ++s_pool_misses;
+    return MapStack(size);
+}
+
+void StackAllocator::Dealloc(void* vp, size_t size, Type type) {
+    ++s_frees;
+    if(type == MALLOC) {
+        free(vp);
+        return;
+    }
+
+    if(!t_stack_cache_dead) {
+        std::vector<void*>* stacks = t_stack_cache.get(size, true);
+        if(stacks->size() < s_pool_size.load(std::memory_order_relaxed)) {
+            stacks->push_back(vp);
+            s_resident_bytes += MappedSize(size);
+            return;
+        }
+    }
+    UnmapStack(vp, size);
+}
+
+StackAllocator::Type StackAllocator::GetType() {
+    return (Type)s_type.load(std::memory_order_relaxed);
+}
+
+StackAllocator::Stats StackAllocator::GetStats() {
+    Stats s;
+    s.allocs = s_allocs;
+    s.frees = s_frees;
+    s.pool_hits = s_pool_hits;
+    s.pool_misses = s_pool_misses;
+    s.mapped_bytes = s_mapped_bytes;
+    s.resident_bytes = s_resident_bytes;
+    return s;
+}
+
+}
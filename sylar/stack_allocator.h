@@ -0,0 +1,67 @@
+#ifndef __SYLAR_STACK_ALLOCATOR_H__
+#define __SYLAR_STACK_ALLOCATOR_H__
+
+/*
+  协程栈分配器
+
+  fiber.stack_allocator = malloc : 每个协程直接malloc/free
+  fiber.stack_allocator = pooled : mmap分配, 栈的低地址端放一个PROT_NONE保护页,
+                                   栈溢出直接SIGSEGV而不是踩坏相邻内存;
+                                   释放的栈放回线程本地空闲链表, 下次同尺寸分配直接复用;
+                                   线程绑了核(scheduler.affinity)时栈绑定到所在的NUMA节点
+
+  |<- guard page ->|<------------- stack size ------------->|
+  |   PROT_NONE    |        PROT_READ | PROT_WRITE          |
+  ^ mmap base      ^ Alloc()返回值                  栈顶(高地址) ^
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace sylar {
+
+class StackAllocator {
+public:
+    enum Type {
+        MALLOC = 0,         //// malloc/free
+        POOLED = 1          //// mmap + 保护页 + 线程本地复用
+    };
+
+    struct Stats {
+        uint64_t allocs = 0;            //// 分配次数
+        uint64_t frees = 0;             //// 释放次数
+        uint64_t pool_hits = 0;         //// 从空闲链表取到栈的次数
+        uint64_t pool_misses = 0;       //// 空闲链表为空, 需要重新mmap的次数
+        uint64_t mapped_bytes = 0;      //// 当前mmap映射的栈字节数(含保护页, 含空闲链表中的)
+        uint64_t resident_bytes = 0;    //// 空闲链表中保留的栈字节数(页不归还内核, 常驻内存)
+
+        // 命中率
+        double hitRate() const {
+            uint64_t total = pool_hits + pool_misses;
+            return total ? (double)pool_hits / total : 0;
+        }
+    };
+
+    /**
+     * @brief 分配协程栈
+     * @param[in] size 栈大小
+     * @param[out] type 实际使用的后端, 释放时原样传回
+     * @return 栈的低地址
+     */
+    static void* Alloc(size_t size, Type& type);
+
+    /**
+     * @brief 释放协程栈, 可以在任意线程释放
+     */
+    static void Dealloc(void* vp, size_t size, Type type);
+
+    // 当前配置的后端
+    static Type GetType();
+
+    // 获取统计信息, 各项计数为全局原子变量, 读取不加锁
+    static Stats GetStats();
+};
+
+}
+
+#endif
@@ -0,0 +1,118 @@
+#include "task.h"
+#include "mutex.h"
+
+#include <atomic>
+
+namespace sylar {
+
+// 线程本地空闲链表的上限, 超过后一半转到全局链表
+static const size_t LOCAL_CACHE_MAX = 256;
+// 全局空闲链表的上限, 超过后直接释放
+static const size_t GLOBAL_CACHE_MAX = 64 * 1024;
+
+static std::atomic<uint64_t> s_mallocs(0);
+
+/**
+ * @brief 全局空闲链表
+ * @details 任务通常在一个线程放入, 在另一个线程执行完回收,
+ *          只生产的线程(比如accept线程)要从这里取回其他线程回收的节点
+ */
+struct GlobalTaskCache {
+    typedef Spinlock MutexType;
+
+    ~GlobalTaskCache() {
+        while(Task* task = free.pop_front()) {
+            ::operator delete((void*)task);
+        }
+    }
+
+    MutexType mutex;
+    TaskList free;
+};
+
+static GlobalTaskCache& GetGlobalCache() {
+    static GlobalTaskCache s_cache;
+    return s_cache;
+}
+
+struct LocalTaskCache {
+    ~LocalTaskCache();
+
+    TaskList free;
+};
+
+// 线程退出时t_task_cache先于部分任务析构, 之后回收的节点直接释放
+static thread_local bool t_task_cache_dead = false;
+static thread_local LocalTaskCache t_task_cache;
+
+LocalTaskCache::~LocalTaskCache() {
+    t_task_cache_dead = true;
+    GlobalTaskCache& global = GetGlobalCache();
+    GlobalTaskCache::MutexType::Lock lock(global.mutex);
+    while(Task* task = free.pop_front()) {
+        if(global.free.size < GLOBAL_CACHE_MAX) {
+            global.free.push_back(task);
+        } else {
+            ::operator delete((void*)task);
+        }
+    }
+}
+
+Task* Task::Create() {
+    void* vp = nullptr;
+    if(!t_task_cache_dead) {
+        TaskList& local = t_task_cache.free;
+        if(local.empty()) {
+            GlobalTaskCache& global = GetGlobalCache();
+            GlobalTaskCache::MutexType::Lock lock(global.mutex);
+            for(size_t i = 0; i < LOCAL_CACHE_MAX / 2 && !global.free.empty(); ++i) {
+                local.push_back(global.free.pop_front());
+            }
+        }
+        vp = local.pop_front();
+    }
+    if(!vp) {
+        ++s_mallocs;
+        vp = ::operator new(sizeof(Task));
+    }
+    return new (vp) Task();
+}
+
+void Task::Destroy(Task* task) {
+    task->~Task();
+    if(t_task_cache_dead) {
+        ::operator delete((void*)task);
+        return;
+    }
+    TaskList& local = t_task_cache.free;
+    local.push_back(task);
+    if(local.size <= LOCAL_CACHE_MAX) {
+        return;
+    }
+
+    TaskList spill;
+    while(local.size > LOCAL_CACHE_MAX / 2) {
+        spill.push_back(local.pop_front());
+    }
+    GlobalTaskCache& global = GetGlobalCache();
+    {
+        GlobalTaskCache::MutexType::Lock lock(global.mutex);
+        while(global.free.size < GLOBAL_CACHE_MAX && !spill.empty()) {
+            global.free.push_back(spill.pop_front());
+        }
+    }
+    while(Task* t = spill.pop_front()) {
+        ::operator delete((void*)t);
+    }
+}
+
+Task::Stats Task::GetStats() {
+    Stats s;
+    s.mallocs = s_mallocs;
+    GlobalTaskCache& global = GetGlobalCache();
+    GlobalTaskCache::MutexType::Lock lock(global.mutex);
+    s.cached = global.free.size;
+    return s;
+}
+
+}
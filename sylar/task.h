@@ -0,0 +1,228 @@
+#ifndef __SYLAR_TASK_H__
+#define __SYLAR_TASK_H__
+
+/*
+  调度器的任务节点
+
+  原来每次schedule都要构造FiberAndThread(Fiber::ptr + std::function),
+  再拷贝进std::list节点, 一次调度好几次malloc.
+  Task是侵入式链表节点, 回调直接构造在节点内的小缓冲区里,
+  节点用完回收到线程本地的空闲链表, 稳定状态下调度和执行都不分配内存
+*/
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include "fiber.h"
+#include "noncopyable.h"
+
+namespace sylar {
+
+/**
+ * @brief 调度任务, 协程或回调二选一
+ * @details 只能通过Create/Destroy创建和回收, 不可拷贝
+ */
+class Task : Noncopyable {
+public:
+    //回调小于这个大小时直接存放在节点内
+    static const size_t INLINE_SIZE = 64;
+
+    /**
+     * @brief 从当前线程的空闲链表取一个空节点
+     */
+    static Task* Create();
+
+    /**
+     * @brief 析构节点中的协程和回调, 回收到当前线程的空闲链表
+     */
+    static void Destroy(Task* task);
+
+    /**
+     * @brief 空闲链表的统计
+     */
+    struct Stats {
+        uint64_t mallocs = 0;   //// 空闲链表为空时新分配的节点数
+        uint64_t cached = 0;    //// 全局空闲链表中的节点数
+    };
+    static Stats GetStats();
+
+    /**
+     * @brief 设置任务内容, 内容为空返回false
+     * @details 传指针时交换走其中的内容, 与原来FiberAndThread的语义一致
+     */
+    bool assign(Fiber::ptr&& f) {
+        fiber.swap(f);
+        return (bool)fiber;
+    }
+
+    bool assign(Fiber::ptr* f) {
+        fiber.swap(*f);
+        return (bool)fiber;
+    }
+
+    bool assign(std::function<void()>&& cb) {
+        if(!cb) {
+            return false;
+        }
+        setCallback(std::move(cb));
+        return true;
+    }
+
+    bool assign(std::function<void()>* cb) {
+        if(!*cb) {
+            return false;
+        }
+        setCallback(std::move(*cb));
+        *cb = nullptr;
+        return true;
+    }
+
+    bool assign(std::nullptr_t) { return false;}
+
+    template<class F>
+    bool assign(F&& f) {
+        //空函数指针和原来std::function一样丢弃
+        if(IsNull(f)) {
+            return false;
+        }
+        setCallback(std::forward<F>(f));
+        return true;
+    }
+
+    // 是否是回调任务
+    bool hasCallback() const { return m_invoke != nullptr;}
+
+    // 执行回调
+    void invoke() { m_invoke(data());}
+
+    // 析构回调
+    void resetCallback() {
+        if(m_destroy) {
+            m_destroy(data());
+            m_destroy = nullptr;
+        }
+        m_invoke = nullptr;
+    }
+
+public:
+    Task* next = nullptr;       //// 所在队列的下一个节点
+    int thread = -1;            //// 指定执行的线程, -1表示任意线程
+    bool inlined = false;       //// 回调不会让出, 在调度循环的栈上直接执行
+    int priority = 1;           //// 优先级, 见Scheduler::Priority, 默认NORMAL
+    uint64_t enqueueTime = 0;   //// 放入队列的时间(单调时钟ns), 0表示不统计
+    Fiber::ptr fiber;           //// 协程任务
+
+private:
+    Task() {}
+    ~Task() { resetCallback();}
+
+    void* data() { return m_heap ? m_ptr : (void*)&m_buf;}
+
+    template<class Fn>
+    static bool IsNull(const Fn&) { return false;}
+
+    template<class R, class... Args>
+    static bool IsNull(R (*f)(Args...)) { return f == nullptr;}
+
+    template<class F>
+    void setCallback(F&& f) {
+        typedef typename std::decay<F>::type Fn;
+        setCallback<Fn>(std::forward<F>(f), std::integral_constant<bool,
+                sizeof(Fn) <= INLINE_SIZE
+                && alignof(Fn) <= alignof(std::max_align_t)>());
+    }
+
+    //放在节点内
+    template<class Fn, class F>
+    void setCallback(F&& f, std::true_type) {
+        new (&m_buf) Fn(std::forward<F>(f));
+        m_heap = false;
+        m_invoke = &Invoke<Fn>;
+        m_destroy = &DestroyInline<Fn>;
+    }
+
+    //太大的回调放到堆上
+    template<class Fn, class F>
+    void setCallback(F&& f, std::false_type) {
+        m_ptr = new Fn(std::forward<F>(f));
+        m_heap = true;
+        m_invoke = &Invoke<Fn>;
+        m_destroy = &DestroyHeap<Fn>;
+    }
+
+    template<class Fn>
+    static void Invoke(void* p) { (*(Fn*)p)();}
+
+    template<class Fn>
+    static void DestroyInline(void* p) { ((Fn*)p)->~Fn();}
+
+    template<class Fn>
+    static void DestroyHeap(void* p) { delete (Fn*)p;}
+
+private:
+    void (*m_invoke)(void*) = nullptr;
+    void (*m_destroy)(void*) = nullptr;
+    bool m_heap = false;
+    union {
+        typename std::aligned_storage<INLINE_SIZE, alignof(std::max_align_t)>::type m_buf;
+        void* m_ptr;
+    };
+};
+
+/**
+ * @brief Task的侵入式FIFO链表, 不加锁
+ */
+struct TaskList {
+    bool empty() const { return head == nullptr;}
+
+    void push_back(Task* task) {
+        task->next = nullptr;
+        if(tail) {
+            tail->next = task;
+        } else {
+            head = task;
+        }
+        tail = task;
+        ++size;
+    }
+
+    // 把other整个接到尾部
+    void splice(TaskList& other) {
+        if(other.empty()) {
+            return;
+        }
+        if(tail) {
+            tail->next = other.head;
+        } else {
+            head = other.head;
+        }
+        tail = other.tail;
+        size += other.size;
+        other.head = other.tail = nullptr;
+        other.size = 0;
+    }
+
+    Task* pop_front() {
+        Task* task = head;
+        if(task) {
+            head = task->next;
+            if(!head) {
+                tail = nullptr;
+            }
+            task->next = nullptr;
+            --size;
+        }
+        return task;
+    }
+
+    Task* head = nullptr;
+    Task* tail = nullptr;
+    size_t size = 0;
+};
+
+}
+
+#endif
@@ -8,6 +8,10 @@ static sylar::ConfigVar<uint64_t>::ptr g_tcp_server_read_timeout =
     sylar::Config::Lookup("tcp_server.read_timeout", (uint64_t)(60 * 1000 * 2),
             "tcp server read timeout");
 
+static sylar::ConfigVar<bool>::ptr g_tcp_server_shared_stack =
+    sylar::Config::Lookup("tcp_server.shared_stack", false,
+            "tcp server run client fibers on shared stacks");
+
 static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("system");
 
 TcpServer::TcpServer(sylar::IOManager* woker,
@@ -16,7 +20,8 @@ TcpServer::TcpServer(sylar::IOManager* woker,
     ,m_acceptWorker(accept_woker)
     ,m_recvTimeout(g_tcp_server_read_timeout->getValue())
     ,m_name("sylar/1.0.0")
-    ,m_isStop(true) {
+    ,m_isStop(true)
+    ,m_sharedStack(g_tcp_server_shared_stack->getValue()) {
 }
 
 TcpServer::~TcpServer() {
@@ -70,8 +75,13 @@ void TcpServer::startAccept(Socket::ptr sock) {
         Socket::ptr client = sock->accept();
         if(client) {
             client->setRecvTimeout(m_recvTimeout);
-            m_worker->schedule(std::bind(&TcpServer::handleClient,
+            if(m_sharedStack) {
+                m_worker->schedule(Fiber::ptr(new Fiber(std::bind(&TcpServer::handleClient,
+                        shared_from_this(), client), 0, false, true)));
+            } else {
+                m_worker->schedule(std::bind(&TcpServer::handleClient,
                         shared_from_this(), client));
+            }
         } else {
             SYLAR_LOG_ERROR(g_logger) << "accept errno=" << errno
                 << " errstr=" << strerror(errno);
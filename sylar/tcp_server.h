@@ -31,6 +31,9 @@ public:
     std::string getName() const { return m_name;}
     void setRecvTimeout(uint64_t v) { m_recvTimeout = v;}
     void setName(const std::string& v) { m_name = v;}
+    /// 连接协程是否运行在共享栈上, 大量空闲长连接时节省内存
+    bool isSharedStack() const { return m_sharedStack;}
+    void setSharedStack(bool v) { m_sharedStack = v;}
 
     bool isStop() const { return m_isStop;}
 protected:
@@ -49,6 +52,8 @@ private:
     std::string m_name;
     /// 是否停止
     bool m_isStop;
+    /// 连接协程使用共享栈
+    bool m_sharedStack;
 };
 
 }
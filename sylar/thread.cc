@@ -8,6 +8,8 @@ namespace sylar {
 static thread_local Thread* t_thread = nullptr;
 //定义线程局部变量指向【当前线程】的线程名称
 static thread_local std::string t_thread_name = "UNKNOW";
+//当前线程绑定的CPU
+static thread_local int t_cpu = -1;
 
 
 static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("system");
@@ -29,9 +31,32 @@ void Thread::SetName(const std::string& name) {
     t_thread_name = name;
 }
 
-Thread::Thread(std::function<void()> cb, const std::string& name)
+bool Thread::SetAffinity(int cpu) {
+    if(cpu < 0 || cpu >= CPU_SETSIZE) {
+        SYLAR_LOG_ERROR(g_logger) << "invalid cpu=" << cpu;
+        return false;
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    int rt = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if(rt) {
+        SYLAR_LOG_ERROR(g_logger) << "pthread_setaffinity_np fail, rt=" << rt
+                << " cpu=" << cpu << " name=" << t_thread_name;
+        return false;
+    }
+    t_cpu = cpu;
+    return true;
+}
+
+int Thread::GetCpu() {
+    return t_cpu;
+}
+
+Thread::Thread(std::function<void()> cb, const std::string& name, int cpu)
     :m_cb(cb)
-    ,m_name(name) {
+    ,m_name(name)
+    ,m_cpu(cpu) {
     if(name.empty()) {
         m_name = "UNKNOW";
     }
@@ -72,6 +97,10 @@ void* Thread::run(void* argc) {
     thread->m_id = sylar::GetThreadId();
     //给线程命名
     pthread_setname_np(pthread_self(), thread->m_name.substr(0, 15).c_str());
+    //先绑核, 之后本线程首次访问的内存都分配在所在节点上
+    if(thread->m_cpu >= 0 && !SetAffinity(thread->m_cpu)) {
+        thread->m_cpu = -1;
+    }
 
     std::function<void()> cb;
     cb.swap(thread->m_cb);
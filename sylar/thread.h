@@ -14,11 +14,16 @@ namespace sylar {
 class Thread {
 public:
     typedef std::shared_ptr<Thread> ptr;
-    Thread(std::function<void()> cb, const std::string& name);
+    /**
+     * @brief 创建并启动线程
+     * @param[in] cpu 大于等于0时线程开始执行cb前绑定到该CPU
+     */
+    Thread(std::function<void()> cb, const std::string& name, int cpu = -1);
     ~Thread();
 
     pid_t getId() const { return m_id;}
     const std::string& getName() const { return m_name;}
+    int getCpu() const { return m_cpu;}
 
     void join();
 
@@ -28,6 +33,13 @@ public:
     static const std::string& GetName();
     //设置当前线程名称
     static void SetName(const std::string& name);
+    /**
+     * @brief 把当前线程绑定到一个CPU
+     * @return 失败返回false, 线程保持原来的亲和性
+     */
+    static bool SetAffinity(int cpu);
+    //当前线程绑定的CPU, 没有绑定返回-1
+    static int GetCpu();
 private:
     //C++11 禁止默认拷贝
     Thread(const Thread&) = delete;
@@ -42,6 +54,7 @@ private:
     pthread_t m_thread = 0;
     std::function<void()> m_cb;
     std::string m_name;
+    int m_cpu = -1;
 
     Semaphore m_semaphore;
 };
@@ -19,8 +19,9 @@ bool Timer::Comparator::operator()(const Timer::ptr& lhs, const Timer::ptr& rhs)
 
 
 Timer::Timer(uint64_t ms, std::function<void()> cb,
-          bool recurring, TimerManager* manager)
+          bool recurring, TimerManager* manager, bool inlined)
     :m_recurring(recurring)
+    ,m_inlined(inlined)
     ,m_ms(ms)
     ,m_cb(cb)
     ,m_manager(manager) {
@@ -90,8 +91,9 @@ TimerManager::~TimerManager() {
 
 }
 
-Timer::ptr TimerManager::addTimer(uint64_t ms, std::function<void()> cb, bool recurring) {
-    Timer::ptr timer(new Timer(ms, cb, recurring, this));
+Timer::ptr TimerManager::addTimer(uint64_t ms, std::function<void()> cb, bool recurring
+                                  ,bool inlined) {
+    Timer::ptr timer(new Timer(ms, cb, recurring, this, inlined));
     RWMutex::WriteLock lock(m_mutex);
     addTimer(timer, lock);
 
@@ -107,8 +109,8 @@ static void OnTimer(std::weak_ptr<void> weak_cond, std::function<void()> cb) {
     }
 }
 Timer::ptr TimerManager::addConditionTimer(uint64_t ms, std::function<void()> cb
-               ,std::weak_ptr<void> weak_cond, bool recurring) {
-    return addTimer(ms, std::bind(&OnTimer, weak_cond, cb), recurring);
+               ,std::weak_ptr<void> weak_cond, bool recurring, bool inlined) {
+    return addTimer(ms, std::bind(&OnTimer, weak_cond, cb), recurring, inlined);
 }
 
 uint64_t TimerManager::getNextTimer() {
@@ -130,6 +132,11 @@ uint64_t TimerManager::getNextTimer() {
 }
 
 void TimerManager::listExpiredCb(std::vector<std::function<void()> >& cbs) {
+    listExpiredCb(cbs, cbs);
+}
+
+void TimerManager::listExpiredCb(std::vector<std::function<void()> >& cbs
+                                 ,std::vector<std::function<void()> >& inline_cbs) {
     uint64_t now_ms = sylar::GetCurrentMS();
     std::vector<Timer::ptr> expired;
     {
@@ -157,7 +164,11 @@ void TimerManager::listExpiredCb(std::vector<std::function<void()> >& cbs) {
     cbs.reserve(expired.size());
 
     for(auto& timer : expired) {
-        cbs.push_back(timer->m_cb);
+        if(timer->m_inlined) {
+            inline_cbs.push_back(timer->m_cb);
+        } else {
+            cbs.push_back(timer->m_cb);
+        }
         if(timer->m_recurring) {
             timer->m_next = now_ms + timer->m_ms;
             m_timers.insert(timer);
@@ -34,15 +34,18 @@ private:
      * @param[in] cb 定时器回调函数
      * @param[in] recurring 是否循环执行
      * @param[in] manager 定时器管理器
+     * @param[in] inlined 回调是否不会让出, 见Scheduler::scheduleInline
      */
     Timer(uint64_t ms, std::function<void()> cb,
-          bool recurring, TimerManager* manager);
+          bool recurring, TimerManager* manager, bool inlined = false);
 
     Timer(uint64_t next);
 
 private:
     // 是否循环
     bool m_recurring = false;
+    // 回调不会让出, 到期后不用放到协程里执行
+    bool m_inlined = false;
     // 定时周期
     uint64_t m_ms = 0;
     // 精确的执行时间 11：55：28
@@ -72,23 +75,30 @@ public:
      * @param[in] ms 定时器执行间隔时间
      * @param[in] cb 定时器回调函数
      * @param[in] recurring 是否循环执行
+     * @param[in] inlined 回调很短且不会让出, 到期后由调度循环直接执行
      */
-    Timer::ptr addTimer(uint64_t ms, std::function<void()> cb, bool recurring = false);
+    Timer::ptr addTimer(uint64_t ms, std::function<void()> cb, bool recurring = false
+               ,bool inlined = false);
 
     /**
      * @brief 添加条件定时器
      * @param[in] ms 定时器执行间隔时间
      * @param[in] cb 定时器回调函数
      * @param[in] weak_cond 条件定时器依赖条件
+     * @param[in] inlined 回调很短且不会让出, 到期后由调度循环直接执行
      */
     Timer::ptr addConditionTimer(uint64_t ms, std::function<void()> cb
-               ,std::weak_ptr<void> weak_cond, bool recurring = false);
+               ,std::weak_ptr<void> weak_cond, bool recurring = false
+               ,bool inlined = false);
 
     // 获取下一个定时器的执行时间
     uint64_t getNextTimer();
 
     // 返回超时以及需要执行的Timer的回调函数
     void listExpiredCb(std::vector<std::function<void()> >& cbs);
+    // 同上, 不会让出的回调单独放到inline_cbs
+    void listExpiredCb(std::vector<std::function<void()> >& cbs
+                       ,std::vector<std::function<void()> >& inline_cbs);
 
     // 是否有定时器
     bool hasTimer();
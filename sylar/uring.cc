@@ -0,0 +1,187 @@
+#include "uring.h"
+#include "log.h"
+
+#include <linux/io_uring.h>
+#include <algorithm>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+namespace sylar {
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("system");
+
+// IOManager的hook会用到的操作, 缺一个就不使用io_uring
+static const uint8_t s_required_ops[] = {
+    IORING_OP_RECV,
+    IORING_OP_SEND,
+    IORING_OP_ACCEPT,
+    IORING_OP_CONNECT,
+    IORING_OP_ASYNC_CANCEL
+};
+
+IoUring::ptr IoUring::Create(uint32_t entries) {
+    IoUring::ptr ring(new IoUring);
+    if(!ring->init(entries)) {
+        return nullptr;
+    }
+    return ring;
+}
+
+IoUring::IoUring() {
+}
+
+IoUring::~IoUring() {
+    if(m_sqes) {
+        munmap(m_sqes, m_sqesSize);
+    }
+    if(m_cqRing && m_cqRing != m_sqRing) {
+        munmap(m_cqRing, m_cqRingSize);
+    }
+    if(m_sqRing) {
+        munmap(m_sqRing, m_sqRingSize);
+    }
+    if(m_fd >= 0) {
+        close(m_fd);
+    }
+}
+
+bool IoUring::init(uint32_t entries) {
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    m_fd = syscall(__NR_io_uring_setup, entries, &params);
+    if(m_fd < 0) {
+        SYLAR_LOG_WARN(g_logger) << "io_uring_setup(" << entries << ") errno="
+            << errno << " errstr=" << strerror(errno);
+        return false;
+    }
+    //没有NODROP时CQ满了会丢完成事件, 挂起的协程再也醒不过来
+    if(!(params.features & IORING_FEAT_NODROP)) {
+        SYLAR_LOG_WARN(g_logger) << "io_uring without IORING_FEAT_NODROP";
+        return false;
+    }
+
+    size_t probe_size = sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op);
+    io_uring_probe* probe = (io_uring_probe*)calloc(1, probe_size);
+    int rt = syscall(__NR_io_uring_register, m_fd, IORING_REGISTER_PROBE, probe, 256);
+    bool supported = rt == 0;
+    for(size_t i = 0; supported && i < sizeof(s_required_ops); ++i) {
+        uint8_t op = s_required_ops[i];
+        supported = op <= probe->last_op
+            && (probe->ops[op].flags & IO_URING_OP_SUPPORTED);
+    }
+    free(probe);
+    if(!supported) {
+        SYLAR_LOG_WARN(g_logger) << "io_uring lacks required ops";
+        return false;
+    }
+
+    m_sqRingSize = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+    m_cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if(single_mmap) {
+        m_sqRingSize = std::max(m_sqRingSize, m_cqRingSize);
+        m_cqRingSize = m_sqRingSize;
+    }
+    m_sqRing = mmap(nullptr, m_sqRingSize, PROT_READ | PROT_WRITE
+                    ,MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQ_RING);
+    if(m_sqRing == MAP_FAILED) {
+        m_sqRing = nullptr;
+        return false;
+    }
+    if(single_mmap) {
+        m_cqRing = m_sqRing;
+    } else {
+        m_cqRing = mmap(nullptr, m_cqRingSize, PROT_READ | PROT_WRITE
+                        ,MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_CQ_RING);
+        if(m_cqRing == MAP_FAILED) {
+            m_cqRing = nullptr;
+            return false;
+        }
+    }
+    m_sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+    void* sqes = mmap(nullptr, m_sqesSize, PROT_READ | PROT_WRITE
+                      ,MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQES);
+    if(sqes == MAP_FAILED) {
+        return false;
+    }
+    m_sqes = (io_uring_sqe*)sqes;
+
+    char* sq = (char*)m_sqRing;
+    m_sqTail = (uint32_t*)(sq + params.sq_off.tail);
+    m_sqMask = (uint32_t*)(sq + params.sq_off.ring_mask);
+    m_sqFlags = (uint32_t*)(sq + params.sq_off.flags);
+    m_sqArray = (uint32_t*)(sq + params.sq_off.array);
+    char* cq = (char*)m_cqRing;
+    m_cqHead = (uint32_t*)(cq + params.cq_off.head);
+    m_cqTail = (uint32_t*)(cq + params.cq_off.tail);
+    m_cqMask = (uint32_t*)(cq + params.cq_off.ring_mask);
+    m_cqes = (io_uring_cqe*)(cq + params.cq_off.cqes);
+    return true;
+}
+
+int IoUring::enter(uint32_t to_submit, uint32_t flags) {
+    m_enterCount.fetch_add(1, std::memory_order_relaxed);
+    int rt = 0;
+    do {
+        rt = syscall(__NR_io_uring_enter, m_fd, to_submit, 0, flags, nullptr, 0);
+    } while(rt < 0 && errno == EINTR);
+    return rt < 0 ? -errno : rt;
+}
+
+int IoUring::submit(uint8_t opcode, int fd, uint64_t addr, uint32_t len
+                    ,uint64_t off, uint32_t op_flags, uint64_t user_data) {
+    MutexType::Lock lock(m_mutex);
+    //每次都立即提交, SQ中最多只有这一个
+    uint32_t tail = *m_sqTail;
+    uint32_t idx = tail & *m_sqMask;
+    io_uring_sqe* sqe = &m_sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = opcode;
+    sqe->fd = fd;
+    sqe->addr = addr;
+    sqe->len = len;
+    sqe->off = off;
+    sqe->rw_flags = op_flags;
+    sqe->user_data = user_data;
+    m_sqArray[idx] = idx;
+    __atomic_store_n(m_sqTail, tail + 1, __ATOMIC_RELEASE);
+
+    int rt = enter(1, 0);
+    if(rt != 1) {
+        //内核只在io_uring_enter中读SQ, 没有取走就可以收回
+        __atomic_store_n(m_sqTail, tail, __ATOMIC_RELEASE);
+        return rt < 0 ? rt : -EAGAIN;
+    }
+    return 0;
+}
+
+int IoUring::cancel(uint64_t user_data) {
+    return submit(IORING_OP_ASYNC_CANCEL, -1, user_data, 0, 0, 0, 0);
+}
+
+size_t IoUring::reap(std::vector<Completion>& out) {
+    size_t n = 0;
+    MutexType::Lock lock(m_mutex);
+    while(true) {
+        uint32_t head = *m_cqHead;
+        uint32_t tail = __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE);
+        for(; head != tail; ++head) {
+            io_uring_cqe* cqe = &m_cqes[head & *m_cqMask];
+            out.push_back(Completion{cqe->user_data, cqe->res});
+            ++n;
+        }
+        __atomic_store_n(m_cqHead, head, __ATOMIC_RELEASE);
+        //CQ满时内核把完成事件暂存在溢出链表, 要进入内核才会搬回CQ
+        if(!(__atomic_load_n(m_sqFlags, __ATOMIC_ACQUIRE) & IORING_SQ_CQ_OVERFLOW)) {
+            break;
+        }
+        enter(0, IORING_ENTER_GETEVENTS);
+    }
+    return n;
+}
+
+}
@@ -0,0 +1,100 @@
+#ifndef __SYLAR_URING_H__
+#define __SYLAR_URING_H__
+
+/*
+  io_uring的最小封装, 直接使用系统调用和共享内存环, 不依赖liburing
+
+  IOManager的io_uring后端用它提交socket读写/accept/connect: 提交即调用io_uring_enter,
+  SQ中不积压; 完成队列的fd注册在epoll上, 有CQE时唤醒阻塞在epoll_wait上的线程去reap.
+  内核不支持io_uring(或被禁用), 或不支持需要的操作时Create返回nullptr, 由调用者退回epoll.
+*/
+
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include "mutex.h"
+#include "noncopyable.h"
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+namespace sylar {
+
+class IoUring : Noncopyable {
+public:
+    typedef std::shared_ptr<IoUring> ptr;
+    typedef Spinlock MutexType;
+
+    /**
+     * @brief 一个完成事件
+     */
+    struct Completion {
+        uint64_t userData;      //// 提交时的user_data
+        int32_t res;            //// 系统调用的返回值, 失败为-errno
+    };
+
+    /**
+     * @brief 创建io_uring
+     * @param[in] entries SQ大小, 向上取2的幂, CQ为其2倍
+     * @return 内核不支持或缺少需要的特性时返回nullptr
+     */
+    static IoUring::ptr Create(uint32_t entries);
+
+    ~IoUring();
+
+    /**
+     * @brief 放入一个SQE并立即提交
+     * @param[in] opcode IORING_OP_xxx
+     * @param[in] addr, len, off, op_flags 对应SQE的同名字段, op_flags为msg_flags/accept_flags等
+     * @return 0成功, 否则-errno, 失败时SQE没有提交
+     */
+    int submit(uint8_t opcode, int fd, uint64_t addr, uint32_t len
+               ,uint64_t off, uint32_t op_flags, uint64_t user_data);
+
+    /**
+     * @brief 取消user_data对应的操作, 被取消的操作以-ECANCELED完成
+     * @details 取消操作自身的CQE的user_data为0
+     */
+    int cancel(uint64_t user_data);
+
+    /**
+     * @brief 取出所有完成事件追加到out, 任何线程都可以调用
+     * @return 取出的个数
+     */
+    size_t reap(std::vector<Completion>& out);
+
+    // 用于注册到epoll, 有CQE时可读
+    int getFd() const { return m_fd;}
+    // io_uring_enter调用次数
+    uint64_t getEnterCount() const { return m_enterCount;}
+private:
+    IoUring();
+    bool init(uint32_t entries);
+    int enter(uint32_t to_submit, uint32_t flags);
+private:
+    int m_fd = -1;
+    MutexType m_mutex;
+
+    void* m_sqRing = nullptr;
+    size_t m_sqRingSize = 0;
+    void* m_cqRing = nullptr;
+    size_t m_cqRingSize = 0;
+    io_uring_sqe* m_sqes = nullptr;
+    size_t m_sqesSize = 0;
+
+    uint32_t* m_sqTail = nullptr;
+    uint32_t* m_sqMask = nullptr;
+    uint32_t* m_sqFlags = nullptr;
+    uint32_t* m_sqArray = nullptr;
+    uint32_t* m_cqHead = nullptr;
+    uint32_t* m_cqTail = nullptr;
+    uint32_t* m_cqMask = nullptr;
+    io_uring_cqe* m_cqes = nullptr;
+
+    std::atomic<uint64_t> m_enterCount = {0};
+};
+
+}
+
+#endif
@@ -1,6 +1,7 @@
 #include "util.h"
 #include <execinfo.h>
 #include <sys/time.h>
+#include <time.h>
 
 #include "log.h"
 #include "fiber.h"
@@ -56,4 +57,10 @@ uint64_t GetCurrentUS() {
     return tv.tv_sec * 1000 * 1000ul + tv.tv_usec;
 }
 
+uint64_t GetMonotonicNS() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000 * 1000 * 1000ul + ts.tv_nsec;
+}
+
 }
\ No newline at end of file
@@ -23,6 +23,8 @@ std::string BacktraceToString(int size = 64, int skip = 2, const std::string& pr
 //时间ms
 uint64_t GetCurrentMS();
 uint64_t GetCurrentUS();
+//单调时钟ns, 只用于计算时间间隔
+uint64_t GetMonotonicNS();
 
 
 }
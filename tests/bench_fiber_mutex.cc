@@ -0,0 +1,80 @@
+#include "sylar/fiber_sync.h"
+#include "sylar/iomanager.h"
+#include "sylar/log.h"
+#include "sylar/mutex.h"
+#include "sylar/util.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <atomic>
+
+/*
+  锁竞争基准: threads个线程上的fibers个协程反复加锁, 每16次让出一次
+  sylar::Mutex的临界区内不能让出(同线程的其他协程再加锁会卡死线程), 两边临界区都不让出
+  对比sylar::Mutex(阻塞线程)和FiberMutex(只挂起协程)的吞吐,
+  以及同时运行的心跳协程在压测期间能跑多少次
+  ./bench_fiber_mutex [threads] [fibers] [rounds]
+*/
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static int s_threads = 4;
+static int s_fibers = 64;
+static int s_rounds = 2000;
+
+template<class MutexType>
+void bench(const char* name) {
+    MutexType mutex;
+    uint64_t count = 0;
+    std::atomic<int> running(s_fibers);
+    std::atomic<uint64_t> ticks(0);
+
+    uint64_t begin = sylar::GetCurrentUS();
+    {
+        sylar::IOManager iom(s_threads, false, name);
+        iom.schedule([&](){
+            while(running > 0) {
+                ++ticks;
+                sylar::Fiber::YieldToReady();
+            }
+        });
+        for(int i = 0; i < s_fibers; ++i) {
+            iom.schedule([&](){
+                for(int j = 0; j < s_rounds; ++j) {
+                    {
+                        typename MutexType::Lock lock(mutex);
+                        ++count;
+                    }
+                    if(j % 16 == 0) {
+                        sylar::Fiber::YieldToReady();
+                    }
+                }
+                --running;
+            });
+        }
+    }
+    uint64_t used = sylar::GetCurrentUS() - begin;
+
+    SYLAR_LOG_INFO(g_logger) << name << ": threads=" << s_threads
+        << " fibers=" << s_fibers << " ops=" << count
+        << " time=" << used / 1000.0 << "ms"
+        << " ops/s=" << (uint64_t)(count * 1000000.0 / (used ? used : 1))
+        << " heartbeat_ticks=" << ticks;
+}
+
+int main(int argc, char** argv) {
+    if(argc > 1) {
+        s_threads = atoi(argv[1]);
+    }
+    if(argc > 2) {
+        s_fibers = atoi(argv[2]);
+    }
+    if(argc > 3) {
+        s_rounds = atoi(argv[3]);
+    }
+    g_logger->setLevel(sylar::LogLevel::INFO);
+    SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::WARN);
+    bench<sylar::FiberMutex>("fiber_mutex");
+    bench<sylar::Mutex>("mutex");
+    return 0;
+}
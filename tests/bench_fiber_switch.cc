@@ -0,0 +1,114 @@
+#include "sylar/fiber.h"
+#include "sylar/fiber_context.h"
+#include "sylar/log.h"
+#include "sylar/util.h"
+
+#include <ucontext.h>
+#include <stdlib.h>
+
+/*
+  上下文切换微基准, 每轮往返计两次切换
+  ./bench_fiber_switch [rounds]
+*/
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static const size_t STACK_SIZE = 128 * 1024;
+static uint64_t s_rounds = 1000000;
+
+static void report(const char* name, uint64_t us) {
+    double switches = s_rounds * 2.0;
+    SYLAR_LOG_INFO(g_logger) << name << ": rounds=" << s_rounds
+        << " time=" << us / 1000.0 << "ms"
+        << " switches/s=" << (uint64_t)(switches * 1000000 / (us ? us : 1))
+        << " ns/switch=" << us * 1000.0 / switches;
+}
+
+/**********************  ucontext  **********************/
+
+static ucontext_t s_uc_main;
+static ucontext_t s_uc_co;
+
+static void uc_func() {
+    while(true) {
+        swapcontext(&s_uc_co, &s_uc_main);
+    }
+}
+
+void bench_ucontext() {
+    void* stack = malloc(STACK_SIZE);
+    getcontext(&s_uc_co);
+    s_uc_co.uc_link = nullptr;
+    s_uc_co.uc_stack.ss_sp = stack;
+    s_uc_co.uc_stack.ss_size = STACK_SIZE;
+    makecontext(&s_uc_co, &uc_func, 0);
+
+    uint64_t begin = sylar::GetCurrentUS();
+    for(uint64_t i = 0; i < s_rounds; ++i) {
+        swapcontext(&s_uc_main, &s_uc_co);
+    }
+    report("ucontext swapcontext", sylar::GetCurrentUS() - begin);
+    free(stack);
+}
+
+/**********************  asm  **********************/
+
+#ifdef SYLAR_HAS_ASM_CONTEXT
+static void* s_asm_main = nullptr;
+static void* s_asm_co = nullptr;
+
+static void asm_func() {
+    while(true) {
+        sylar_context_swap(&s_asm_co, s_asm_main);
+    }
+}
+
+void bench_asm() {
+    void* stack = malloc(STACK_SIZE);
+    s_asm_co = sylar::MakeContext(stack, STACK_SIZE, &asm_func);
+
+    uint64_t begin = sylar::GetCurrentUS();
+    for(uint64_t i = 0; i < s_rounds; ++i) {
+        sylar_context_swap(&s_asm_main, s_asm_co);
+    }
+    report("asm sylar_context_swap", sylar::GetCurrentUS() - begin);
+    free(stack);
+}
+#endif
+
+/**********************  Fiber  **********************/
+
+void bench_fiber() {
+    sylar::Fiber::GetThis();
+    sylar::Fiber* raw = nullptr;
+    sylar::Fiber::ptr fiber(new sylar::Fiber([&raw](){
+        for(uint64_t i = 0; i < s_rounds; ++i) {
+            raw->back();
+        }
+    }, 0, true));
+    raw = fiber.get();
+
+    uint64_t begin = sylar::GetCurrentUS();
+    for(uint64_t i = 0; i < s_rounds; ++i) {
+        fiber->call();
+    }
+    uint64_t used = sylar::GetCurrentUS() - begin;
+    fiber->call();
+#ifdef SYLAR_FIBER_ASM_CONTEXT
+    report("Fiber::call/back (asm)", used);
+#else
+    report("Fiber::call/back (ucontext)", used);
+#endif
+}
+
+int main(int argc, char** argv) {
+    if(argc > 1) {
+        s_rounds = atoll(argv[1]);
+    }
+    bench_ucontext();
+#ifdef SYLAR_HAS_ASM_CONTEXT
+    bench_asm();
+#endif
+    bench_fiber();
+    return 0;
+}
@@ -0,0 +1,70 @@
+#include "sylar/scheduler.h"
+#include "sylar/fiber.h"
+#include "sylar/log.h"
+#include "sylar/util.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+
+/*
+  两个协程乒乓唤醒对方的延迟
+  schedule: 唤醒方schedule后YieldToHold, 经过调度主协程和任务队列
+  handoff:  Fiber::YieldTo直接切换到对方
+  ./bench_handoff [rounds]
+*/
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static uint64_t s_rounds = 1000000;
+static volatile uint64_t s_count = 0;
+static volatile bool s_done = false;
+static sylar::Fiber::ptr s_ping;
+static sylar::Fiber::ptr s_pong;
+
+static void schedule_loop(sylar::Fiber::ptr* other) {
+    while(s_count < s_rounds) {
+        ++s_count;
+        sylar::Scheduler::GetThis()->schedule(*other);
+        sylar::Fiber::YieldToHold();
+    }
+    // 对方还挂起着, 唤醒它结束
+    sylar::Scheduler::GetThis()->schedule(*other);
+}
+
+static void handoff_loop(sylar::Fiber::ptr* other) {
+    while(s_count < s_rounds) {
+        ++s_count;
+        sylar::Fiber::YieldTo(*other);
+    }
+}
+
+void bench(const char* name, void (*loop)(sylar::Fiber::ptr*)) {
+    s_count = 0;
+    sylar::Scheduler sc(1, false, name);
+    s_ping.reset(new sylar::Fiber(std::bind(loop, &s_pong)));
+    s_pong.reset(new sylar::Fiber(std::bind(loop, &s_ping)));
+
+    uint64_t begin = sylar::GetCurrentUS();
+    sc.start();
+    sc.schedule(s_ping);
+    sc.stop();
+    uint64_t used = sylar::GetCurrentUS() - begin;
+
+    SYLAR_LOG_INFO(g_logger) << name << ": wakeups=" << s_count
+        << " time=" << used / 1000.0 << "ms"
+        << " ns/wakeup=" << used * 1000.0 / s_count;
+    s_ping.reset();
+    s_pong.reset();
+}
+
+int main(int argc, char** argv) {
+    if(argc > 1) {
+        s_rounds = atoll(argv[1]);
+    }
+    g_logger->setLevel(sylar::LogLevel::INFO);
+    // Scheduler::tickle每次都打INFO日志, 会掩盖切换本身的开销
+    SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::WARN);
+    bench("schedule", &schedule_loop);
+    bench("handoff", &handoff_loop);
+    return 0;
+}
@@ -0,0 +1,267 @@
+#include "sylar/http/http_server.h"
+#include "sylar/config.h"
+#include "sylar/hook.h"
+#include "sylar/iomanager.h"
+#include "sylar/log.h"
+#include "sylar/util.h"
+
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <strings.h>
+#include <map>
+#include <sstream>
+#include <vector>
+
+/*
+  HTTP server吞吐测试, 同进程内的客户端线程(不hook)用epoll维持大量keep-alive连接,
+  每个连接收到响应后立刻发下一个请求, epoll每轮返回大量就绪fd
+  ./bench_http_server [threads] [connections] [seconds] [mode] [backend]
+    threads 逗号分隔的线程数列表, 依次测试, 如1,2,4
+    mode    shared(所有线程共用一个epoll), per_thread(每线程一个epoll)或both
+    backend epoll, io_uring或both
+  每格输出requests/s和server端每个请求的系统调用数(hook的IO调用+epoll_wait+epoll_ctl
+  +io_uring_enter+tickle)
+*/
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static std::vector<int> s_threads = {2};
+static int s_connections = 256;
+static int s_seconds = 5;
+static std::string s_mode = "both";
+static std::string s_backend = "both";
+// 每轮换一个端口, 避免上一轮的连接处于TIME_WAIT
+static int s_port = 8521;
+
+static const char REQUEST[] =
+    "GET /bench HTTP/1.1\r\n"
+    "Host: 127.0.0.1\r\n"
+    "Connection: keep-alive\r\n"
+    "\r\n";
+
+static sylar::http::HttpServer::ptr s_server;
+
+void run_server() {
+    s_server.reset(new sylar::http::HttpServer(true));
+    sylar::Address::ptr addr = sylar::Address::LookupAnyIPAddress(
+            "127.0.0.1:" + std::to_string(s_port));
+    while(!s_server->bind(addr)) {
+        sleep(1);
+    }
+    s_server->getServletDispatch()->addServlet("/bench", [](
+                sylar::http::HttpRequest::ptr req
+                , sylar::http::HttpResponse::ptr rsp
+                , sylar::http::HttpSession::ptr session) {
+        rsp->setBody("hello sylar");
+        return 0;
+    });
+    s_server->start();
+}
+
+struct Conn {
+    int fd = -1;
+    std::string buf;
+};
+
+// 缓冲区中有完整的响应则去掉并返回true
+static bool consume_response(std::string& buf) {
+    size_t pos = buf.find("\r\n\r\n");
+    if(pos == std::string::npos) {
+        return false;
+    }
+    size_t length = 0;
+    size_t p = 0;
+    while((p = buf.find("\r\n", p)) != std::string::npos && p < pos) {
+        p += 2;
+        if(strncasecmp(buf.c_str() + p, "content-length:", 15) == 0) {
+            length = atoi(buf.c_str() + p + 15);
+            break;
+        }
+    }
+    if(buf.size() < pos + 4 + length) {
+        return false;
+    }
+    buf.erase(0, pos + 4 + length);
+    return true;
+}
+
+static int connect_server() {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(s_port);
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    if(connect(fd, (sockaddr*)&addr, sizeof(addr))) {
+        SYLAR_LOG_ERROR(g_logger) << "connect errno=" << errno
+            << " errstr=" << strerror(errno);
+        close(fd);
+        return -1;
+    }
+    int on = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    return fd;
+}
+
+// 返回完成的请求数, used为用时(ms)
+uint64_t run_client(uint64_t& used) {
+    int epfd = epoll_create(1024);
+    std::vector<Conn> conns(s_connections);
+    for(int i = 0; i < s_connections; ++i) {
+        conns[i].fd = connect_server();
+        if(conns[i].fd < 0) {
+            return 0;
+        }
+        epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.u32 = i;
+        epoll_ctl(epfd, EPOLL_CTL_ADD, conns[i].fd, &ev);
+    }
+
+    uint64_t requests = 0;
+    uint64_t begin = sylar::GetCurrentMS();
+    uint64_t end = begin + s_seconds * 1000;
+    for(auto& c : conns) {
+        write(c.fd, REQUEST, sizeof(REQUEST) - 1);
+    }
+
+    epoll_event events[256];
+    char buf[4096];
+    while(sylar::GetCurrentMS() < end) {
+        int rt = epoll_wait(epfd, events, 256, 100);
+        for(int i = 0; i < rt; ++i) {
+            Conn& c = conns[events[i].data.u32];
+            int n = 0;
+            while((n = read(c.fd, buf, sizeof(buf))) > 0) {
+                c.buf.append(buf, n);
+            }
+            while(consume_response(c.buf)) {
+                ++requests;
+                write(c.fd, REQUEST, sizeof(REQUEST) - 1);
+            }
+        }
+    }
+    used = sylar::GetCurrentMS() - begin;
+    for(auto& c : conns) {
+        close(c.fd);
+    }
+    close(epfd);
+
+    return requests;
+}
+
+// 用指定的线程数, epoll模式和IO后端起一个server, 返回"requests/s(syscalls/request)"
+std::string run_bench(int threads, bool per_thread, const std::string& backend) {
+    std::map<std::string, bool> mode;
+    mode["http"] = per_thread;
+    sylar::Config::Lookup<std::map<std::string, bool> >("iomanager.per_thread_epoll")->setValue(mode);
+    sylar::Config::Lookup<std::string>("iomanager.backend")->setValue(backend);
+
+    uint64_t requests = 0;
+    uint64_t used = 0;
+    uint64_t syscalls = 0;
+    uint64_t ctls = 0;
+    bool uring = false;
+    {
+        sylar::IOManager iom(threads, false, "http");
+        uring = iom.hasUring();
+        iom.schedule(run_server);
+        usleep(200 * 1000);
+        sylar::IOManager::IOStats io0 = iom.getIOStats();
+        sylar::Scheduler::Stats st0 = iom.getStats();
+        uint64_t hook0 = sylar::get_hook_io_calls();
+        requests = run_client(used);
+        sylar::IOManager::IOStats io1 = iom.getIOStats();
+        sylar::Scheduler::Stats st1 = iom.getStats();
+        ctls = io1.epollCtls - io0.epollCtls;
+        syscalls = sylar::get_hook_io_calls() - hook0
+            + io1.epollWaits - io0.epollWaits
+            + ctls
+            + io1.uringEnters - io0.uringEnters
+            + st1.tickles - st0.tickles;
+        s_server->stop();
+        s_server.reset();
+    }
+    uint64_t rps = requests * 1000.0 / (used ? used : 1);
+    double per_request = requests ? (double)syscalls / requests : 0;
+    SYLAR_LOG_INFO(g_logger) << "mode=" << (per_thread ? "per_thread" : "shared")
+        << " backend=" << (uring ? "io_uring" : "epoll")
+        << " threads=" << threads
+        << " connections=" << s_connections
+        << " requests/s=" << rps
+        << " syscalls/request=" << per_request
+        << " epoll_ctls/request=" << (requests ? (double)ctls / requests : 0);
+    ++s_port;
+    std::stringstream ss;
+    ss.precision(3);
+    ss << rps << "(" << per_request << ")";
+    return ss.str();
+}
+
+int main(int argc, char** argv) {
+    if(argc > 1) {
+        s_threads.clear();
+        std::stringstream ss(argv[1]);
+        std::string item;
+        while(std::getline(ss, item, ',')) {
+            s_threads.push_back(atoi(item.c_str()));
+        }
+    }
+    if(argc > 2) {
+        s_connections = atoi(argv[2]);
+    }
+    if(argc > 3) {
+        s_seconds = atoi(argv[3]);
+    }
+    if(argc > 4) {
+        s_mode = argv[4];
+    }
+    if(argc > 5) {
+        s_backend = argv[5];
+    }
+    g_logger->setLevel(sylar::LogLevel::INFO);
+    SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::ERROR);
+
+    std::vector<bool> modes;
+    if(s_mode != "per_thread") {
+        modes.push_back(false);
+    }
+    if(s_mode != "shared") {
+        modes.push_back(true);
+    }
+    std::vector<std::string> backends;
+    if(s_backend != "io_uring") {
+        backends.push_back("epoll");
+    }
+    if(s_backend != "epoll") {
+        backends.push_back("io_uring");
+    }
+    //按线程数列出各模式的吞吐, 看随核数的扩展
+    std::stringstream result;
+    result << "threads";
+    for(bool m : modes) {
+        for(auto& b : backends) {
+            result << "\t" << (m ? "per_thread" : "shared") << "/" << b;
+        }
+    }
+    for(int threads : s_threads) {
+        result << "\n" << threads;
+        for(bool m : modes) {
+            for(auto& b : backends) {
+                result << "\t" << run_bench(threads, m, b);
+            }
+        }
+    }
+    SYLAR_LOG_INFO(g_logger) << "requests/s(syscalls/request) connections=" << s_connections
+        << "\n" << result.str();
+    return 0;
+}
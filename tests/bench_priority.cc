@@ -0,0 +1,105 @@
+#include "sylar/scheduler.h"
+#include "sylar/log.h"
+#include "sylar/util.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+/*
+  混合负载下的排队延迟
+  后台线程持续放入LOW回调, 保持LOW队列有backlog个任务;
+  主线程每毫秒放入一个"请求"回调, 统计从schedule到开始执行的延迟.
+  请求分别以LOW(与后台同级, 相当于原来的单一FIFO), NORMAL, HIGH放入
+  ./bench_priority [threads] [requests] [backlog]
+*/
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static int s_threads = 2;
+static int s_requests = 1000;
+static size_t s_backlog = 5000;
+static volatile uint64_t s_sink = 0;
+
+static void work() {
+    uint64_t v = 0;
+    for(int i = 0; i < 1000; ++i) {
+        v += i * i;
+    }
+    s_sink += v;
+}
+
+void bench(const char* name, sylar::Scheduler::Priority priority) {
+    sylar::Scheduler sc(s_threads, false, "priority");
+    sc.start();
+
+    std::atomic<bool> running(true);
+    std::atomic<uint64_t> low_done(0);
+    std::thread background([&](){
+        while(running) {
+            if(sc.getQueueSize(sylar::Scheduler::LOW) >= s_backlog) {
+                usleep(100);
+                continue;
+            }
+            sc.schedule([&low_done](){
+                work();
+                ++low_done;
+            }, -1, sylar::Scheduler::LOW);
+        }
+    });
+    while(sc.getQueueSize(sylar::Scheduler::LOW) < s_backlog) {
+        usleep(1000);
+    }
+
+    std::vector<uint64_t> latency(s_requests, 0);
+    std::atomic<int> done(0);
+    uint64_t depth = 0;
+    for(int i = 0; i < s_requests; ++i) {
+        uint64_t begin = sylar::GetCurrentUS();
+        uint64_t* slot = &latency[i];
+        sc.schedule([slot, begin, &done](){
+            *slot = sylar::GetCurrentUS() - begin;
+            work();
+            ++done;
+        }, -1, priority);
+        depth += sc.getQueueSize(sylar::Scheduler::LOW);
+        usleep(1000);
+    }
+    while(done < s_requests) {
+        usleep(1000);
+    }
+    running = false;
+    background.join();
+    sc.stop();
+
+    std::sort(latency.begin(), latency.end());
+    SYLAR_LOG_INFO(g_logger) << name << ": threads=" << s_threads
+        << " requests=" << s_requests
+        << " p50=" << latency[s_requests / 2] << "us"
+        << " p99=" << latency[s_requests * 99 / 100] << "us"
+        << " max=" << latency.back() << "us"
+        << " avg_low_depth=" << depth / s_requests
+        << " low_done=" << low_done;
+}
+
+int main(int argc, char** argv) {
+    if(argc > 1) {
+        s_threads = atoi(argv[1]);
+    }
+    if(argc > 2) {
+        s_requests = atoi(argv[2]);
+    }
+    if(argc > 3) {
+        s_backlog = atoi(argv[3]);
+    }
+    g_logger->setLevel(sylar::LogLevel::INFO);
+    // Scheduler::tickle每次都打INFO日志
+    SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::WARN);
+    bench("low", sylar::Scheduler::LOW);
+    bench("normal", sylar::Scheduler::NORMAL);
+    bench("high", sylar::Scheduler::HIGH);
+    return 0;
+}
@@ -0,0 +1,152 @@
+#include "sylar/scheduler.h"
+#include "sylar/fiber.h"
+#include "sylar/log.h"
+#include "sylar/util.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <atomic>
+#include <thread>
+
+/*
+  调度器线程数扩展性测试, 线程数从1到N
+  yield:    每个协程做少量计算后YieldToReady, 任务在工作线程本地队列间流转
+  external: 外部线程不断schedule回调, 走全局队列, 由工作线程取走或互相偷
+  pinned:   每个协程固定在第一次运行的线程上, 每轮schedule(fiber, thread)自己
+  inline:   同external, 但用scheduleInline, 回调直接在调度循环上执行
+  ./bench_scheduler [max_threads] [tasks]
+*/
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static int s_max_threads = 0;
+static uint64_t s_tasks = 1000000;
+static std::atomic<uint64_t> s_done(0);
+static volatile uint64_t s_sink = 0;
+
+static void work() {
+    uint64_t v = 0;
+    for(int i = 0; i < 200; ++i) {
+        v += i * i;
+    }
+    s_sink += v;
+}
+
+static void yield_fiber(uint64_t rounds) {
+    for(uint64_t i = 0; i < rounds; ++i) {
+        work();
+        ++s_done;
+        sylar::Fiber::YieldToReady();
+    }
+}
+
+static void pinned_fiber(uint64_t rounds) {
+    int thread = sylar::GetThreadId();
+    sylar::Scheduler* sc = sylar::Scheduler::GetThis();
+    for(uint64_t i = 0; i < rounds; ++i) {
+        work();
+        ++s_done;
+        sc->schedule(sylar::Fiber::GetThis(), thread);
+        sylar::Fiber::YieldToHold();
+    }
+}
+
+static void report(const char* name, int threads, uint64_t us) {
+    SYLAR_LOG_INFO(g_logger) << name << ": threads=" << threads
+        << " tasks=" << s_done
+        << " time=" << us / 1000.0 << "ms"
+        << " tasks/s=" << (uint64_t)(s_done * 1000000.0 / (us ? us : 1));
+}
+
+void bench_yield(int threads) {
+    s_done = 0;
+    const int fibers = 256;
+    uint64_t begin = sylar::GetCurrentUS();
+    {
+        sylar::Scheduler sc(threads, false, "yield");
+        sc.start();
+        for(int i = 0; i < fibers; ++i) {
+            sc.schedule(std::bind(&yield_fiber, s_tasks / fibers));
+        }
+        sc.stop();
+    }
+    report("yield", threads, sylar::GetCurrentUS() - begin);
+}
+
+void bench_pinned(int threads) {
+    s_done = 0;
+    const int fibers = 256;
+    uint64_t begin = sylar::GetCurrentUS();
+    {
+        sylar::Scheduler sc(threads, false, "pinned");
+        sc.start();
+        for(int i = 0; i < fibers; ++i) {
+            sc.schedule(std::bind(&pinned_fiber, s_tasks / fibers));
+        }
+        sc.stop();
+    }
+    report("pinned", threads, sylar::GetCurrentUS() - begin);
+}
+
+void bench_external(int threads) {
+    s_done = 0;
+    uint64_t begin = sylar::GetCurrentUS();
+    {
+        sylar::Scheduler sc(threads, false, "external");
+        sc.start();
+        for(uint64_t i = 0; i < s_tasks; ++i) {
+            sc.schedule([](){
+                work();
+                ++s_done;
+            });
+        }
+        sc.stop();
+    }
+    report("external", threads, sylar::GetCurrentUS() - begin);
+}
+
+void bench_inline(int threads) {
+    s_done = 0;
+    uint64_t begin = sylar::GetCurrentUS();
+    {
+        sylar::Scheduler sc(threads, false, "inline");
+        sc.start();
+        for(uint64_t i = 0; i < s_tasks; ++i) {
+            sc.scheduleInline([](){
+                work();
+                ++s_done;
+            });
+        }
+        sc.stop();
+    }
+    report("inline", threads, sylar::GetCurrentUS() - begin);
+}
+
+int main(int argc, char** argv) {
+    s_max_threads = std::thread::hardware_concurrency();
+    if(argc > 1) {
+        s_max_threads = atoi(argv[1]);
+    }
+    if(argc > 2) {
+        s_tasks = atoll(argv[2]);
+    }
+    if(s_max_threads < 1) {
+        s_max_threads = 1;
+    }
+    g_logger->setLevel(sylar::LogLevel::INFO);
+    // Scheduler::tickle每次都打INFO日志
+    SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::WARN);
+    for(int i = 1; i <= s_max_threads; i = (i < 4 ? i + 1 : i * 2)) {
+        bench_yield(i);
+    }
+    for(int i = 1; i <= s_max_threads; i = (i < 4 ? i + 1 : i * 2)) {
+        bench_pinned(i);
+    }
+    for(int i = 1; i <= s_max_threads; i = (i < 4 ? i + 1 : i * 2)) {
+        bench_external(i);
+    }
+    for(int i = 1; i <= s_max_threads; i = (i < 4 ? i + 1 : i * 2)) {
+        bench_inline(i);
+    }
+    return 0;
+}
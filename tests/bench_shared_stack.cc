@@ -0,0 +1,111 @@
+#include "sylar/scheduler.h"
+#include "sylar/fiber.h"
+#include "sylar/log.h"
+#include "sylar/util.h"
+#include "sylar/macro.h"
+
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <atomic>
+#include <vector>
+
+/*
+  模拟大量挂起的空闲连接, 比较私有栈和共享栈每个连接占用的内存
+  ./bench_shared_stack [fibers]
+*/
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static int s_fibers = 10000;
+static std::atomic<int> s_parked(0);
+static std::atomic<int> s_done(0);
+
+// 读取/proc/self/statm, 单位字节
+static void get_mem(uint64_t& vsz, uint64_t& rss) {
+    vsz = rss = 0;
+    FILE* fp = fopen("/proc/self/statm", "r");
+    if(!fp) {
+        return;
+    }
+    unsigned long v = 0, r = 0;
+    if(fscanf(fp, "%lu %lu", &v, &r) == 2) {
+        vsz = v * sysconf(_SC_PAGESIZE);
+        rss = r * sysconf(_SC_PAGESIZE);
+    }
+    fclose(fp);
+}
+
+// 模拟请求处理的栈峰值(解析/序列化), 返回后这部分栈已不再需要
+static int __attribute__((noinline)) handle_request(int v) {
+    char tmp[16 * 1024];
+    memset(tmp, v, sizeof(tmp));
+    return tmp[v];
+}
+
+// 模拟连接协程: 处理完一个请求后挂起等待下一个请求
+static void conn_func() {
+    static std::atomic<int> s_sum(0);
+    s_sum += handle_request(1);
+    char buf[2048];
+    memset(buf, 0x5a, sizeof(buf));
+    ++s_parked;
+    sylar::Fiber::YieldToHold();
+    SYLAR_ASSERT(buf[sizeof(buf) - 1] == 0x5a);
+    ++s_done;
+}
+
+void bench(bool shared) {
+    s_parked = 0;
+    s_done = 0;
+    uint64_t vsz0, rss0;
+    get_mem(vsz0, rss0);
+
+    sylar::Scheduler sc(1, false, shared ? "shared" : "private");
+    sc.start();
+    std::vector<sylar::Fiber::ptr> fibers;
+    fibers.reserve(s_fibers);
+    uint64_t begin = sylar::GetCurrentUS();
+    for(int i = 0; i < s_fibers; ++i) {
+        fibers.push_back(sylar::Fiber::ptr(new sylar::Fiber(&conn_func, 0, false, shared)));
+        sc.schedule(fibers.back());
+    }
+    while(s_parked < s_fibers) {
+        usleep(1000);
+    }
+    uint64_t park_us = sylar::GetCurrentUS() - begin;
+
+    uint64_t vsz1, rss1;
+    get_mem(vsz1, rss1);
+
+    // 全部唤醒一次, 共享栈模式下每次切换都要换栈
+    begin = sylar::GetCurrentUS();
+    for(auto& i : fibers) {
+        sc.schedule(i);
+    }
+    while(s_done < s_fibers) {
+        usleep(1000);
+    }
+    uint64_t resume_us = sylar::GetCurrentUS() - begin;
+    sc.stop();
+
+    SYLAR_LOG_INFO(g_logger) << (shared ? "shared stack" : "private stack")
+        << ": fibers=" << s_fibers
+        << " rss/conn=" << (int64_t)(rss1 - rss0) / s_fibers << "B"
+        << " vsz/conn=" << (int64_t)(vsz1 - vsz0) / s_fibers << "B"
+        << " rss_total=" << (rss1 - rss0) / 1024 / 1024 << "MB"
+        << " park=" << park_us / 1000.0 << "ms"
+        << " resume=" << resume_us / 1000.0 << "ms";
+}
+
+int main(int argc, char** argv) {
+    if(argc > 1) {
+        s_fibers = atoi(argv[1]);
+    }
+    g_logger->setLevel(sylar::LogLevel::INFO);
+    SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::INFO);
+    bench(true);
+    bench(false);
+    return 0;
+}
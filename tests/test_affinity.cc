@@ -0,0 +1,84 @@
+#include "sylar/scheduler.h"
+#include "sylar/config.h"
+#include "sylar/numa.h"
+#include "sylar/log.h"
+#include "sylar/macro.h"
+
+#include <sched.h>
+#include <unistd.h>
+#include <atomic>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+void test_parse() {
+    std::vector<int> cpus;
+    SYLAR_ASSERT(sylar::Numa::ParseCpuList("0-3,8,10-11", cpus));
+    SYLAR_ASSERT(cpus == std::vector<int>({0, 1, 2, 3, 8, 10, 11}));
+    cpus.clear();
+    SYLAR_ASSERT(!sylar::Numa::ParseCpuList("3-1", cpus));
+    SYLAR_ASSERT(!sylar::Numa::ParseCpuList("a", cpus));
+    SYLAR_ASSERT(!sylar::Numa::ParseAffinity("", cpus));
+    SYLAR_ASSERT(!sylar::Numa::ParseAffinity("node:1024", cpus));
+
+    SYLAR_ASSERT(sylar::Numa::GetNodeCount() >= 1);
+    std::vector<int> node0 = sylar::Numa::GetNodeCpus(0, false);
+    std::vector<int> cores = sylar::Numa::GetNodeCpus(0, true);
+    SYLAR_ASSERT(!cores.empty() && cores.size() <= node0.size());
+    SYLAR_ASSERT(sylar::Numa::ParseAffinity("node:0", cpus));
+    SYLAR_ASSERT(cpus == cores);
+    SYLAR_LOG_INFO(g_logger) << "nodes=" << sylar::Numa::GetNodeCount()
+        << " node0 cpus=" << node0.size() << " cores=" << cores.size();
+}
+
+void test_pin() {
+    int cpu = sylar::Numa::GetNodeCpus(0, true).back();
+    auto affinity = sylar::Config::Lookup<std::map<std::string, std::string> >(
+            "scheduler.affinity");
+    SYLAR_ASSERT(affinity);
+    std::map<std::string, std::string> v;
+    v["pinned"] = std::to_string(cpu);
+    affinity->setValue(v);
+
+    static std::atomic<int> s_count(0);
+    static std::atomic<int> s_wrong(0);
+    sylar::Scheduler sc(2, false, "pinned");
+    sc.start();
+    for(int i = 0; i < 100; ++i) {
+        sc.schedule([cpu](){
+            if(sched_getcpu() != cpu || sylar::Thread::GetCpu() != cpu) {
+                ++s_wrong;
+            }
+            ++s_count;
+        });
+    }
+    sc.stop();
+    SYLAR_ASSERT(s_count == 100);
+    SYLAR_ASSERT(s_wrong == 0);
+    SYLAR_ASSERT(sylar::Thread::GetCpu() == -1);
+
+    // 不在配置中的调度器不绑核
+    sylar::Scheduler other(1, false, "other");
+    other.start();
+    other.schedule([](){
+        SYLAR_ASSERT(sylar::Thread::GetCpu() == -1);
+    });
+    other.stop();
+}
+
+void test_alloc() {
+    size_t size = 64 * 1024;
+    char* p = (char*)sylar::Numa::Alloc(size, 0);
+    SYLAR_ASSERT(p);
+    for(size_t i = 0; i < size; ++i) {
+        SYLAR_ASSERT(p[i] == 0);
+    }
+    sylar::Numa::Free(p, size);
+}
+
+int main(int argc, char** argv) {
+    SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::WARN);
+    test_parse();
+    test_pin();
+    test_alloc();
+    return 0;
+}
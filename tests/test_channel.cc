@@ -0,0 +1,182 @@
+#include "sylar/channel.h"
+#include "sylar/iomanager.h"
+#include "sylar/log.h"
+#include "sylar/macro.h"
+#include "sylar/thread.h"
+#include "sylar/util.h"
+
+#include <unistd.h>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+// 多生产者多消费者, 容量很小, 生产者经常因为满了挂起
+void test_mpmc() {
+    sylar::Channel<int> ch(3);
+    SYLAR_ASSERT(ch.getCapacity() == 3);
+    std::atomic<int> producers(4);
+    std::atomic<int> consumed(0);
+    std::atomic<int64_t> sum(0);
+    {
+        sylar::IOManager iom(2, false, "chan_mpmc");
+        for(int i = 0; i < 4; ++i) {
+            iom.schedule([&, i](){
+                for(int j = 0; j < 1000; ++j) {
+                    SYLAR_ASSERT(ch.push(i * 1000 + j));
+                }
+                if(--producers == 0) {
+                    ch.close();
+                }
+            });
+        }
+        for(int i = 0; i < 3; ++i) {
+            iom.schedule([&](){
+                int v = 0;
+                while(ch.pop(v)) {
+                    SYLAR_ASSERT(ch.size() <= 3);
+                    sum += v;
+                    ++consumed;
+                }
+            });
+        }
+    }
+    SYLAR_ASSERT(consumed == 4000);
+    SYLAR_ASSERT(sum == 4000LL * 3999 / 2);
+    SYLAR_ASSERT(ch.isClosed() && !ch.push(1));
+}
+
+// 满了push超时, 空了pop超时, 关闭时把剩下的取完
+void test_timeout_close() {
+    sylar::Channel<std::string> ch(2);
+    SYLAR_ASSERT(ch.tryPush("a") && ch.tryPush("b") && !ch.tryPush("c"));
+    {
+        sylar::IOManager iom(1, false, "chan_timeout");
+        iom.schedule([&](){
+            uint64_t begin = sylar::GetCurrentMS();
+            SYLAR_ASSERT(!ch.push("c", 30));
+            SYLAR_ASSERT(sylar::GetCurrentMS() - begin >= 25);
+            std::string v;
+            SYLAR_ASSERT(ch.pop(v) && v == "a");
+            SYLAR_ASSERT(ch.pop(v) && v == "b");
+            SYLAR_ASSERT(!ch.pop(v, 30));
+        });
+    }
+    // 线程等待, 协程关闭
+    std::atomic<bool> closed(false);
+    {
+        sylar::IOManager iom(1, false, "chan_close");
+        iom.schedule([&](){
+            usleep(30 * 1000);
+            ch.push("x");
+            closed = true;
+            ch.close();
+        });
+        std::string v;
+        SYLAR_ASSERT(ch.pop(v) && v == "x");
+        SYLAR_ASSERT(!ch.pop(v));
+        SYLAR_ASSERT(closed);
+    }
+}
+
+// 取出后槽位释放, 不延长数据的生命周期
+void test_release() {
+    sylar::Channel<std::shared_ptr<int> > ch(1);
+    std::shared_ptr<int> p(new int(1));
+    SYLAR_ASSERT(ch.push(p));
+    std::shared_ptr<int> q;
+    SYLAR_ASSERT(ch.pop(q) && q == p);
+    q.reset();
+    SYLAR_ASSERT(p.use_count() == 1);
+}
+
+void test_select() {
+    sylar::Channel<int> a(4);
+    sylar::Channel<int> b(4);
+    std::vector<sylar::Channel<int>*> chans = {&a, &b};
+    int v = 0;
+    SYLAR_ASSERT(sylar::Channel<int>::Select(chans, v, 0) == -1);
+    b.push(2);
+    SYLAR_ASSERT(sylar::Channel<int>::Select(chans, v, 0) == 1 && v == 2);
+
+    std::atomic<int> got_a(0);
+    std::atomic<int> got_b(0);
+    std::atomic<bool> timeout(false);
+    {
+        sylar::IOManager iom(2, false, "chan_select");
+        // 两个select协程和一个普通读者抢a, b的数据
+        for(int i = 0; i < 2; ++i) {
+            iom.schedule([&](){
+                int v = 0;
+                int idx = 0;
+                while((idx = sylar::Channel<int>::Select(chans, v)) >= 0) {
+                    (idx == 0 ? got_a : got_b) += 1;
+                }
+            });
+        }
+        iom.schedule([&](){
+            int v = 0;
+            while(b.pop(v)) {
+                ++got_b;
+            }
+        });
+        iom.schedule([&](){
+            for(int i = 0; i < 500; ++i) {
+                a.push(i);
+                b.push(i);
+                if(i % 10 == 0) {
+                    usleep(1000);
+                }
+            }
+            a.close();
+            b.close();
+        });
+        iom.schedule([&](){
+            sylar::Channel<int> c(1);
+            std::vector<sylar::Channel<int>*> cs = {&c};
+            int v = 0;
+            timeout = sylar::Channel<int>::Select(cs, v, 30) == -1 && !c.isClosed();
+        });
+    }
+    SYLAR_LOG_INFO(g_logger) << "select got_a=" << got_a << " got_b=" << got_b;
+    SYLAR_ASSERT(got_a == 500 && got_b == 500);
+    SYLAR_ASSERT(timeout);
+    // 全部关闭且为空
+    SYLAR_ASSERT(sylar::Channel<int>::Select(chans, v) == -1);
+}
+
+// 同一线程上的流水线: push直接切换到等待的读者, 返回时读者已经取走
+void test_handoff() {
+    sylar::Channel<int> ch(1);
+    std::vector<int> order;
+    {
+        sylar::IOManager iom(1, false, "chan_handoff");
+        iom.schedule([&](){
+            int v = 0;
+            while(ch.pop(v)) {
+                order.push_back(v);
+            }
+        });
+        iom.schedule([&](){
+            for(int i = 0; i < 3; ++i) {
+                SYLAR_ASSERT(ch.push(i * 2));
+                order.push_back(i * 2 + 1);
+            }
+            ch.close();
+        });
+    }
+    SYLAR_ASSERT(order == std::vector<int>({0, 1, 2, 3, 4, 5}));
+}
+
+int main(int argc, char** argv) {
+    SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::WARN);
+    test_mpmc();
+    test_timeout_close();
+    test_release();
+    test_select();
+    test_handoff();
+    SYLAR_LOG_INFO(g_logger) << "test_channel ok";
+    return 0;
+}
@@ -0,0 +1,93 @@
+#include "sylar/scheduler.h"
+#include "sylar/iomanager.h"
+#include "sylar/config.h"
+#include "sylar/log.h"
+#include "sylar/macro.h"
+#include "sylar/util.h"
+
+#include <unistd.h>
+#include <atomic>
+#include <set>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static std::atomic<int> s_done(0);
+static sylar::Spinlock s_mutex;
+static std::set<int> s_threads;
+
+// 不让出的忙等, 让任务在队列里排起来
+static void busy() {
+    uint64_t end = sylar::GetCurrentMS() + 5;
+    while(sylar::GetCurrentMS() < end) {
+    }
+    {
+        sylar::Spinlock::Lock lock(s_mutex);
+        s_threads.insert(sylar::GetThreadId());
+    }
+    ++s_done;
+}
+
+// 等待条件成立, 超时返回false
+template<class Pred>
+static bool wait_for(Pred pred, int ms) {
+    for(int i = 0; i < ms / 10; ++i) {
+        if(pred()) {
+            return true;
+        }
+        usleep(10 * 1000);
+    }
+    return pred();
+}
+
+template<class S>
+void test(S& sc, int tasks, int idle_wait_ms) {
+    s_done = 0;
+    s_threads.clear();
+    for(int i = 0; i < tasks; ++i) {
+        sc.schedule(&busy);
+    }
+    size_t peak = 1;
+    SYLAR_ASSERT(wait_for([&](){
+        peak = std::max(peak, sc.getStats().threads);
+        return s_done == tasks;
+    }, 10000));
+    SYLAR_LOG_INFO(g_logger) << sc.getName() << " peak threads=" << peak
+        << " used threads=" << s_threads.size();
+    SYLAR_ASSERT(peak > 1);
+    SYLAR_ASSERT(peak <= 3);
+
+    SYLAR_ASSERT(wait_for([&](){ return sc.getStats().threads == 1;}, idle_wait_ms));
+    SYLAR_LOG_INFO(g_logger) << sc.getName() << " after idle: " << sc.getStats().toString();
+
+    // 指定到已退出线程的任务在其他线程执行
+    std::atomic<int> pinned(0);
+    for(auto& i : s_threads) {
+        sc.schedule([&pinned](){ ++pinned;}, i);
+    }
+    SYLAR_ASSERT(wait_for([&](){ return pinned == (int)s_threads.size();}, 1000));
+}
+
+int main(int argc, char** argv) {
+    SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::WARN);
+    std::map<std::string, uint32_t> max_threads;
+    max_threads["elastic"] = 3;
+    max_threads["elastic_io"] = 3;
+    sylar::Config::Lookup<std::map<std::string, uint32_t> >("scheduler.max_threads")
+        ->setValue(max_threads);
+    sylar::Config::Lookup<uint32_t>("scheduler.elastic_grow_delay")->setValue(1000);
+    sylar::Config::Lookup<uint32_t>("scheduler.elastic_idle_timeout")->setValue(200);
+
+    {
+        sylar::Scheduler sc(1, false, "elastic");
+        sc.start();
+        test(sc, 200, 2000);
+        sc.stop();
+    }
+    {
+        // IOManager的idle最长阻塞3秒才回到调度循环判断是否退出
+        sylar::IOManager iom(1, false, "elastic_io");
+        test(iom, 200, 10000);
+        iom.stop();
+    }
+    return 0;
+}
@@ -0,0 +1,117 @@
+#include "sylar/iomanager.h"
+#include "sylar/log.h"
+#include "sylar/macro.h"
+
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#include <atomic>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static const int PIPES = 64;
+static const int ROUNDS = 200;
+static const int HIGH_FD = 100000;
+
+// 没见过的fd上删除/取消不分配; fd表按块懒分配, 大fd只多一块
+void test_lazy() {
+    sylar::IOManager iom(2, false, "fd_table_lazy");
+    SYLAR_ASSERT(!iom.delEvent(500, sylar::IOManager::READ));
+    SYLAR_ASSERT(!iom.cancelEvent(500, sylar::IOManager::WRITE));
+    SYLAR_ASSERT(!iom.cancelAll(500));
+    SYLAR_ASSERT(!iom.consumeReady(500, sylar::IOManager::READ));
+    SYLAR_ASSERT(iom.getIOStats().fdChunks == 0);
+    SYLAR_ASSERT(iom.getIOStats().fdContexts == 0);
+
+    int fds[2];
+    SYLAR_ASSERT(!pipe(fds));
+    std::atomic<int> fired(0);
+    SYLAR_ASSERT(!iom.addEvent(fds[0], sylar::IOManager::READ, [&fired](){
+        ++fired;
+    }));
+    SYLAR_ASSERT(write(fds[1], "x", 1) == 1);
+
+    int high = -1;
+    rlimit rl;
+    SYLAR_ASSERT(!getrlimit(RLIMIT_NOFILE, &rl));
+    if(rl.rlim_cur <= HIGH_FD && rl.rlim_max > HIGH_FD) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+    if(dup2(fds[0], HIGH_FD) == HIGH_FD) {
+        high = HIGH_FD;
+        SYLAR_ASSERT(!iom.addEvent(high, sylar::IOManager::READ, [&fired](){
+            ++fired;
+        }));
+    } else {
+        SYLAR_LOG_INFO(g_logger) << "skip fd=" << HIGH_FD << " rlimit=" << rl.rlim_cur;
+    }
+    while(fired < (high < 0 ? 1 : 2)) {
+        usleep(1000);
+    }
+
+    // 超出fd表
+    SYLAR_ASSERT(iom.addEvent(1 << 23, sylar::IOManager::READ, [](){}) == -1);
+
+    sylar::IOManager::IOStats s = iom.getIOStats();
+    SYLAR_LOG_INFO(g_logger) << "lazy " << s.toString();
+    SYLAR_ASSERT(s.fdChunks == (high < 0 ? 1u : 2u));
+    SYLAR_ASSERT(s.fdContexts == (high < 0 ? 1u : 2u));
+    iom.cancelAll(fds[0]);
+    close(fds[0]);
+    close(fds[1]);
+    if(high >= 0) {
+        iom.cancelAll(high);
+        close(high);
+    }
+}
+
+// 多个线程同时第一次用到同一块中的fd, 只留下一个块和每个fd一个上下文
+void test_concurrent() {
+    int fds[PIPES][2];
+    for(int i = 0; i < PIPES; ++i) {
+        SYLAR_ASSERT(!pipe(fds[i]));
+    }
+    std::atomic<int> fired(0);
+    std::atomic<int> done(0);
+    {
+        sylar::IOManager iom(4, false, "fd_table_concurrent");
+        for(int i = 0; i < PIPES; ++i) {
+            int fd = fds[i][0];
+            iom.schedule([&iom, &fired, &done, fd](){
+                for(int r = 0; r < ROUNDS; ++r) {
+                    SYLAR_ASSERT(!iom.addEvent(fd, sylar::IOManager::READ, [&fired](){
+                        ++fired;
+                    }));
+                    SYLAR_ASSERT(iom.cancelEvent(fd, sylar::IOManager::READ));
+                }
+                ++done;
+            });
+        }
+        while(done < PIPES) {
+            usleep(1000);
+        }
+        while(fired < PIPES * ROUNDS) {
+            usleep(1000);
+        }
+        sylar::IOManager::IOStats s = iom.getIOStats();
+        SYLAR_LOG_INFO(g_logger) << "concurrent " << s.toString();
+        SYLAR_ASSERT(s.fdContexts == (size_t)PIPES);
+        SYLAR_ASSERT(s.fdChunks == 1);
+        for(int i = 0; i < PIPES; ++i) {
+            iom.cancelAll(fds[i][0]);
+        }
+    }
+    for(int i = 0; i < PIPES; ++i) {
+        close(fds[i][0]);
+        close(fds[i][1]);
+    }
+}
+
+int main(int argc, char** argv) {
+    SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::WARN);
+    test_lazy();
+    test_concurrent();
+    SYLAR_LOG_INFO(g_logger) << "test_fd_table ok";
+    return 0;
+}
@@ -0,0 +1,85 @@
+#include "sylar/fiber_local.h"
+#include "sylar/iomanager.h"
+#include "sylar/log.h"
+#include "sylar/macro.h"
+
+#include <unistd.h>
+#include <atomic>
+#include <string>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static std::atomic<int> s_alive(0);
+
+struct Context {
+    Context() { ++s_alive;}
+    Context(const Context& o) : id(o.id) { ++s_alive;}
+    ~Context() { --s_alive;}
+    int id = 0;
+};
+
+static sylar::FiberLocal<std::string> s_trace_id;
+static sylar::FiberLocal<Context> s_ctx;
+
+// 同一线程上交替运行的协程各自看到自己的值
+void test_isolation() {
+    std::atomic<int> ok(0);
+    {
+        sylar::IOManager iom(2, false, "local_io");
+        for(int i = 0; i < 20; ++i) {
+            iom.schedule([&ok, i](){
+                SYLAR_ASSERT(!s_trace_id.get());
+                SYLAR_ASSERT(!s_ctx.get());
+                s_trace_id.set("trace-" + std::to_string(i));
+                s_ctx->id = i;
+                for(int j = 0; j < 3; ++j) {
+                    usleep(1000);
+                    sylar::Fiber::YieldToReady();
+                    SYLAR_ASSERT(*s_trace_id == "trace-" + std::to_string(i));
+                    SYLAR_ASSERT(s_ctx->id == i);
+                }
+                ++ok;
+            });
+        }
+    }
+    SYLAR_ASSERT(ok == 20);
+    //回调协程复用或析构时都已销毁
+    SYLAR_LOG_INFO(g_logger) << "alive after scheduler=" << s_alive;
+    SYLAR_ASSERT(s_alive == 0);
+}
+
+// 手动创建的协程reset和析构时销毁
+void test_reset() {
+    sylar::Fiber::GetThis();
+    sylar::Fiber::ptr fiber(new sylar::Fiber([](){
+        s_ctx->id = 1;
+        s_ctx.set(Context());
+    }, 0, true));
+    fiber->call();
+    SYLAR_ASSERT(fiber->getState() == sylar::Fiber::TERM);
+    SYLAR_ASSERT(s_alive == 1);
+    fiber->reset(nullptr);
+    SYLAR_ASSERT(s_alive == 0);
+
+    fiber.reset(new sylar::Fiber([](){
+        s_ctx->id = 2;
+    }, 0, true));
+    fiber->call();
+    SYLAR_ASSERT(s_alive == 1);
+    fiber.reset();
+    SYLAR_ASSERT(s_alive == 0);
+
+    // 线程主协程上也可以使用
+    s_trace_id.set("main");
+    SYLAR_ASSERT(*s_trace_id.get() == "main");
+    s_trace_id.reset();
+    SYLAR_ASSERT(!s_trace_id.get());
+}
+
+int main(int argc, char** argv) {
+    SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::WARN);
+    test_isolation();
+    test_reset();
+    SYLAR_LOG_INFO(g_logger) << "test_fiber_local ok";
+    return 0;
+}
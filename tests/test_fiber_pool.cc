@@ -0,0 +1,91 @@
+#include "sylar/iomanager.h"
+#include "sylar/config.h"
+#include "sylar/fiber_local.h"
+#include "sylar/log.h"
+#include "sylar/macro.h"
+
+#include <unistd.h>
+#include <atomic>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static sylar::FiberLocal<int> s_local;
+
+// 每个回调都让出一次, cb_fiber不能复用, 下一个任务要换一个协程
+static void run_wave(sylar::IOManager& iom, int n, std::atomic<int>& done) {
+    for(int i = 0; i < n; ++i) {
+        iom.schedule([&done](){
+            SYLAR_ASSERT(!s_local.get());
+            s_local.set(1);
+            usleep(1000);
+            ++done;
+        });
+    }
+    while(done < n) {
+        usleep(1000);
+    }
+}
+
+void test_pool() {
+    sylar::IOManager iom(1, false, "fiber_pool");
+    std::atomic<int> done(0);
+    run_wave(iom, 50, done);
+    usleep(10 * 1000);
+    sylar::Scheduler::Stats s1 = iom.getStats();
+    SYLAR_LOG_INFO(g_logger) << "wave1 " << s1.toString();
+    SYLAR_ASSERT(s1.fiberPoolMisses > 0);
+    SYLAR_ASSERT(s1.fiberPoolRecycled > 0 && s1.fiberPooled > 0);
+
+    done = 0;
+    run_wave(iom, 50, done);
+    usleep(10 * 1000);
+    sylar::Scheduler::Stats s2 = iom.getStats();
+    SYLAR_LOG_INFO(g_logger) << "wave2 " << s2.toString();
+    //第二轮的协程从池中取
+    SYLAR_ASSERT(s2.fiberPoolHits > s1.fiberPoolHits);
+    SYLAR_ASSERT(s2.fiberPoolMisses - s1.fiberPoolMisses < s2.fiberPoolHits - s1.fiberPoolHits);
+
+    // Fiber::Create在工作线程上同样从池中取
+    std::atomic<bool> ok(false);
+    iom.schedule([&ok](){
+        SYLAR_ASSERT(sylar::Fiber::GetThreadPool());
+        uint64_t hits = sylar::Fiber::GetThreadPool()->getHits();
+        sylar::Fiber::ptr f = sylar::Fiber::Create([](){});
+        ok = f->getState() == sylar::Fiber::INIT
+            && sylar::Fiber::GetThreadPool()->getHits() == hits + 1;
+        sylar::Scheduler::GetThis()->schedule(f);
+    });
+    usleep(10 * 1000);
+    SYLAR_ASSERT(ok);
+}
+
+void test_cap() {
+    sylar::Config::Lookup<uint32_t>("fiber.pool_size")->setValue(4);
+    {
+        sylar::IOManager iom(1, false, "fiber_pool_cap");
+        std::atomic<int> done(0);
+        run_wave(iom, 30, done);
+        usleep(10 * 1000);
+        sylar::Scheduler::Stats s = iom.getStats();
+        SYLAR_LOG_INFO(g_logger) << "cap " << s.toString();
+        SYLAR_ASSERT(s.fiberPooled <= 4);
+    }
+    sylar::Config::Lookup<uint32_t>("fiber.pool_size")->setValue(0);
+    {
+        sylar::IOManager iom(1, false, "fiber_pool_off");
+        std::atomic<int> done(0);
+        run_wave(iom, 10, done);
+        SYLAR_ASSERT(iom.getStats().fiberPooled == 0);
+    }
+    // 不在调度线程上直接新建
+    SYLAR_ASSERT(!sylar::Fiber::GetThreadPool());
+    SYLAR_ASSERT(sylar::Fiber::Create([](){})->getState() == sylar::Fiber::INIT);
+}
+
+int main(int argc, char** argv) {
+    SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::WARN);
+    test_pool();
+    test_cap();
+    SYLAR_LOG_INFO(g_logger) << "test_fiber_pool ok";
+    return 0;
+}
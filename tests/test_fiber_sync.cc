@@ -0,0 +1,238 @@
+#include "sylar/fiber_sync.h"
+#include "sylar/iomanager.h"
+#include "sylar/log.h"
+#include "sylar/macro.h"
+#include "sylar/thread.h"
+#include "sylar/util.h"
+
+#include <unistd.h>
+#include <atomic>
+#include <vector>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+// 单线程上持锁的协程让出时, 其他协程挂起等待而不是阻塞线程
+void test_mutex() {
+    sylar::FiberMutex mutex;
+    int value = 0;
+    std::atomic<int> ticks(0);
+    {
+        sylar::IOManager iom(1, false, "mutex_io");
+        iom.schedule([&](){
+            sylar::FiberMutex::Lock lock(mutex);
+            for(int i = 0; i < 5; ++i) {
+                usleep(10 * 1000);
+                sylar::Fiber::YieldToReady();
+            }
+            value = 1;
+        });
+        for(int i = 0; i < 10; ++i) {
+            iom.schedule([&](){
+                sylar::FiberMutex::Lock lock(mutex);
+                SYLAR_ASSERT(value > 0);
+                ++value;
+            });
+        }
+        iom.schedule([&](){
+            if(value == 0) {
+                ++ticks;
+            }
+        });
+    }
+    SYLAR_ASSERT(value == 11);
+    //等锁的协程都挂起了, 持锁期间线程还能运行其他协程
+    SYLAR_ASSERT(ticks == 1);
+
+    // 多线程计数
+    int count = 0;
+    {
+        sylar::IOManager iom(4, false, "mutex_mt");
+        for(int i = 0; i < 8; ++i) {
+            iom.schedule([&](){
+                for(int j = 0; j < 1000; ++j) {
+                    sylar::FiberMutex::Lock lock(mutex);
+                    ++count;
+                    if(j % 100 == 0) {
+                        sylar::Fiber::YieldToReady();
+                    }
+                }
+            });
+        }
+    }
+    SYLAR_ASSERT(count == 8000);
+    SYLAR_ASSERT(mutex.tryLock());
+    mutex.unlock();
+}
+
+void test_mutex_timeout() {
+    sylar::FiberMutex mutex;
+    std::atomic<int> got(0);
+    std::atomic<int> timeout(0);
+    {
+        sylar::IOManager iom(2, false, "mutex_timeout");
+        iom.schedule([&](){
+            sylar::FiberMutex::Lock lock(mutex);
+            usleep(200 * 1000);
+        });
+        usleep(10 * 1000);
+        iom.schedule([&](){
+            uint64_t begin = sylar::GetCurrentMS();
+            if(mutex.lockFor(50)) {
+                ++got;
+                mutex.unlock();
+            } else {
+                ++timeout;
+                SYLAR_ASSERT(sylar::GetCurrentMS() - begin >= 45);
+            }
+        });
+        iom.schedule([&](){
+            if(mutex.lockFor(1000)) {
+                ++got;
+                mutex.unlock();
+            } else {
+                ++timeout;
+            }
+        });
+    }
+    SYLAR_LOG_INFO(g_logger) << "got=" << got << " timeout=" << timeout;
+    SYLAR_ASSERT(got == 1 && timeout == 1);
+}
+
+// 协程和普通线程混用
+void test_semaphore() {
+    sylar::FiberSemaphore sem;
+    std::atomic<int> done(0);
+    {
+        sylar::IOManager iom(1, false, "sem_io");
+        for(int i = 0; i < 5; ++i) {
+            iom.schedule([&](){
+                sem.wait();
+                ++done;
+            });
+        }
+        sylar::Thread t([&](){
+            usleep(50 * 1000);
+            sem.notify(3);
+            usleep(10 * 1000);
+            sem.notify(4);
+        }, "sem_notify");
+        t.join();
+    }
+    SYLAR_ASSERT(done == 5);
+    SYLAR_ASSERT(sem.getCount() == 2);
+    SYLAR_ASSERT(sem.tryWait() && sem.tryWait() && !sem.tryWait());
+
+    // 线程等待协程唤醒, 以及线程等待超时
+    SYLAR_ASSERT(!sem.waitFor(20));
+    {
+        sylar::IOManager iom(1, false, "sem_thread");
+        iom.schedule([&](){
+            usleep(20 * 1000);
+            sem.notify();
+        });
+        SYLAR_ASSERT(sem.waitFor(5000));
+    }
+
+    // 协程等待超时
+    std::atomic<bool> timeout(false);
+    {
+        sylar::IOManager iom(1, false, "sem_timeout");
+        iom.schedule([&](){
+            timeout = !sem.waitFor(30);
+        });
+    }
+    SYLAR_ASSERT(timeout);
+}
+
+// 生产者消费者
+void test_condition() {
+    sylar::FiberMutex mutex;
+    sylar::FiberCondition cond;
+    std::vector<int> items;
+    bool closed = false;
+    std::atomic<int> consumed(0);
+    {
+        sylar::IOManager iom(2, false, "cond_io");
+        for(int i = 0; i < 4; ++i) {
+            iom.schedule([&](){
+                sylar::FiberMutex::Lock lock(mutex);
+                while(true) {
+                    while(items.empty() && !closed) {
+                        cond.wait(lock);
+                    }
+                    if(items.empty()) {
+                        break;
+                    }
+                    items.pop_back();
+                    ++consumed;
+                }
+            });
+        }
+        iom.schedule([&](){
+            for(int i = 0; i < 1000; ++i) {
+                sylar::FiberMutex::Lock lock(mutex);
+                items.push_back(i);
+                cond.notify();
+                if(i % 50 == 0) {
+                    lock.unlock();
+                    sylar::Fiber::YieldToReady();
+                }
+            }
+            sylar::FiberMutex::Lock lock(mutex);
+            closed = true;
+            cond.notifyAll();
+        });
+    }
+    SYLAR_ASSERT(consumed == 1000);
+
+    // 超时后重新持有锁
+    {
+        sylar::IOManager iom(1, false, "cond_timeout");
+        iom.schedule([&](){
+            sylar::FiberMutex::Lock lock(mutex);
+            SYLAR_ASSERT(!cond.waitFor(lock, 20));
+            SYLAR_ASSERT(!mutex.tryLock());
+        });
+    }
+    SYLAR_ASSERT(mutex.tryLock());
+    mutex.unlock();
+}
+
+// 单线程上解锁/notify直接切换到等待的协程, 返回时它已经执行过
+void test_handoff() {
+    sylar::FiberMutex mutex;
+    sylar::FiberSemaphore sem;
+    std::vector<int> order;
+    {
+        sylar::IOManager iom(1, false, "handoff_io");
+        iom.schedule([&](){
+            mutex.lock();
+            //让等锁的协程先挂起
+            sylar::Fiber::YieldToReady();
+            order.push_back(1);
+            mutex.unlock();
+            order.push_back(3);
+            sem.notify();
+            order.push_back(5);
+        });
+        iom.schedule([&](){
+            mutex.lock();
+            order.push_back(2);
+            mutex.unlock();
+            sem.wait();
+            order.push_back(4);
+        });
+    }
+    SYLAR_ASSERT(order == std::vector<int>({1, 2, 3, 4, 5}));
+}
+
+int main(int argc, char** argv) {
+    SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::WARN);
+    test_mutex();
+    test_mutex_timeout();
+    test_semaphore();
+    test_condition();
+    test_handoff();
+    SYLAR_LOG_INFO(g_logger) << "test_fiber_sync ok";
+    return 0;
+}
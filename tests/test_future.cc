@@ -0,0 +1,117 @@
+#include "sylar/future.h"
+#include "sylar/iomanager.h"
+#include "sylar/log.h"
+#include "sylar/macro.h"
+#include "sylar/util.h"
+
+#include <unistd.h>
+#include <atomic>
+#include <stdexcept>
+#include <string>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+// 在协程中并发发出10个"后端调用", 等全部完成后汇总
+void test_fan_out() {
+    std::atomic<bool> ok(false);
+    {
+        sylar::IOManager iom(2, false, "future_io");
+        iom.schedule([&](){
+            uint64_t begin = sylar::GetCurrentMS();
+            std::vector<sylar::Future<int> > fs;
+            for(int i = 0; i < 10; ++i) {
+                fs.push_back(sylar::Async(&iom, [i](){
+                    usleep(50 * 1000);
+                    return i * i;
+                }));
+            }
+            sylar::WhenAll(fs).get();
+            int sum = 0;
+            for(auto& f : fs) {
+                SYLAR_ASSERT(f.isReady());
+                sum += f.get();
+            }
+            uint64_t used = sylar::GetCurrentMS() - begin;
+            SYLAR_LOG_INFO(g_logger) << "fan out sum=" << sum << " used=" << used << "ms";
+            //hook的usleep只挂起协程, 10个调用并发执行
+            SYLAR_ASSERT(sum == 285 && used < 400);
+            ok = true;
+        });
+    }
+    SYLAR_ASSERT(ok);
+}
+
+void test_any_and_error() {
+    sylar::IOManager iom(2, false, "future_any");
+    std::vector<sylar::Future<std::string> > fs;
+    fs.push_back(sylar::Async(&iom, [](){
+        usleep(200 * 1000);
+        return std::string("slow");
+    }));
+    fs.push_back(sylar::Async(&iom, [](){
+        usleep(10 * 1000);
+        return std::string("fast");
+    }));
+    // 不在协程中, 阻塞线程等待
+    size_t idx = sylar::WhenAny(fs).get();
+    SYLAR_ASSERT(idx == 1 && fs[1].get() == "fast");
+    SYLAR_ASSERT(!fs[0].isReady());
+    SYLAR_ASSERT(fs[0].get() == "slow");
+
+    sylar::Future<void> err = sylar::Async(&iom, [](){
+        throw std::runtime_error("backend error");
+    });
+    bool caught = false;
+    try {
+        err.get();
+    } catch(std::runtime_error& e) {
+        caught = std::string(e.what()) == "backend error";
+    }
+    SYLAR_ASSERT(caught);
+
+    std::atomic<bool> timeout(false);
+    sylar::Promise<int> never;
+    iom.schedule([&](){
+        timeout = !never.getFuture().waitFor(30);
+        never.setValue(1);
+    });
+    SYLAR_ASSERT(never.getFuture().get() == 1);
+    SYLAR_ASSERT(timeout);
+
+    // 空列表
+    SYLAR_ASSERT(sylar::WhenAll(std::vector<sylar::Future<int> >()).isReady());
+}
+
+void test_wait_group() {
+    sylar::WaitGroup wg;
+    std::atomic<int> done(0);
+    std::atomic<bool> ok(false);
+    {
+        sylar::IOManager iom(2, false, "wait_group");
+        iom.schedule([&](){
+            for(int i = 0; i < 10; ++i) {
+                wg.add();
+                sylar::IOManager::GetThis()->schedule([&](){
+                    usleep(20 * 1000);
+                    ++done;
+                    wg.done();
+                });
+            }
+            SYLAR_ASSERT(!wg.waitFor(5));
+            wg.wait();
+            SYLAR_ASSERT(done == 10 && wg.getCount() == 0);
+            ok = true;
+        });
+    }
+    SYLAR_ASSERT(ok);
+    wg.wait();
+}
+
+int main(int argc, char** argv) {
+    SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::WARN);
+    test_fan_out();
+    test_any_and_error();
+    test_wait_group();
+    SYLAR_LOG_INFO(g_logger) << "test_future ok";
+    return 0;
+}
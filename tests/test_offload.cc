@@ -0,0 +1,165 @@
+#include "sylar/offload.h"
+#include "sylar/iomanager.h"
+#include "sylar/config.h"
+#include "sylar/log.h"
+#include "sylar/macro.h"
+#include "sylar/util.h"
+
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <atomic>
+#include <stdexcept>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+// 池里阻塞200ms期间, 同一个线程上的其他协程照常运行
+void test_resume() {
+    sylar::OffloadPool pool(2, 16, "test_offload");
+    std::atomic<int> ticks(0);
+    std::atomic<bool> done(false);
+    {
+        sylar::IOManager iom(1, false, "offload_io");
+        iom.schedule([&](){
+            while(!done) {
+                usleep(10 * 1000);
+                ++ticks;
+            }
+        });
+        iom.schedule([&](){
+            sylar::Scheduler* sc = sylar::Scheduler::GetThis();
+            int tid = 0;
+            SYLAR_ASSERT(pool.run([&](){
+                tid = sylar::GetThreadId();
+                usleep(200 * 1000);
+            }));
+            SYLAR_ASSERT(sylar::Scheduler::GetThis() == sc);
+            SYLAR_ASSERT(tid != sylar::GetThreadId());
+            SYLAR_LOG_INFO(g_logger) << "ticks during offload=" << ticks;
+            SYLAR_ASSERT(ticks >= 5);
+
+            bool caught = false;
+            try {
+                pool.run([](){
+                    throw std::logic_error("offload error");
+                });
+            } catch(std::logic_error& e) {
+                caught = true;
+            }
+            SYLAR_ASSERT(caught);
+            done = true;
+        });
+    }
+    sylar::OffloadPool::Stats s = pool.getStats();
+    SYLAR_LOG_INFO(g_logger) << s.toString();
+    SYLAR_ASSERT(s.submitted == 2 && s.completed == 2);
+    SYLAR_ASSERT(s.runTime.count == 2);
+
+    // 不在协程中直接执行
+    int v = 0;
+    SYLAR_ASSERT(pool.run([&v](){ v = 1;}));
+    SYLAR_ASSERT(v == 1 && pool.getStats().inlined == 1);
+}
+
+// 1个线程, 排队上限1: 最多一个执行一个排队, 其余拒绝
+void test_reject() {
+    sylar::OffloadPool pool(1, 1, "test_reject");
+    std::atomic<int> accepted(0);
+    std::atomic<int> rejected(0);
+    {
+        sylar::IOManager iom(1, false, "reject_io");
+        for(int i = 0; i < 4; ++i) {
+            iom.schedule([&](){
+                if(pool.run([](){ usleep(50 * 1000);})) {
+                    ++accepted;
+                } else {
+                    ++rejected;
+                }
+            });
+        }
+    }
+    SYLAR_LOG_INFO(g_logger) << "accepted=" << accepted << " rejected=" << rejected
+        << " " << pool.getStats().toString();
+    //池线程取走第一个之前第二个就来了的话, 只接受一个
+    SYLAR_ASSERT(accepted >= 1 && accepted <= 2 && accepted + rejected == 4);
+    SYLAR_ASSERT(pool.getStats().rejected == (uint64_t)rejected);
+}
+
+void test_file_io() {
+    sylar::Config::Lookup<bool>("offload.file_io")->setValue(true);
+    uint64_t before = sylar::OffloadPool::GetDefault()->getStats().submitted;
+    {
+        sylar::IOManager iom(1, false, "file_io");
+        iom.schedule([](){
+            const char* path = "/tmp/sylar_test_offload";
+            int fd = open(path, O_CREAT | O_TRUNC | O_RDWR, 0644);
+            SYLAR_ASSERT(fd >= 0);
+            SYLAR_ASSERT(write(fd, "hello", 5) == 5);
+            lseek(fd, 0, SEEK_SET);
+            char buf[8] = {0};
+            SYLAR_ASSERT(read(fd, buf, sizeof(buf)) == 5);
+            SYLAR_ASSERT(std::string(buf) == "hello");
+            close(fd);
+            unlink(path);
+        });
+    }
+    sylar::Config::Lookup<bool>("offload.file_io")->setValue(false);
+    SYLAR_ASSERT(sylar::OffloadPool::GetDefault()->getStats().submitted == before + 2);
+}
+
+// 共享栈协程挂起后栈被同线程的其他协程占用, offload在当前线程直接执行
+void test_shared_stack() {
+    sylar::OffloadPool pool(1, 16, "test_shared");
+    sylar::Config::Lookup<bool>("offload.file_io")->setValue(true);
+    uint64_t before = sylar::OffloadPool::GetDefault()->getStats().submitted;
+    std::atomic<bool> done(false);
+    {
+        sylar::IOManager iom(1, false, "shared_io");
+        iom.schedule(std::make_shared<sylar::Fiber>([&pool, &done](){
+            int tid = 0;
+            char buf[64] = {0};
+            SYLAR_ASSERT(pool.run([&](){
+                tid = sylar::GetThreadId();
+                strcpy(buf, "offload");
+            }));
+            SYLAR_ASSERT(tid == sylar::GetThreadId());
+            SYLAR_ASSERT(std::string(buf) == "offload");
+
+            const char* path = "/tmp/sylar_test_offload_shared";
+            int fd = open(path, O_CREAT | O_TRUNC | O_RDWR, 0644);
+            SYLAR_ASSERT(fd >= 0);
+            SYLAR_ASSERT(write(fd, "hello", 5) == 5);
+            lseek(fd, 0, SEEK_SET);
+            memset(buf, 0, sizeof(buf));
+            SYLAR_ASSERT(read(fd, buf, sizeof(buf)) == 5);
+            SYLAR_ASSERT(std::string(buf) == "hello");
+            close(fd);
+            unlink(path);
+            done = true;
+        }, 0, false, true));
+        //和上面的协程轮流使用同一个共享栈
+        iom.schedule(std::make_shared<sylar::Fiber>([&done](){
+            while(!done) {
+                char junk[4096];
+                memset(junk, 'x', sizeof(junk));
+                usleep(1000);
+                SYLAR_ASSERT(junk[0] == 'x' && junk[sizeof(junk) - 1] == 'x');
+            }
+        }, 0, false, true));
+    }
+    sylar::Config::Lookup<bool>("offload.file_io")->setValue(false);
+    sylar::OffloadPool::Stats s = pool.getStats();
+    SYLAR_LOG_INFO(g_logger) << "shared " << s.toString();
+    SYLAR_ASSERT(done);
+    SYLAR_ASSERT(s.submitted == 0 && s.inlined == 1);
+    SYLAR_ASSERT(sylar::OffloadPool::GetDefault()->getStats().submitted == before);
+}
+
+int main(int argc, char** argv) {
+    SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::WARN);
+    test_resume();
+    test_reject();
+    test_file_io();
+    test_shared_stack();
+    return 0;
+}
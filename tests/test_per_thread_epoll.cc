@@ -0,0 +1,126 @@
+#include "sylar/iomanager.h"
+#include "sylar/config.h"
+#include "sylar/log.h"
+#include "sylar/macro.h"
+#include "sylar/util.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <atomic>
+#include <map>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static const int PIPES = 8;
+static const int ROUNDS = 5;
+
+static void set_mode(const std::string& name, bool per_thread) {
+    std::map<std::string, bool> v;
+    v[name] = per_thread;
+    sylar::Config::Lookup<std::map<std::string, bool> >("iomanager.per_thread_epoll")->setValue(v);
+}
+
+// 每轮等fd可读, 记录被唤醒时是否换了线程; 另有协程一直占着CPU, 事件要靠poll()收取
+void test_wait(const std::string& name, bool per_thread) {
+    set_mode(name, per_thread);
+    int fds[PIPES][2];
+    for(int i = 0; i < PIPES; ++i) {
+        SYLAR_ASSERT(!pipe(fds[i]));
+        fcntl(fds[i][0], F_SETFL, O_NONBLOCK);
+    }
+    std::atomic<int> moved(0);
+    std::atomic<int> timeouts(0);
+    std::atomic<int> done(0);
+    std::atomic<int> cb_done(0);
+    {
+        sylar::IOManager iom(3, false, name);
+        SYLAR_ASSERT(iom.isPerThreadEpoll() == per_thread);
+        for(int i = 0; i < PIPES; ++i) {
+            int fd = fds[i][0];
+            iom.schedule([&, fd](){
+                sylar::IOManager* cur = sylar::IOManager::GetThis();
+                for(int r = 0; r < ROUNDS; ++r) {
+                    int tid = sylar::GetThreadId();
+                    cur->addEvent(fd, sylar::IOManager::READ);
+                    sylar::Fiber::YieldToHold();
+                    if(sylar::GetThreadId() != tid) {
+                        ++moved;
+                    }
+                    char c = 0;
+                    SYLAR_ASSERT(read(fd, &c, 1) == 1);
+                }
+                //超时由任意线程上的定时器取消, 协程同样回到fd所属的线程
+                int tid = sylar::GetThreadId();
+                cur->addEvent(fd, sylar::IOManager::READ);
+                cur->addTimer(10, [cur, fd](){
+                    cur->cancelEvent(fd, sylar::IOManager::READ);
+                });
+                sylar::Fiber::YieldToHold();
+                ++timeouts;
+                if(sylar::GetThreadId() != tid) {
+                    ++moved;
+                }
+                ++done;
+            });
+        }
+        for(int i = 0; i < 2; ++i) {
+            iom.schedule([&done](){
+                while(done < PIPES) {
+                    sylar::Fiber::YieldToReady();
+                }
+            });
+        }
+        usleep(10 * 1000);
+        for(int r = 0; r < ROUNDS; ++r) {
+            for(int i = 0; i < PIPES; ++i) {
+                SYLAR_ASSERT(write(fds[i][1], "x", 1) == 1);
+            }
+            usleep(5 * 1000);
+        }
+
+        // 外部线程注册的回调, fd轮流分给工作线程
+        int pfd[2];
+        SYLAR_ASSERT(!pipe(pfd));
+        iom.addEvent(pfd[0], sylar::IOManager::READ, [&cb_done](){
+            ++cb_done;
+        });
+        SYLAR_ASSERT(write(pfd[1], "x", 1) == 1);
+        while(done < PIPES || cb_done == 0) {
+            usleep(1000);
+        }
+        close(pfd[0]);
+        close(pfd[1]);
+        SYLAR_LOG_INFO(g_logger) << name << " " << iom.getIOStats().toString();
+    }
+    for(int i = 0; i < PIPES; ++i) {
+        close(fds[i][0]);
+        close(fds[i][1]);
+    }
+    SYLAR_LOG_INFO(g_logger) << name << " per_thread=" << per_thread << " moved=" << moved;
+    SYLAR_ASSERT(done == PIPES && timeouts == PIPES && cb_done == 1);
+    if(per_thread) {
+        SYLAR_ASSERT(moved == 0);
+    }
+}
+
+// 停止时阻塞在各自epoll上的线程都要被唤醒
+void test_stop() {
+    set_mode("pte_stop", true);
+    uint64_t begin = sylar::GetCurrentMS();
+    {
+        sylar::IOManager iom(4, false, "pte_stop");
+        usleep(10 * 1000);
+    }
+    uint64_t used = sylar::GetCurrentMS() - begin;
+    SYLAR_LOG_INFO(g_logger) << "stop used=" << used << "ms";
+    SYLAR_ASSERT(used < 1000);
+}
+
+int main(int argc, char** argv) {
+    SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::WARN);
+    test_wait("pte_shared", false);
+    test_wait("pte_per_thread", true);
+    test_stop();
+    SYLAR_LOG_INFO(g_logger) << "test_per_thread_epoll ok";
+    return 0;
+}
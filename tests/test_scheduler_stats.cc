@@ -0,0 +1,111 @@
+#include "sylar/scheduler.h"
+#include "sylar/iomanager.h"
+#include "sylar/histogram.h"
+#include "sylar/log.h"
+#include "sylar/macro.h"
+
+#include <unistd.h>
+#include <atomic>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+void test_histogram() {
+    sylar::Histogram h;
+    for(uint64_t i = 1; i <= 1000; ++i) {
+        h.record(i);
+    }
+    sylar::Histogram::Snapshot s;
+    h.snapshot(s);
+    SYLAR_ASSERT(s.count == 1000);
+    SYLAR_ASSERT(s.sum == 500500);
+    SYLAR_ASSERT(s.max == 1000);
+    // 桶的上界是2的幂减1, 误差在两倍以内
+    uint64_t p50 = s.percentile(0.5);
+    SYLAR_ASSERT(p50 >= 500 && p50 < 1024);
+    SYLAR_ASSERT(s.percentile(1) == 1000);
+    SYLAR_LOG_INFO(g_logger) << "histogram: " << s.toString();
+}
+
+void test_scheduler() {
+    static const int N = 1000;
+    static std::atomic<int> s_count(0);
+    sylar::Scheduler sc(2, false, "stats");
+    sc.start();
+    for(int i = 0; i < N; ++i) {
+        sc.schedule([](){
+            ++s_count;
+            sylar::Fiber::YieldToReady();
+        });
+    }
+    while(s_count < N) {
+        usleep(1000);
+    }
+    // 运行中读取
+    SYLAR_LOG_INFO(g_logger) << "running: " << sc.getStats().toString();
+    sc.stop();
+
+    sylar::Scheduler::Stats s = sc.getStats();
+    SYLAR_LOG_INFO(g_logger) << "stopped: " << s.toString();
+    // 每个回调切入两次: 第一次执行到YieldToReady, 第二次执行完
+    SYLAR_ASSERT(s.queueDelay.count == N * 2);
+    SYLAR_ASSERT(s.runTime.count == N * 2);
+    SYLAR_ASSERT(s.queued[sylar::Scheduler::NORMAL] == 0);
+}
+
+// 协程指定到另一个线程再让出, 对方常常在它切出完成前取到任务.
+// 这样的任务留在对方线程上等它切出, 每次切入仍只统计一次
+class SwitchingScheduler : public sylar::Scheduler {
+public:
+    SwitchingScheduler()
+        :sylar::Scheduler(2, false, "switching") {
+    }
+    const std::vector<int>& threads() const { return m_threadIds;}
+};
+
+void test_switching() {
+    static const int N = 500;
+    static int s_hops = 0;
+    SwitchingScheduler sc;
+    sc.start();
+    std::vector<int> threads = sc.threads();
+    SYLAR_ASSERT(threads.size() == 2);
+    sc.schedule([threads](){
+        sylar::Scheduler* sc = sylar::Scheduler::GetThis();
+        for(int i = 0; i < N; ++i) {
+            int other = threads[0] == sylar::GetThreadId() ? threads[1] : threads[0];
+            sc->schedule(sylar::Fiber::GetThis(), other);
+            sylar::Fiber::YieldToHold();
+            SYLAR_ASSERT(sylar::GetThreadId() == other);
+            ++s_hops;
+        }
+    });
+    sc.stop();
+    sylar::Scheduler::Stats s = sc.getStats();
+    SYLAR_LOG_INFO(g_logger) << "switching: " << s.toString();
+    SYLAR_ASSERT(s_hops == N);
+    SYLAR_ASSERT(s.queueDelay.count == N + 1);
+    SYLAR_ASSERT(s.runTime.count == N + 1);
+}
+
+void test_iomanager() {
+    sylar::IOManager iom(1, false, "stats_io");
+    iom.schedule([](){
+        for(int i = 0; i < 10; ++i) {
+            usleep(1000);
+        }
+    });
+    iom.stop();
+    sylar::IOManager::IOStats s = iom.getIOStats();
+    SYLAR_LOG_INFO(g_logger) << "io: " << s.toString();
+    SYLAR_ASSERT(s.timers == 10);
+    SYLAR_ASSERT(s.pendingEvents == 0);
+}
+
+int main(int argc, char** argv) {
+    SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::WARN);
+    test_histogram();
+    test_scheduler();
+    test_switching();
+    test_iomanager();
+    return 0;
+}
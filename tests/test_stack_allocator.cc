@@ -0,0 +1,78 @@
+#include "sylar/stack_allocator.h"
+#include "sylar/scheduler.h"
+#include "sylar/config.h"
+#include "sylar/log.h"
+#include "sylar/macro.h"
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+void print_stats(const std::string& tag) {
+    sylar::StackAllocator::Stats s = sylar::StackAllocator::GetStats();
+    SYLAR_LOG_INFO(g_logger) << tag
+        << " allocs=" << s.allocs
+        << " frees=" << s.frees
+        << " hits=" << s.pool_hits
+        << " misses=" << s.pool_misses
+        << " hit_rate=" << s.hitRate()
+        << " mapped_bytes=" << s.mapped_bytes
+        << " resident_bytes=" << s.resident_bytes;
+}
+
+void test_pool() {
+    sylar::StackAllocator::Type type;
+    void* s1 = sylar::StackAllocator::Alloc(128 * 1024, type);
+    SYLAR_ASSERT(type == sylar::StackAllocator::POOLED);
+    sylar::StackAllocator::Dealloc(s1, 128 * 1024, type);
+
+    // 同线程同尺寸, 应复用刚释放的栈
+    void* s2 = sylar::StackAllocator::Alloc(128 * 1024, type);
+    SYLAR_ASSERT(s1 == s2);
+    sylar::StackAllocator::Dealloc(s2, 128 * 1024, type);
+    print_stats("test_pool");
+}
+
+void test_fiber() {
+    static int s_count = 0;
+    sylar::Scheduler sc(2, false, "stack");
+    sc.start();
+    for(int i = 0; i < 1000; ++i) {
+        sc.schedule(sylar::Fiber::ptr(new sylar::Fiber([](){
+            ++s_count;
+        })));
+    }
+    sc.stop();
+    SYLAR_LOG_INFO(g_logger) << "fibers done count=" << s_count;
+    print_stats("test_fiber");
+}
+
+// 栈溢出应命中保护页, 进程收到SIGSEGV
+void overflow(int depth) {
+    char buf[1024];
+    memset(buf, depth, sizeof(buf));
+    if(depth > 0) {
+        overflow(depth - 1);
+    }
+}
+
+void test_guard_page() {
+    sylar::Scheduler sc(1, false, "guard");
+    sc.start();
+    sc.schedule(sylar::Fiber::ptr(new sylar::Fiber([](){
+        overflow(1024);
+    }, 64 * 1024)));
+    sc.stop();
+}
+
+int main(int argc, char** argv) {
+    test_pool();
+    test_fiber();
+
+    sylar::Config::Lookup<std::string>("fiber.stack_allocator")->setValue("malloc");
+    test_fiber();
+
+    if(argc > 1 && std::string(argv[1]) == "-g") {
+        sylar::Config::Lookup<std::string>("fiber.stack_allocator")->setValue("pooled");
+        test_guard_page();
+    }
+    return 0;
+}
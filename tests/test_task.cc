@@ -0,0 +1,110 @@
+#include "sylar/scheduler.h"
+#include "sylar/task.h"
+#include "sylar/log.h"
+#include "sylar/macro.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <atomic>
+#include <new>
+
+/*
+  统计调度路径上的内存分配, 预热之后schedule和执行都不应该再malloc
+*/
+
+static std::atomic<uint64_t> s_news(0);
+
+void* operator new(size_t size) {
+    ++s_news;
+    void* p = malloc(size ? size : 1);
+    if(!p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void* p) noexcept {
+    free(p);
+}
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static const int N = 100000;
+static std::atomic<int> s_count(0);
+
+// 工作线程内schedule回调: 走本线程队列, 回调在复用的cb_fiber中执行
+void test_local() {
+    sylar::Scheduler sc(1, false, "local");
+    sc.start();
+    uint64_t news = 0;
+    sc.schedule([&news](){
+        sylar::Scheduler* sc = sylar::Scheduler::GetThis();
+        for(int i = 0; i < N; ++i) {
+            if(i == 5000) {
+                news = s_news;
+            }
+            sc->schedule([](){ ++s_count;});
+            sylar::Fiber::YieldToReady();
+        }
+        news = s_news - news;
+    });
+    sc.stop();
+    SYLAR_LOG_INFO(g_logger) << "local: count=" << s_count << " operator new=" << news;
+    SYLAR_ASSERT(news == 0);
+}
+
+// 外部线程schedule回调: 走全局队列, 节点在工作线程回收, 经全局空闲链表回到本线程
+void test_external() {
+    sylar::Scheduler sc(1, false, "external");
+    sc.start();
+    uint64_t news = 0;
+    // 每批1000个, 在途的任务数有上限; 预热几批后工作线程的本地链表也填满了,
+    // 之后本线程取的节点全部来自全局空闲链表
+    s_count = 0;
+    for(int i = 0; i < N; i += 1000) {
+        if(i == 5000) {
+            news = s_news;
+        }
+        for(int j = 0; j < 1000; ++j) {
+            sc.schedule([](){ ++s_count;});
+        }
+        while(s_count < i + 1000) {
+            usleep(100);
+        }
+    }
+    news = s_news - news;
+    sc.stop();
+    SYLAR_LOG_INFO(g_logger) << "external: count=" << s_count << " operator new=" << news
+        << " task mallocs=" << sylar::Task::GetStats().mallocs;
+    // s_count加一时最后一个节点可能还没回收, 偶尔会多分配一个节点
+    SYLAR_ASSERT(news < N / 1000);
+}
+
+// 空回调和原来一样不入队
+void test_null() {
+    sylar::Scheduler sc(1, false, "null");
+    sc.start();
+    void (*fn)() = nullptr;
+    std::function<void()> cb;
+    sc.schedule(fn);
+    sc.schedule(cb);
+    sc.schedule(nullptr);
+    sc.schedule(sylar::Fiber::ptr());
+    sc.stop();
+
+    sylar::Task* task = sylar::Task::Create();
+    SYLAR_ASSERT(!task->assign(fn));
+    SYLAR_ASSERT(!task->hasCallback());
+    SYLAR_ASSERT(task->assign(&test_external));
+    SYLAR_ASSERT(task->hasCallback());
+    sylar::Task::Destroy(task);
+}
+
+int main(int argc, char** argv) {
+    // Scheduler::tickle的INFO日志会分配内存
+    SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::WARN);
+    test_local();
+    test_external();
+    test_null();
+    return 0;
+}
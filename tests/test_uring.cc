@@ -0,0 +1,214 @@
+#include "sylar/iomanager.h"
+#include "sylar/config.h"
+#include "sylar/hook.h"
+#include "sylar/log.h"
+#include "sylar/macro.h"
+#include "sylar/socket.h"
+#include "sylar/util.h"
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <atomic>
+#include <map>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static const int CLIENTS = 4;
+static const int ROUNDS = 20;
+static std::atomic<uint16_t> s_port(18600);
+
+static void set_backend(const std::string& backend) {
+    sylar::Config::Lookup<std::string>("iomanager.backend")->setValue(backend);
+}
+
+static void set_per_thread(const std::string& name, bool per_thread) {
+    std::map<std::string, bool> v;
+    v[name] = per_thread;
+    sylar::Config::Lookup<std::map<std::string, bool> >("iomanager.per_thread_epoll")->setValue(v);
+}
+
+// 要在协程中创建, 主线程没有开启hook, 建出来的socket是阻塞的
+static sylar::Socket::ptr listen_on(uint16_t port) {
+    sylar::Address::ptr addr = sylar::IPv4Address::Create("127.0.0.1", port);
+    sylar::Socket::ptr sock = sylar::Socket::CreateTCP(addr);
+    int val = 1;
+    sock->setOption(SOL_SOCKET, SO_REUSEADDR, val);
+    SYLAR_ASSERT(sock->bind(addr));
+    SYLAR_ASSERT(sock->listen());
+    return sock;
+}
+
+// 每个客户端连上后来回ROUNDS次, accept/connect/recv/send都走hook
+static void run_echo(sylar::IOManager& iom) {
+    uint16_t port = s_port++;
+    std::atomic<int> done(0);
+    std::atomic<bool> listening(false);
+    iom.schedule([port, &listening](){
+        sylar::Socket::ptr server = listen_on(port);
+        listening = true;
+        for(int i = 0; i < CLIENTS; ++i) {
+            sylar::Socket::ptr client = server->accept();
+            SYLAR_ASSERT(client);
+            sylar::IOManager::GetThis()->schedule([client](){
+                char buf[64];
+                while(true) {
+                    int n = client->recv(buf, sizeof(buf));
+                    if(n <= 0) {
+                        break;
+                    }
+                    SYLAR_ASSERT(client->send(buf, n) == n);
+                }
+                client->close();
+            });
+        }
+    });
+    while(!listening) {
+        usleep(1000);
+    }
+    for(int i = 0; i < CLIENTS; ++i) {
+        iom.schedule([port, i, &done](){
+            sylar::Address::ptr addr = sylar::IPv4Address::Create("127.0.0.1", port);
+            sylar::Socket::ptr sock = sylar::Socket::CreateTCP(addr);
+            SYLAR_ASSERT(sock->connect(addr, 1000));
+            for(int r = 0; r < ROUNDS; ++r) {
+                std::string msg = std::to_string(i) + "-" + std::to_string(r);
+                SYLAR_ASSERT(sock->send(msg.c_str(), msg.size()) == (int)msg.size());
+                char buf[64];
+                int n = sock->recv(buf, sizeof(buf));
+                SYLAR_ASSERT(n == (int)msg.size());
+                SYLAR_ASSERT(std::string(buf, n) == msg);
+            }
+            sock->close();
+            ++done;
+        });
+    }
+    while(done < CLIENTS) {
+        usleep(1000);
+    }
+}
+
+// 接收超时和close唤醒阻塞中的accept
+static void run_cancel(sylar::IOManager& iom) {
+    uint16_t port = s_port++;
+    sylar::Socket::ptr server;
+    std::atomic<int> timeout_errno(0);
+    std::atomic<bool> accept_back(false);
+    std::atomic<bool> listening(false);
+    iom.schedule([port, &server, &listening, &accept_back](){
+        server = listen_on(port);
+        listening = true;
+        //第一次accept等到连接, 第二次一直阻塞到close
+        sylar::Socket::ptr client = server->accept();
+        SYLAR_ASSERT(client);
+        sylar::Socket::ptr none = server->accept();
+        SYLAR_ASSERT(!none);
+        accept_back = true;
+    });
+    while(!listening) {
+        usleep(1000);
+    }
+    iom.schedule([port, server, &timeout_errno](){
+        sylar::Address::ptr addr = sylar::IPv4Address::Create("127.0.0.1", port);
+        sylar::Socket::ptr sock = sylar::Socket::CreateTCP(addr);
+        SYLAR_ASSERT(sock->connect(addr, 1000));
+        sock->setRecvTimeout(20);
+        char buf[16];
+        uint64_t begin = sylar::GetCurrentMS();
+        int n = sock->recv(buf, sizeof(buf));
+        uint64_t used = sylar::GetCurrentMS() - begin;
+        SYLAR_LOG_INFO(g_logger) << "recv timeout rt=" << n << " errno=" << errno
+            << " used=" << used << "ms";
+        SYLAR_ASSERT(n == -1);
+        SYLAR_ASSERT(used < 1000);
+        timeout_errno = errno;
+        sock->close();
+        server->close();
+    });
+    uint64_t begin = sylar::GetCurrentMS();
+    while(!accept_back && sylar::GetCurrentMS() - begin < 2000) {
+        usleep(1000);
+    }
+    SYLAR_ASSERT(accept_back);
+    SYLAR_ASSERT(timeout_errno == ETIMEDOUT);
+}
+
+void test_backend(const std::string& name, const std::string& backend
+                  ,bool per_thread) {
+    set_backend(backend);
+    set_per_thread(name, per_thread);
+    uint64_t io_calls = sylar::get_hook_io_calls();
+    sylar::IOManager::IOStats stats;
+    bool uring = false;
+    {
+        sylar::IOManager iom(2, false, name);
+        uring = iom.hasUring();
+        run_echo(iom);
+        run_cancel(iom);
+        stats = iom.getIOStats();
+    }
+    SYLAR_LOG_INFO(g_logger) << name << " backend=" << backend << " uring=" << uring
+        << " hook_io_calls=" << sylar::get_hook_io_calls() - io_calls
+        << " " << stats.toString();
+    if(backend == "io_uring" && uring) {
+        SYLAR_ASSERT(stats.uringOps > 0);
+        SYLAR_ASSERT(stats.uringEnters > 0);
+    } else {
+        SYLAR_ASSERT(!uring);
+        SYLAR_ASSERT(stats.uringOps == 0 && stats.uringEnters == 0);
+    }
+}
+
+// 共享栈协程挂起时栈上是同线程的其他协程, 它的accept/recv走epoll, 不交给io_uring
+void test_shared_stack() {
+    set_backend("io_uring");
+    set_per_thread("uring_shared_stack", false);
+    uint16_t port = s_port++;
+    std::atomic<bool> received(false);
+    sylar::IOManager::IOStats stats;
+    {
+        sylar::IOManager iom(1, false, "uring_shared_stack");
+        iom.schedule(std::make_shared<sylar::Fiber>([port, &received](){
+            sylar::Socket::ptr server = listen_on(port);
+            sylar::Socket::ptr client = server->accept();
+            SYLAR_ASSERT(client);
+            char buf[64];
+            int n = client->recv(buf, sizeof(buf));
+            SYLAR_ASSERT(n == 5);
+            SYLAR_ASSERT(std::string(buf, n) == "hello");
+            received = true;
+        }, 0, false, true));
+        iom.schedule(std::make_shared<sylar::Fiber>([port](){
+            sylar::Address::ptr addr = sylar::IPv4Address::Create("127.0.0.1", port);
+            sylar::Socket::ptr sock = sylar::Socket::CreateTCP(addr);
+            SYLAR_ASSERT(sock->connect(addr, 1000));
+            //对方挂起在recv中时占用共享栈
+            char junk[4096];
+            memset(junk, 'x', sizeof(junk));
+            usleep(10 * 1000);
+            SYLAR_ASSERT(sock->send("hello", 5) == 5);
+            SYLAR_ASSERT(junk[sizeof(junk) - 1] == 'x');
+            usleep(10 * 1000);
+            sock->close();
+        }, 0, false, true));
+        uint64_t begin = sylar::GetCurrentMS();
+        while(!received && sylar::GetCurrentMS() - begin < 2000) {
+            usleep(1000);
+        }
+        stats = iom.getIOStats();
+    }
+    SYLAR_LOG_INFO(g_logger) << "uring_shared_stack " << stats.toString();
+    SYLAR_ASSERT(received);
+    SYLAR_ASSERT(stats.uringOps == 0);
+}
+
+int main(int argc, char** argv) {
+    SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::WARN);
+    test_backend("uring_epoll", "epoll", false);
+    test_backend("uring_shared", "io_uring", false);
+    test_backend("uring_per_thread", "io_uring", true);
+    test_shared_stack();
+    set_backend("epoll");
+    SYLAR_LOG_INFO(g_logger) << "test_uring ok";
+    return 0;
+}
@@ -0,0 +1,79 @@
+#include "sylar/scheduler.h"
+#include "sylar/config.h"
+#include "sylar/log.h"
+#include "sylar/macro.h"
+#include "sylar/util.h"
+
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+#include <atomic>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static volatile uint64_t s_sink = 0;
+static std::atomic<int> s_app_signals(0);
+
+// 应用自己的SIGURG处理函数, 看门狗安装后仍要收到不是看门狗发的信号
+static void app_handler(int sig) {
+    ++s_app_signals;
+}
+
+static bool app_handler_installed() {
+    struct sigaction sa;
+    sigaction(SIGURG, nullptr, &sa);
+    return !(sa.sa_flags & SA_SIGINFO) && sa.sa_handler == &app_handler;
+}
+
+// 不让出地计算ms毫秒, 看门狗的日志里应能看到这个函数
+void busy_loop(uint64_t ms) {
+    uint64_t end = sylar::GetCurrentMS() + ms;
+    while(sylar::GetCurrentMS() < end) {
+        for(int i = 0; i < 1000; ++i) {
+            s_sink += i;
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::WARN);
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = &app_handler;
+    sigemptyset(&sa.sa_mask);
+    SYLAR_ASSERT(!sigaction(SIGURG, &sa, nullptr));
+
+    //默认关闭, 不改动信号处理
+    {
+        sylar::Scheduler off(1, false, "watchdog_off");
+        off.start();
+        off.stop();
+        SYLAR_ASSERT(off.getStats().longSlices == 0);
+        SYLAR_ASSERT(app_handler_installed());
+    }
+
+    sylar::Config::Lookup<uint32_t>("scheduler.watchdog_threshold")->setValue(50);
+
+    sylar::Scheduler sc(2, false, "watchdog");
+    sc.start();
+    sc.schedule([](){
+        busy_loop(300);
+    });
+    for(int i = 0; i < 100; ++i) {
+        sc.schedule([](){
+            busy_loop(1);
+        });
+    }
+    sc.stop();
+
+    sylar::Scheduler::Stats s = sc.getStats();
+    SYLAR_LOG_INFO(g_logger) << s.toString();
+    SYLAR_ASSERT(s.longSlices == 1);
+
+    //进程内其他来源的SIGURG转给原来的处理函数
+    SYLAR_ASSERT(!app_handler_installed());
+    kill(getpid(), SIGURG);
+    pthread_kill(pthread_self(), SIGURG);
+    SYLAR_ASSERT(s_app_signals == 2);
+    return 0;
+}